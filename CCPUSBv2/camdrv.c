@@ -1,1009 +1,3804 @@
-/* camdrv.c */
-/* Created by Sanshiro Enomoto on 11 April 1999 */
-/* Last updated by Sanshiro Enomoto on 1 December 2025 */
-
-
-#include <linux/module.h>
-#include <linux/kernel.h>
-#include <linux/init.h>
-#include <linux/usb.h>
-#include <linux/device.h>
-#include <linux/cdev.h>
-#include <linux/uaccess.h>
-#include <linux/slab.h>
-#include <linux/mutex.h>
-#include <linux/delay.h>
-#include <linux/ioctl.h>
-#include <linux/types.h>
-#include "camdrv.h"
-
-
-MODULE_LICENSE("GPL");
-MODULE_AUTHOR("Sanshiro Enomoto");
-MODULE_DESCRIPTION("CAMAC Driver for Hoshin CCP-USB(V2) Controller");
-MODULE_VERSION("1.00");
-
-#define DRIVER_NAME "camdrv"
-#define DEVICE_NAME "camdrv"
-#define CCP_VENDOR_ID 0x24b9
-#define CCP_PRODUCT_ID 0x0020
-
-#define BUFFER_SIZE 64
-#define LATENCY_TIME 2
-#define TIMEOUT_MS 500
-#define USB_IN_TRANSFER_SIZE 512
-
-// Debug support: define DEBUG to enable debug messages
-//#define DEBUG
-#ifdef DEBUG
-#define dbg_print(fmt, ...) pr_info("camdrv: " fmt, ##__VA_ARGS__)
-#define dbg_dev_print(dev, fmt, ...) dev_info(&(dev)->udev->dev, "camdrv: " fmt, ##__VA_ARGS__)
-#else
-#define dbg_print(fmt, ...) do {} while (0)
-#define dbg_dev_print(dev, fmt, ...) do {} while (0)
-#endif
-
-
-static int major_number;
-static struct class *camdrv_class = NULL;
-static struct device *camdrv_device = NULL;
-static dev_t dev_num;
-
-// Device structure
-struct camdrv_device {
-    struct usb_device *udev;
-    struct usb_interface *interface;
-    struct cdev cdev;
-    struct mutex mutex;
-    struct usb_endpoint_descriptor *bulk_in;
-    struct usb_endpoint_descriptor *bulk_out;
-    unsigned char *tx_buffer;
-    unsigned char *rx_buffer;
-    int start_n;
-    bool is_open;
-    unsigned crate_number;
-};
-
-static struct usb_device_id camdrv_table[] = {
-    { USB_DEVICE(CCP_VENDOR_ID, CCP_PRODUCT_ID) },
-    { }
-};
-MODULE_DEVICE_TABLE(usb, camdrv_table);
-
-static int camdrv_open(struct inode *inode, struct file *file);
-static int camdrv_release(struct inode *inode, struct file *file);
-static long camdrv_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
-static int camdrv_probe(struct usb_interface *interface, const struct usb_device_id *id);
-static void camdrv_disconnect(struct usb_interface *interface);
-
-static int ftdi_init_sync_fifo(struct camdrv_device *dev);
-static int ftdi_control_request(struct usb_device *udev, u8 request_type, u8 request, u16 value, u16 index, void *data, u16 size);
-
-static int ccp_inout(struct camdrv_device *dev, unsigned int write_size, unsigned int read_size);
-static int ccp_init(struct camdrv_device *dev, unsigned char crate_number);
-static int ccp_initialize(struct camdrv_device *dev, unsigned crate_number);
-static int ccp_clear(struct camdrv_device *dev, unsigned crate_number);
-static int ccp_camac_action(struct camdrv_device *dev, unsigned crate, unsigned n, unsigned a, unsigned f, unsigned* data);
-static int ccp_read_lam(struct camdrv_device *dev, unsigned char crate_number, unsigned *data);
-static int ccp_wait_lam(struct camdrv_device *dev, unsigned char crate_number, unsigned timeout, unsigned* data);
-//static int ccp_read_register(struct camdrv_device *dev, unsigned char crate_number, unsigned address, unsigned *data);
-static int ccp_write_register(struct camdrv_device *dev, unsigned char crate_number, unsigned address, unsigned data);
-
-
-
-static const struct file_operations camdrv_fops = {
-    .owner = THIS_MODULE,
-    .open = camdrv_open,
-    .release = camdrv_release,
-    .unlocked_ioctl = camdrv_ioctl,
-};
-
-static struct usb_driver camdrv_driver = {
-    .name = DRIVER_NAME,
-    .probe = camdrv_probe,
-    .disconnect = camdrv_disconnect,
-    .id_table = camdrv_table,
-};
-
-
-static int __init camdrv_init(void)
-{
-    int result;
-    
-    result = alloc_chrdev_region(&dev_num, 0, 1, DEVICE_NAME);
-    if (result < 0) {
-        pr_err("Failed to allocate chrdev region\n");
-        return result;
-    }
-    major_number = MAJOR(dev_num);
-    
-    camdrv_class = class_create(DEVICE_NAME);
-    if (IS_ERR(camdrv_class)) {
-        pr_err("Failed to create device class\n");
-        result = PTR_ERR(camdrv_class);
-        goto error_class;
-    }
-    
-    camdrv_device = device_create(camdrv_class, NULL, dev_num, NULL, DEVICE_NAME);
-    if (IS_ERR(camdrv_device)) {
-        pr_err("Failed to create device\n");
-        result = PTR_ERR(camdrv_device);
-        goto error_device;
-    }
-    
-    result = usb_register(&camdrv_driver);
-    if (result) {
-        pr_err("Failed to register USB driver\n");
-        goto error_usb;
-    }
-    
-    pr_info("CCP-USB(V2) kernel driver loaded\n");
-    return 0;
-    
-  error_usb:
-    device_destroy(camdrv_class, dev_num);
-  error_device:
-    class_destroy(camdrv_class);
-  error_class:
-    unregister_chrdev_region(dev_num, 1);
-        
-    return result;
-}
-module_init(camdrv_init);
-
-
-static void __exit camdrv_exit(void)
-{
-    usb_deregister(&camdrv_driver);
-    device_destroy(camdrv_class, dev_num);
-    class_destroy(camdrv_class);
-    unregister_chrdev_region(dev_num, 1);
-    pr_info("CCP-USB(V2) kernel driver unloaded\n");
-}
-module_exit(camdrv_exit);
-
-
-static int camdrv_probe(struct usb_interface *interface, const struct usb_device_id *id)
-{
-    struct usb_device *udev = interface_to_usbdev(interface);
-    struct usb_host_interface *iface_desc;
-    struct usb_endpoint_descriptor *endpoint;
-    struct camdrv_device *dev;
-    int result = -ENOMEM;
-    int i;
-    
-    dbg_print("camdrv_probe: device detected (vendor=0x%04x, product=0x%04x)\n",
-             le16_to_cpu(udev->descriptor.idVendor),
-             le16_to_cpu(udev->descriptor.idProduct));
-    
-    dev = kzalloc(sizeof(*dev), GFP_KERNEL);
-    if (!dev) {
-        dev_err(&interface->dev, "camdrv_probe: failed to allocate device structure\n");
-        return -ENOMEM;
-    }
-    
-    dev->udev = usb_get_dev(udev);
-    dev->interface = interface;
-    
-    // Find bulk endpoints
-    iface_desc = interface->cur_altsetting;
-    dbg_print("camdrv_probe: searching endpoints (num_endpoints=%u)\n",
-             iface_desc->desc.bNumEndpoints);
-    for (i = 0; i < iface_desc->desc.bNumEndpoints; i++) {
-        endpoint = &iface_desc->endpoint[i].desc;
-        dbg_print("camdrv_probe: endpoint[%d]: addr=0x%02x, type=%u, dir=%s\n",
-                 i, endpoint->bEndpointAddress,
-                 usb_endpoint_type(endpoint),
-                 usb_endpoint_dir_in(endpoint) ? "IN" : "OUT");
-        if (usb_endpoint_is_bulk_in(endpoint)) {
-            if (!dev->bulk_in) {
-                dev->bulk_in = endpoint;
-                dbg_print("camdrv_probe: found bulk IN endpoint: 0x%02x\n",
-                         endpoint->bEndpointAddress);
-            }
-        } else if (usb_endpoint_is_bulk_out(endpoint)) {
-            if (!dev->bulk_out) {
-                dev->bulk_out = endpoint;
-                dbg_print("camdrv_probe: found bulk OUT endpoint: 0x%02x\n",
-                         endpoint->bEndpointAddress);
-            }
-        }
-    }
-    
-    if (!dev->bulk_in || !dev->bulk_out) {
-        dev_err(&interface->dev, "Could not find bulk endpoints (in=%p, out=%p)\n",
-               dev->bulk_in, dev->bulk_out);
-        result = -ENODEV;
-        goto error;
-    }
-    
-    dev->tx_buffer = kmalloc(BUFFER_SIZE, GFP_KERNEL);
-    dev->rx_buffer = kmalloc(USB_IN_TRANSFER_SIZE, GFP_KERNEL);
-    if (!dev->tx_buffer || !dev->rx_buffer) {
-        dev_err(&interface->dev, "camdrv_probe: failed to allocate buffers\n");
-        result = -ENOMEM;
-        goto error;
-    }
-    dbg_print("camdrv_probe: allocated buffers (tx=%p, rx=%p)\n",
-             dev->tx_buffer, dev->rx_buffer);
-    
-    mutex_init(&dev->mutex);
-    dev->is_open = false;
-    dev->crate_number = 1;
-    
-    cdev_init(&dev->cdev, &camdrv_fops);
-    dev->cdev.owner = THIS_MODULE;
-    result = cdev_add(&dev->cdev, dev_num, 1);
-    if (result) {
-        dev_err(&interface->dev, "Error %d adding cdev\n", result);
-        goto error;
-    }
-    dbg_print("camdrv_probe: cdev added successfully\n");
-    
-    usb_set_intfdata(interface, dev);
-    
-    dev_info(&interface->dev, "CCP-USB(V2) device attached\n");
-    dbg_print("camdrv_probe: probe completed successfully\n");
-    
-    return 0;
-    
-  error:
-    if (dev->tx_buffer) {
-        kfree(dev->tx_buffer);
-    }
-    if (dev->rx_buffer) {
-        kfree(dev->rx_buffer);
-    }
-    usb_put_dev(dev->udev);
-    kfree(dev);
-    
-    dbg_print("camdrv_probe: probe failed with error %d\n", result);
-    return result;
-}
-
-
-static void camdrv_disconnect(struct usb_interface *interface)
-{
-    struct camdrv_device *dev = usb_get_intfdata(interface);
-
-    usb_set_intfdata(interface, NULL);
-    
-    if (dev) {
-        cdev_del(&dev->cdev);
-        mutex_lock(&dev->mutex);
-        dev->is_open = false;
-        mutex_unlock(&dev->mutex);
-        kfree(dev->tx_buffer);
-        kfree(dev->rx_buffer);
-        usb_put_dev(dev->udev);
-        kfree(dev);
-        dev_info(&interface->dev, "CCP-USB(V2) device disconnected\n");
-    }
-}
-
-
-static int camdrv_open(struct inode *inode, struct file *file)
-{
-    struct camdrv_device *dev;
-    int result = 0;
-    
-    dbg_print("camdrv_open: called\n");
-    
-    dev = container_of(inode->i_cdev, struct camdrv_device, cdev);
-    file->private_data = dev;
-    
-    dbg_dev_print(dev, "camdrv_open: device found, crate_number=%u\n", dev->crate_number);
-    
-    if (mutex_lock_interruptible(&dev->mutex)) {
-        dbg_dev_print(dev, "camdrv_open: mutex lock interrupted\n");
-        return -ERESTARTSYS;
-    }
-    
-    if (dev->is_open) {
-        dbg_dev_print(dev, "camdrv_open: device already open\n");
-        result = -EBUSY;
-        goto err_unlock;
-    }
-    
-    dbg_dev_print(dev, "camdrv_open: initializing FTDI device\n");
-    result = ftdi_init_sync_fifo(dev);
-    if (result < 0) {
-        dev_err(&dev->udev->dev, "Failed to initialize FTDI device: %d\n", result);
-        goto err_unlock;
-    }
-    dbg_dev_print(dev, "camdrv_open: FTDI device initialized successfully\n");
-    
-    dbg_dev_print(dev, "camdrv_open: initializing CCP interface, crate=%u\n", dev->crate_number);
-    result = ccp_init(dev, dev->crate_number);
-    if (result < 0) {
-        dev_err(&dev->udev->dev, "Failed to initialize CCP interface: %d\n", result);
-        goto err_unlock;
-    }
-    dbg_dev_print(dev, "camdrv_open: CCP interface initialized, result=0x%02x\n", result);
-    pr_info("CCP-USB(V2) opened\n");
-    
-    dev->is_open = true;
-    mutex_unlock(&dev->mutex);
-    
-    dbg_dev_print(dev, "camdrv_open: successfully opened\n");
-    return 0;
-
-  err_unlock:
-    mutex_unlock(&dev->mutex);
-    dbg_dev_print(dev, "camdrv_open: failed with error %d\n", result);
-    return result;
-}
-
-
-static int camdrv_release(struct inode *inode, struct file *file)
-{
-    struct camdrv_device *dev = file->private_data;
-
-    if (dev) {
-        mutex_lock(&dev->mutex);
-        dev->is_open = false;
-        mutex_unlock(&dev->mutex);
-    }
-
-    return 0;
-}
-
-
-static long camdrv_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
-{
-    unsigned parameter = 0, data = 0;
-    unsigned *user_parameter_ptr, *user_data_ptr;
-    unsigned crate_number, n, a, f;
-    int result = 0;
-
-    struct camdrv_device *dev = file->private_data;
-    crate_number = dev->crate_number;
-    
-    dbg_dev_print(dev, "camdrv_ioctl: cmd=0x%08x, arg=0x%08lx\n", cmd, arg);
-    
-    user_parameter_ptr = (unsigned *) arg;
-    user_data_ptr = (unsigned *) arg + 1;
-
-    if (_IOC_TYPE(cmd) != CAMDRV_IOC_MAGIC) {
-        dbg_dev_print(dev, "camdrv_ioctl: invalid IOC magic (got 0x%02x, expected 0x%02x)\n", 
-                     _IOC_TYPE(cmd), CAMDRV_IOC_MAGIC);
-        return -EINVAL;
-    }
-    if (_IOC_DIR(cmd) & (_IOC_READ | _IOC_WRITE)) {
-        if (get_user(parameter, user_parameter_ptr) < 0) {
-            dbg_dev_print(dev, "camdrv_ioctl: failed to get parameter\n");
-            return -EFAULT;
-        }
-        if (get_user(data, user_data_ptr) < 0) {
-            dbg_dev_print(dev, "camdrv_ioctl: failed to get data\n");
-            return -EFAULT;
-        }
-        dbg_dev_print(dev, "camdrv_ioctl: parameter=0x%08x, data=0x%08x\n", parameter, data);
-    }
-
-    if (mutex_lock_interruptible(&dev->mutex)) {
-        dbg_dev_print(dev, "camdrv_ioctl: mutex lock interrupted\n");
-        return -ERESTARTSYS;
-    }
-    
-    switch (cmd) {
-      case CAMDRV_IOC_INITIALIZE:
-        dbg_dev_print(dev, "camdrv_ioctl: INITIALIZE, crate=%u\n", crate_number);
-        result = ccp_initialize(dev, crate_number);
-        break;
-      case CAMDRV_IOC_CLEAR:
-        dbg_dev_print(dev, "camdrv_ioctl: CLEAR, crate=%u\n", crate_number);
-        result = ccp_clear(dev, crate_number);
-        break;
-      case CAMDRV_IOC_INHIBIT:
-        dbg_dev_print(dev, "camdrv_ioctl: INHIBIT (not supported)\n");
-        result = -EINVAL;
-        break;
-      case CAMDRV_IOC_RELEASE_INHIBIT:
-        dbg_dev_print(dev, "camdrv_ioctl: RELEASE_INHIBIT (not supported)\n");
-        result = -EINVAL;
-        break;
-      case CAMDRV_IOC_ENABLE_INTERRUPT:
-        dbg_dev_print(dev, "camdrv_ioctl: ENABLE_INTERRUPT (not supported)\n");
-        result = -EINVAL;
-        break;
-      case CAMDRV_IOC_DISABLE_INTERRUPT:
-        dbg_dev_print(dev, "camdrv_ioctl: DISABLE_INTERRUPT (not supported)\n");
-        result = -EINVAL;
-        break;
-      case CAMDRV_IOC_CAMAC_ACTION:
-        n = (parameter >> 9) & 0x1f;
-        a = (parameter >> 5) & 0x0f;
-        f = (parameter >> 0) & 0x1f;
-        dbg_dev_print(
-            dev,
-            "camdrv_ioctl: CAMAC_ACTION, crate=%u, n=%u, a=%u, f=%u, data=0x%08x\n",
-            crate_number, n, a, f, data
-        );
-        result = ccp_camac_action(dev, crate_number, n, a, f, &data);
-        dbg_dev_print(dev, "camdrv_ioctl: CAMAC_ACTION result=%d, data=0x%08x\n", result, data);
-        put_user(data, user_data_ptr);
-        break;
-      case CAMDRV_IOC_READ_LAM:
-        dbg_dev_print(dev, "camdrv_ioctl: READ_LAM, crate=%u\n", crate_number);
-        result = ccp_read_lam(dev, crate_number, &data);
-        dbg_dev_print(dev, "camdrv_ioctl: READ_LAM result=%d, data=0x%08x\n", result, data);
-        put_user(data, user_data_ptr);
-        break;
-      case CAMDRV_IOC_WAIT_LAM:
-        dbg_dev_print(dev, "camdrv_ioctl: WAIT_LAM, crate=%u, timeout=%u\n", crate_number, parameter);
-        result = ccp_wait_lam(dev, crate_number, parameter, &data);
-        dbg_dev_print(dev, "camdrv_ioctl: WAIT_LAM result=%d, data=0x%08x\n", result, data);
-        put_user(data, user_data_ptr);
-        break;
-      case CAMDRV_IOC_SET_CRATE:
-        dbg_dev_print(dev, "camdrv_ioctl: SET_CRATE, old=%u, new=%u\n", crate_number, parameter + 1);
-        dev->crate_number = parameter;
-        result = ccp_init(dev, dev->crate_number);
-        dbg_dev_print(dev, "camdrv_ioctl: SET_CRATE result=%d\n", result);
-        break;
-      default:
-        dbg_dev_print(dev, "camdrv_ioctl: unknown command 0x%08x\n", cmd);
-        result = -EINVAL;
-    }
-
-    mutex_unlock(&dev->mutex);
-    
-    dbg_dev_print(dev, "camdrv_ioctl: returning %d\n", result);
-    return result;
-}
-
-
-//// FTDI ////
-
-#define FTDI_SIO_RESET_REQUEST_TYPE 0x40
-#define FTDI_SIO_RESET_REQUEST 0x00
-#define FTDI_SIO_RESET_SIO 0
-#define FTDI_SIO_FLUSH_HOST_OUT 1
-#define FTDI_SIO_FLUSH_HOST_IN 2
-
-#define FTDI_SIO_SET_BITMODE_REQUEST_TYPE 0x40
-#define FTDI_SIO_SET_BITMODE_REQUEST 0x0b
-#define FTDI_BITMODE_RESET 0x00
-#define FTDI_BITMODE_SYNC_FIFO 0x40
-
-#define FTDI_SIO_SET_LATENCY_TIMER_REQUEST_TYPE 0x40
-#define FTDI_SIO_SET_LATENCY_TIMER_REQUEST 0x09
-
-#define FTDI_SIO_SET_EVENT_CHAR_REQUEST_TYPE 0x40
-#define FTDI_SIO_SET_EVENT_CHAR_REQUEST 0x06
-
-#define FTDI_INTERFACE_A 1
-
-
-// Helper function to send FTDI control request
-static int ftdi_control_request(struct usb_device *udev, u8 request_type, u8 request, u16 value, u16 index, void *data, u16 size)
-{
-    int result;
-    result = usb_control_msg(
-        udev, usb_sndctrlpipe(udev, 0),
-        request, request_type, value, index,
-        data, size, TIMEOUT_MS
-    );
-    if (result < 0) {
-        dev_err(&udev->dev, "FTDI control request failed: %d\n", result);
-    }
-    
-    return result;
-}
-
-
-// Initialize FTDI device for synchronous FIFO mode
-static int ftdi_init_sync_fifo(struct camdrv_device *dev)
-{
-    struct usb_device *udev = dev->udev;
-    int result;
-
-    dbg_dev_print(dev, "ftdi_init_sync_fifo: starting initialization\n");
-
-    // Reset device
-    dbg_dev_print(dev, "ftdi_init_sync_fifo: resetting device\n");
-    result = ftdi_control_request(
-        udev, FTDI_SIO_RESET_REQUEST_TYPE,
-        FTDI_SIO_RESET_REQUEST,
-        FTDI_SIO_RESET_SIO, FTDI_INTERFACE_A,
-        NULL, 0
-    );
-    if (result < 0) {
-        dev_err(&udev->dev, "ftdi_init_sync_fifo: reset failed: %d\n", result);
-        return result;
-    }
-    dbg_dev_print(dev, "ftdi_init_sync_fifo: reset successful\n");
-
-    // Reset bit mode
-    dbg_dev_print(dev, "ftdi_init_sync_fifo: resetting bit mode\n");
-    result = ftdi_control_request(
-        udev, FTDI_SIO_SET_BITMODE_REQUEST_TYPE,
-        FTDI_SIO_SET_BITMODE_REQUEST,
-        FTDI_BITMODE_RESET, FTDI_INTERFACE_A,
-        NULL, 0
-    );
-    if (result < 0) {
-        dev_err(&udev->dev, "ftdi_init_sync_fifo: bit mode reset failed: %d\n", result);
-        return result;
-    }
-    dbg_dev_print(dev, "ftdi_init_sync_fifo: bit mode reset successful\n");
-
-    // Set synchronous FIFO mode (0xF0 = pin direction, 0x40 = sync FIFO mode)
-    dbg_dev_print(dev, "ftdi_init_sync_fifo: setting sync FIFO mode (value=0x%04x)\n", (FTDI_BITMODE_SYNC_FIFO << 8) | 0xF0);
-    result = ftdi_control_request(
-        udev, FTDI_SIO_SET_BITMODE_REQUEST_TYPE,
-        FTDI_SIO_SET_BITMODE_REQUEST,
-        (FTDI_BITMODE_SYNC_FIFO << 8) | 0xF0,
-        FTDI_INTERFACE_A, NULL, 0
-    );
-    if (result < 0) {
-        dev_err(&udev->dev, "ftdi_init_sync_fifo: set sync FIFO mode failed: %d\n", result);
-        return result;
-    }
-    dbg_dev_print(dev, "ftdi_init_sync_fifo: sync FIFO mode set successfully\n");
-
-    // Set latency timer
-    dbg_dev_print(dev, "ftdi_init_sync_fifo: setting latency timer to %d\n", LATENCY_TIME);
-    result = ftdi_control_request(
-        udev, FTDI_SIO_SET_LATENCY_TIMER_REQUEST_TYPE,
-        FTDI_SIO_SET_LATENCY_TIMER_REQUEST,
-        LATENCY_TIME, FTDI_INTERFACE_A,
-        NULL, 0
-    );
-    if (result < 0) {
-        dev_err(&udev->dev, "ftdi_init_sync_fifo: set latency timer failed: %d\n", result);
-        return result;
-    }
-    dbg_dev_print(dev, "ftdi_init_sync_fifo: latency timer set successfully\n");
-
-    dbg_dev_print(dev, "ftdi_init_sync_fifo: initialization completed successfully\n");
-    return 0;
-}
-
-
-//// CCP ////
-
-enum ccp_command {
-    cmdINITIALIZE_CCP = 0x49,
-    cmdCAMAC = 0x43,
-    cmdLAM = 0x4c,
-    cmdWRITE_REG = 0x57,
-    cmdREAD_REG = 0x52
-};
-
-enum ccp_ctrlbits {
-    ctrlINITIALIZE = 0x40,
-    ctrlCLEAR = 0x80
-};
-
-enum ccp_statbits {
-    statQ = 0x01,
-    statX = 0x02,
-    statI = 0x04,
-    statLE = 0x08,
-    statREQ = 0x40,
-    statDEM = 0x80
-};
-
-static int ccp_inout(struct camdrv_device *dev, unsigned int write_size, unsigned int read_size)
-{
-    struct usb_device *udev = dev->udev;
-    int result;
-    int actual_length, start_n;
-    unsigned int i;
-    
-    dbg_dev_print(dev, "ccp_inout: write_size=%u, read_size=%u\n", write_size, read_size);
-    
-    if (!dev->bulk_in || !dev->bulk_out) {
-        dev_err(&udev->dev, "ccp_inout: bulk endpoints not found\n");
-        return -ENODEV;
-    }
-
-    // Print TX buffer
-    dbg_dev_print(dev, "ccp_inout: TX buffer (%u bytes): ", write_size);
-    for (i = 0; i < write_size; i++) {
-        dbg_print("TX %d: %02x ", i, dev->tx_buffer[i]);
-    }
-    dbg_print("==(end TX)==\n");
-
-    // Purge RX buffer
-    dbg_dev_print(dev, "ccp_inout: purging RX buffer\n");
-    ftdi_control_request(
-        udev, FTDI_SIO_RESET_REQUEST_TYPE,
-        FTDI_SIO_RESET_REQUEST,
-        FTDI_SIO_FLUSH_HOST_IN, FTDI_INTERFACE_A,
-        NULL, 0
-    );
-    //udelay(10);
-
-    // Write data
-    dbg_dev_print(
-        dev, "ccp_inout: writing %u bytes to endpoint 0x%02x\n",
-        write_size, dev->bulk_out->bEndpointAddress
-    );
-    result = usb_bulk_msg(
-        udev, usb_sndbulkpipe(udev, dev->bulk_out->bEndpointAddress),
-        dev->tx_buffer, write_size, &actual_length,
-        TIMEOUT_MS
-    );
-    if (result < 0) {
-        dev_err(&udev->dev, "ccp_inout: Write failed: %d\n", result);
-        return -EIO;
-    }
-    dbg_dev_print(dev, "ccp_inout: wrote %d bytes (expected %u)\n", actual_length, write_size);
-    //udelay(10);
-
-    if (read_size == 0) {
-        return 0;
-    }
-    
-    // Read data
-    dbg_dev_print(
-        dev, "ccp_inout: reading from endpoint 0x%02x (max %u bytes)\n",
-        dev->bulk_in->bEndpointAddress, USB_IN_TRANSFER_SIZE
-    );
-    result = usb_bulk_msg(
-        udev, usb_rcvbulkpipe(udev, dev->bulk_in->bEndpointAddress),
-        dev->rx_buffer, USB_IN_TRANSFER_SIZE, &actual_length,
-        TIMEOUT_MS
-    );
-    if (result < 0) {
-        dev_err(&udev->dev, "ccp_inout: Read failed: %d\n", result);
-        return -EIO;
-    }
-    dbg_dev_print(dev, "ccp_inout: read %d bytes (expected at least %u)\n", actual_length, read_size);
-
-    if (actual_length < read_size) {
-        dev_err(
-            &udev->dev, "ccp_inout: Read size mismatch: expected %u, got %d\n",
-            read_size, actual_length
-        );
-        return -EIO;
-    }
-
-    // Find start marker (0x43)
-    dbg_dev_print(dev, "ccp_inout: searching for start marker 0x43\n");
-    start_n = -1;
-    for (i = 0; i <= actual_length - read_size; i++) {
-        unsigned char byte = ((dev->rx_buffer[i+1] & 0x0f) << 4) | (dev->rx_buffer[i] & 0x0f);
-        if (byte == 0x43) {
-            start_n = i + 2;
-            break;
-        }
-    }
-    
-    // DEBUG: Print RX buffer
-    dbg_dev_print(
-        dev, "ccp_inout: RX buffer (first %u bytes out of %u received): ", 
-        actual_length < 32 ? actual_length : 32,
-        actual_length
-    );
-    for (i = 0; i < actual_length && i < 32; i++) {
-        if (i >= start_n && i < start_n + read_size) {
-            dbg_print("RX %03d: %02x ", i, dev->rx_buffer[i]);
-        }
-        else {
-            dbg_print("RX %03d: (%02x) ", i, dev->rx_buffer[i]);
-        }
-    }
-    dbg_print("==(end RX)==\n");
-
-    if (start_n < 0) {
-        dev_err(&udev->dev, "ccp_inout: start marker 0x43 not found in response\n");
-        return -EIO;
-    }
-    dbg_dev_print(dev, "ccp_inout: found start marker at position %u\n", start_n);
-    dev->start_n = start_n;
-
-    return 0;
-}
-
-
-static int ccp_init(struct camdrv_device *dev, unsigned char crate_number)
-{
-    unsigned char cmd = cmdINITIALIZE_CCP;
-    int result;
-
-    dbg_dev_print(dev, "ccp_init: initializing crate %u\n", crate_number);
-
-#if 0
-    if (crate_number < 1 || crate_number > 7) {
-        dev_err(&dev->udev->dev, "ccp_init: invalid crate number %u (must be 1-7)\n", crate_number);
-#else
-    if (crate_number > 7) {
-        dev_err(&dev->udev->dev, "ccp_init: invalid crate number %u (must be 0-7)\n", crate_number);
-#endif
-        return -EINVAL;
-    }
-
-    // Reset device
-    dbg_dev_print(dev, "ccp_init: resetting device\n");
-    result = ftdi_control_request(
-        dev->udev, FTDI_SIO_RESET_REQUEST_TYPE,
-        FTDI_SIO_RESET_REQUEST,
-        FTDI_SIO_RESET_SIO, FTDI_INTERFACE_A,
-        NULL, 0
-    );
-    if (result < 0) {
-        dev_err(&dev->udev->dev, "ccp_init: device reset failed: %d\n", result);
-        return result;
-    }
-
-    // Prepare command
-    dev->tx_buffer[0] = (cmd << 4);
-    dev->tx_buffer[1] = (cmd & 0xF0);
-    dev->tx_buffer[2] = (crate_number << 4);
-    dev->tx_buffer[3] = (crate_number & 0xF0);
-    dbg_dev_print(
-        dev, "ccp_init: prepared command: 0x%02x 0x%02x 0x%02x 0x%02x\n",
-        dev->tx_buffer[0], dev->tx_buffer[1], dev->tx_buffer[2], dev->tx_buffer[3]
-    );
-    
-    // Send and receive
-    result = ccp_inout(dev, 4, 4);
-    if (result < 0) {
-        dev_err(&dev->udev->dev, "ccp_init: ccp_inout failed: %d\n", result);
-        return result;
-    }
-
-    // Extract result
-    result = (
-        ((dev->rx_buffer[dev->start_n + 1] & 0x0F) << 4) | (dev->rx_buffer[dev->start_n] & 0x0F)
-    );
-    dbg_dev_print(dev, "ccp_init: received result: 0x%02x\n", result);
-
-    return result;
-}
-
-
-static int ccp_initialize(struct camdrv_device *dev, unsigned crate_number)
-{
-     return ccp_write_register(dev, crate_number, 5, ctrlINITIALIZE);
-}
-
-
-static int ccp_clear(struct camdrv_device *dev, unsigned crate_number)
-{
-     return ccp_write_register(dev, crate_number, 5, ctrlCLEAR);
-}
-
-
-static int ccp_camac_action(struct camdrv_device *dev, unsigned crate_number, unsigned n, unsigned a, unsigned f, unsigned* data)
-{
-    unsigned char cmd = cmdCAMAC;
-    unsigned dl = 0, dm = 0, dh = 0;
-    unsigned int read_size;
-    unsigned status, nq, nx;
-    int result;
-    
-    dbg_dev_print(dev, "ccp_camac_action: crate=%u, n=%u, a=%u, f=%u, &data=%p\n", crate_number, n, a, f, data);
-#if 0    
-    if (crate_number < 1  || crate_number > 7) {
-#else
-    if (crate_number > 7) {
-#endif
-        dev_err(&dev->udev->dev, "ccp_camac_action: invalid crate number %u\n", crate_number);
-        return -EINVAL;
-    }
-    if (n == 0 || n >= 24 || a >= 16 || f >= 32) {
-        dev_err(&dev->udev->dev, "ccp_camac_action: invalid parameters n=%u, a=%u, f=%u\n", n, a, f);
-        return -EINVAL;
-    }
-    if (f > 15) {
-        read_size = 4;
-    }
-    else {
-        read_size = 10;
-    }
-    dbg_dev_print(dev, "ccp_camac_action: read_size=%u\n", read_size);
-    
-    if (data) {
-        dl = (*data & 0x0000ff);
-        dm = (*data & 0x00ff00) >> 8;
-        dh = (*data & 0xff0000) >> 16;
-        dbg_dev_print(dev, "ccp_camac_action: input data=0x%08x (dl=0x%02x, dm=0x%02x, dh=0x%02x)\n",
-                     *data, dl, dm, dh);
-        *data = 0;
-    }
-    
-    dev->tx_buffer[0] = (cmd << 4);
-    dev->tx_buffer[1] = (cmd & 0xF0);
-    dev->tx_buffer[2] = (crate_number << 4);
-    dev->tx_buffer[3] = (crate_number & 0xF0);
-    dev->tx_buffer[4] = (n << 4);
-    dev->tx_buffer[5] = (n & 0xF0);
-    dev->tx_buffer[6] = (a << 4);
-    dev->tx_buffer[7] = (a & 0xF0);
-    dev->tx_buffer[8] = (f << 4);
-    dev->tx_buffer[9] = (f & 0xF0);
-    dev->tx_buffer[10] = (dl << 4);
-    dev->tx_buffer[11] = (dl & 0xF0);
-    dev->tx_buffer[12] = (dm << 4);
-    dev->tx_buffer[13] = (dm & 0xF0);
-    dev->tx_buffer[14] = (dh << 4);
-    dev->tx_buffer[15] = (dh & 0xF0);
-    
-    result = ccp_inout(dev, 16, read_size);
-    if (result < 0) {
-        dev_err(&dev->udev->dev, "ccp_camac_action: ccp_inout failed: %d\n", result);
-#if 0
-        nq = 1;
-        nx = 1;
-        return (nx << 1) | nq;
-#else
-        return result;
-#endif
-    }
-    
-    if ((f <= 15) && data) {
-        *data = (
-            ((unsigned int)(dev->rx_buffer[dev->start_n + 7] & 0x0F) << 20) |
-            ((unsigned int)(dev->rx_buffer[dev->start_n + 6] & 0x0F) << 16) |
-            ((unsigned int)(dev->rx_buffer[dev->start_n + 5] & 0x0F) << 12) |
-            ((unsigned int)(dev->rx_buffer[dev->start_n + 4] & 0x0F) << 8) |
-            ((unsigned int)(dev->rx_buffer[dev->start_n + 3] & 0x0F) << 4) |
-            ((unsigned int)(dev->rx_buffer[dev->start_n + 2] & 0x0F))
-        );
-        dbg_dev_print(dev, "ccp_camac_action: extracted data=0x%08x\n", *data);
-    }
-    status = (
-        ((unsigned int)(dev->rx_buffer[dev->start_n + 1] & 0x0F) << 4) |
-        ((unsigned int)(dev->rx_buffer[dev->start_n] & 0x0F))
-    );
-    nq = (status & statQ) ? 0x00 : 0x01;
-    nx = (status & statX) ? 0x00 : 0x01;
-
-    dbg_dev_print(
-        dev, "ccp_camac_action: status=0x%02x, NQ=%u, NX=%u, result=%d\n",
-        status, nq, nx, (nx << 1) | nq
-    );
-
-    return (nx << 1) | nq;
-}
-
-
-static int ccp_read_lam(struct camdrv_device *dev, unsigned char crate_number, unsigned *data)
-{
-    unsigned char cmd = cmdLAM;
-    unsigned reply, encoded_lam = 0;
-    int result;
-    
-    dbg_dev_print(dev, "ccp_read_lam: crate=%u\n", crate_number);
-#if 0    
-    if (crate_number < 1 || crate_number > 7) {
-#else
-    if (crate_number > 7) {
-#endif
-        dev_err(&dev->udev->dev, "ccp_read_lam: invalid crate number %u\n", crate_number);
-        return -EINVAL;
-    }
-
-    dev->tx_buffer[0] = (cmd << 4);
-    dev->tx_buffer[1] = (cmd & 0xF0);
-    dev->tx_buffer[2] = (crate_number << 4);
-    dev->tx_buffer[3] = (crate_number & 0xF0);
-    *data = 0;
-    
-    result = ccp_inout(dev, 4, 6);
-    if (result < 0) {
-        dev_err(&dev->udev->dev, "ccp_read_lam: ccp_inout failed: %d\n", result);
-        return result;
-    }
-                
-    reply = (
-        ((unsigned short)(dev->rx_buffer[dev->start_n + 3] & 0x0F) << 12) |
-        ((unsigned short)(dev->rx_buffer[dev->start_n + 2] & 0x0F) << 8) |
-        ((unsigned short)(dev->rx_buffer[dev->start_n + 1] & 0x0F) << 4) |
-        ((unsigned short)(dev->rx_buffer[dev->start_n] & 0x0F))
-    );
-    dbg_dev_print(dev, "ccp_read_lam: reply=0x%04x\n", reply);
-
-    encoded_lam = (reply & 0xff00) >> 8;
-    if (encoded_lam > 0) {
-        *data = 0x0001 << (encoded_lam - 1);
-    }
-    dbg_dev_print(dev, "ccp_read_lam: encoded_lam=0x%x, status=0x%x\n", encoded_lam, (reply & 0xff));
-
-    return 0;
-}
-
-
-static int ccp_wait_lam(struct camdrv_device *dev, unsigned char crate_number, unsigned timeout, unsigned* data)
-{
-    unsigned long timeout_jiffies = jiffies + timeout * HZ;
-    int result;
-
-    /* The hardware does not support "interrupt on LAM". */
-    /* The following code is a "polling loop" to wait for any LAM bits. */
-    while (true) {
-        result = ccp_read_lam(dev, crate_number, data);
-        if (result < 0) {
-            return result;
-        }
-        if (*data != 0) {
-            return *data;
-        }
-
-        if (time_after_eq(jiffies, timeout_jiffies)) {
-            *data = 0;
-            return -ETIMEDOUT;
-        }
-        
-        usleep_range(2000, 5000);
-    }
-
-    return *data;
-}
-
-
-static int ccp_write_register(struct camdrv_device *dev, unsigned char crate_number, unsigned address, unsigned data)
-{
-    unsigned char cmd = cmdWRITE_REG;
-    int result;
-
-#if 0    
-    if (crate_number < 1 || crate_number > 7) {
-#else
-    if (crate_number > 7) {
-#endif
-        return -EINVAL;
-    }
-
-    dev->tx_buffer[0] = (cmd << 4);
-    dev->tx_buffer[1] = (cmd & 0xF0);
-    dev->tx_buffer[2] = (address << 4);
-    dev->tx_buffer[3] = (address & 0xF0);
-    dev->tx_buffer[4] = ((data & 0x0f) << 4);
-    dev->tx_buffer[5] = (data & 0xf0);
-
-    result = ccp_inout(dev, 6, 0);
-    if (result < 0) {
-        return result;
-    }
-
-    return 0;
-}
-
-#if 0
-// not used
-static int ccp_read_register(struct camdrv_device *dev, unsigned char crate_number, unsigned /*address*/, unsigned *data)
-{
-    unsigned char cmd = cmdREAD_REG;
-    unsigned reply;
-    int result;
-
-#if 0
-    if (crate_number < 1 || crate_number > 7) {
-#else
-    if (crate_number > 7) {
-#endif
-        return -EINVAL;
-    }
-
-    dev->tx_buffer[0] = (cmd << 4);
-    dev->tx_buffer[1] = (cmd & 0xF0);
-    dev->tx_buffer[2] = (crate_number << 4);
-    dev->tx_buffer[3] = (crate_number & 0xF0);
-
-    //??? where does the address go?
-    
-    result = ccp_inout(dev, 4, 4);
-    if (result < 0) {
-        return result;
-    }
-
-    reply = (
-        ((unsigned short)(dev->rx_buffer[dev->start_n + 3] & 0x0F) << 12) |
-        ((unsigned short)(dev->rx_buffer[dev->start_n + 2] & 0x0F) << 8) |
-        ((unsigned short)(dev->rx_buffer[dev->start_n + 1] & 0x0F) << 4) |
-        ((unsigned short)(dev->rx_buffer[dev->start_n] & 0x0F))
-    );
-
-    if (data) {
-        *data = reply;
-    }
-
-    return 0;
-}
-#endif
+/* camdrv.c */
+/* Created by Sanshiro Enomoto on 11 April 1999 */
+/* Last updated by Sanshiro Enomoto on 1 December 2025 */
+
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/usb.h>
+#include <linux/device.h>
+#include <linux/cdev.h>
+#include <linux/uaccess.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/delay.h>
+#include <linux/ioctl.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+#include <linux/spinlock.h>
+#include <linux/moduleparam.h>
+#include <linux/sched/signal.h>
+#include <linux/kthread.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/log2.h>
+#include <linux/ktime.h>
+#include <linux/poll.h>
+#include <linux/idr.h>
+#include <linux/kref.h>
+#include "camdrv.h"
+
+#define CREATE_TRACE_POINTS
+#include "camdrv_trace.h"
+
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Sanshiro Enomoto");
+MODULE_DESCRIPTION("CAMAC Driver for Hoshin CCP-USB(V2) Controller");
+MODULE_VERSION("1.00");
+
+#define DRIVER_NAME "camdrv"
+#define DEVICE_NAME "camdrv"
+#define MAX_DEVICES 16
+#define CCP_VENDOR_ID 0x24b9
+#define CCP_PRODUCT_ID 0x0020
+
+#define BUFFER_SIZE (16 * CAMDRV_MAX_COMMANDS)
+#define LATENCY_TIME 2
+#define TIMEOUT_MS 500
+#define USB_IN_TRANSFER_SIZE 512
+#define USB_OUT_TRANSFER_SIZE 512
+#define MAX_IN_TRANSFER_SIZE CAMDRV_MAX_IN_TRANSFER_SIZE
+#define RX_STREAM_SIZE (8 * MAX_IN_TRANSFER_SIZE)
+#define MIN_TIMEOUT_MS 10
+#define MAX_TIMEOUT_MS 60000
+
+#define MAX_PIPELINE_DEPTH 16
+#define CCP_NO_CRATE 0xff
+#define MAX_PENDING_REPLIES (2 * CAMDRV_MAX_COMMANDS)
+#define MAX_REPLY_SIZE 10
+
+#define BLOCK_BUFFER_WORDS 1024
+#define BLOCK_QREPEAT_LIMIT 1000
+
+#define LAM_POLL_INTERVAL_US 2000
+#define LAM_POLL_MIN_INTERVAL_US 10
+#define LAM_POLL_MAX_INTERVAL_US 1000000
+#define LAM_SPIN_MAX_BUDGET_US 5000  // the hybrid spin holds a CPU; a few ms at most
+
+// Defaults of the devices attached afterwards; each device has its own
+// copy in sysfs and SET_TUNING, applied without a replug
+static unsigned pipeline_depth = 4;
+module_param(pipeline_depth, uint, 0644);
+MODULE_PARM_DESC(pipeline_depth, "Number of bulk OUT/IN URBs in flight (1-16)");
+static unsigned latency_timer_ms = LATENCY_TIME;
+module_param(latency_timer_ms, uint, 0644);
+MODULE_PARM_DESC(latency_timer_ms, "FTDI latency timer in ms (1-255)");
+static unsigned in_transfer_size = USB_IN_TRANSFER_SIZE;
+module_param(in_transfer_size, uint, 0644);
+MODULE_PARM_DESC(in_transfer_size, "Bulk IN transfer size in bytes (multiple of the packet size, up to 4096)");
+static unsigned timeout_ms = TIMEOUT_MS;
+module_param(timeout_ms, uint, 0644);
+MODULE_PARM_DESC(timeout_ms, "Timeout of the bulk transfers and the replies in ms (10-60000)");
+
+// Debug support: define DEBUG to enable debug messages
+//#define DEBUG
+#ifdef DEBUG
+#define dbg_print(fmt, ...) pr_info("camdrv: " fmt, ##__VA_ARGS__)
+#define dbg_dev_print(dev, fmt, ...) dev_info(&(dev)->udev->dev, "camdrv: " fmt, ##__VA_ARGS__)
+#else
+#define dbg_print(fmt, ...) do {} while (0)
+#define dbg_dev_print(dev, fmt, ...) do {} while (0)
+#endif
+
+
+static int major_number;
+static struct class *camdrv_class = NULL;
+static dev_t dev_num;
+
+// Minor numbers of the attached controllers, /dev/camdrv0, /dev/camdrv1, ...
+static DEFINE_IDR(camdrv_idr);
+static DEFINE_MUTEX(camdrv_idr_lock);
+
+struct camdrv_device;
+
+// Pre-allocated URB for the bulk pipeline
+struct ccp_urb_slot {
+    struct camdrv_device *dev;
+    struct urb *urb;
+    unsigned char *buffer;
+    bool is_busy;
+};
+
+// Expected reply, filled in by the bulk IN completion handler
+struct ccp_reply_slot {
+    unsigned int read_size;
+    unsigned char frame[MAX_REPLY_SIZE];
+    bool is_done;
+};
+
+// State of one LAM polling loop
+struct ccp_lam_poller {
+    ktime_t last_poll;   // end of the previous poll
+    ktime_t spin_start;  // hybrid: start of the current busy period
+    ktime_t last_lam;    // adaptive: previous detection
+    u64 period_ns;       // adaptive: average LAM period
+    bool was_lam;        // a LAM of the mask at the previous poll
+    bool is_lam_pending; // a LAM of any station at the previous poll
+};
+
+// Poll-to-detection latency: the time from the end of the last poll without
+// LAM to the end of the poll that saw it, an upper bound of the latency
+struct ccp_lam_statistics {
+    unsigned long poll_count;
+    u64 poll_ns;
+    unsigned long detection_count;
+    u64 latency_ns;
+    u64 max_latency_ns;
+    unsigned long request_count;  // LAM requests seen in the replies of other transactions
+    unsigned long spared_count;   // polls spared by a reply showing no LAM
+};
+
+// Transactions are counted per command type, in this order
+enum ccp_command_type {
+    CCP_COUNT_CAMAC,
+    CCP_COUNT_LAM,
+    CCP_COUNT_WRITE_REG,
+    CCP_COUNT_READ_REG,
+    CCP_COUNT_INITIALIZE,
+    CCP_COUNT_OTHER,
+    CCP_NUMBER_OF_COMMAND_TYPES
+};
+
+// log2 histogram: bin k counts the times in [2^k, 2^(k+1)) ns
+#define CCP_HISTOGRAM_BINS 32
+
+struct ccp_histogram {
+    atomic_long_t bins[CCP_HISTOGRAM_BINS];
+};
+
+// Always-on device statistics, reset by a write to the statistics attribute.
+// The counters are updated with the mutex held; the histograms are atomic,
+// as the LAM waiters add to theirs without the mutex.
+struct ccp_statistics {
+    unsigned long command_count[CCP_NUMBER_OF_COMMAND_TYPES];
+    u64 bytes_out;
+    u64 bytes_in;
+    unsigned long usb_error_count;
+    unsigned long timeout_count;
+    unsigned long lam_poll_count;
+    unsigned long lam_hit_count;
+    struct ccp_histogram write_ns;     // ccp_inout(): submitting the command
+    struct ccp_histogram read_ns;      // ccp_inout(): from the submission to the reply
+    struct ccp_histogram lam_wake_ns;  // WAIT_LAM: from the LAM thread seeing the LAM to the waiter taking it
+};
+
+static inline void ccp_histogram_add(struct ccp_histogram *histogram, s64 ns)
+{
+    unsigned bin = (ns > 0) ? min_t(unsigned, ilog2((u64) ns), CCP_HISTOGRAM_BINS - 1) : 0;
+
+    atomic_long_inc(&histogram->bins[bin]);
+}
+
+#define NUMBER_OF_PRIORITIES (CAMDRV_PRIORITY_HIGH + 1)
+
+// Device structure
+struct camdrv_device {
+    struct usb_device *udev;
+    struct usb_interface *interface;
+    struct kref kref;      // taken by the driver, by each open file and by each mapping of the ring
+    bool is_disconnected;  // set under the mutex on unplug; the files then fail with -ENODEV
+    struct cdev *cdev;     // not embedded: the last release can come after the device is freed
+    struct device *class_device;
+    int minor;
+    struct mutex mutex;
+    atomic_t arbiter_waiting[NUMBER_OF_PRIORITIES];
+    wait_queue_head_t arbiter_wait;
+    struct usb_endpoint_descriptor *bulk_in;
+    struct usb_endpoint_descriptor *bulk_out;
+    unsigned char *tx_buffer;
+    struct camdrv_tuning tuning;
+    struct ccp_urb_slot tx_slots[MAX_PIPELINE_DEPTH];
+    struct usb_anchor tx_anchor;
+    wait_queue_head_t tx_wait;
+    unsigned int tx_next;
+    int tx_error;
+    struct ccp_urb_slot rx_slots[MAX_PIPELINE_DEPTH];
+    struct usb_anchor rx_anchor;
+    wait_queue_head_t rx_wait;
+    spinlock_t rx_lock;
+    int rx_error;
+    unsigned char *rx_stream;
+    unsigned int rx_head, rx_tail;
+    bool rx_purge_needed;
+    bool is_resyncing;
+    unsigned long resync_count;
+    struct ccp_reply_slot reply_slots[MAX_PENDING_REPLIES];
+    unsigned int reply_head, reply_tail;
+    unsigned char *reply;
+    struct camdrv_command_list *command_list;
+    unsigned *block_buffer;
+    struct camdrv_readout *readout;
+    struct task_struct *readout_thread;
+    struct camdrv_file *readout_owner;
+    void *ring;
+    unsigned ring_size;
+    atomic_t ring_map_count;
+    struct task_struct *lam_thread;
+    unsigned lam_watch_count;
+    unsigned lam_watchers[24];  // per station: the watching files with it in their mask
+    unsigned lam_watch_mask;    // the stations of lam_watchers, tested by the LAM thread
+    unsigned lam_crate;
+    wait_queue_head_t lam_wait;
+    unsigned lam_pattern;
+    struct camdrv_lam_polling lam_polling;
+    struct ccp_lam_statistics lam_statistics;
+    struct ccp_statistics statistics;
+    ktime_t lam_seen_time;  // when the LAM thread last set lam_pattern
+    unsigned long lam_requests;        // bit per crate: a reply showed a LAM since the last poll
+    ktime_t lam_idle_time[8];          // per crate: the latest reply showing no LAM
+    wait_queue_head_t lam_request_wait;
+    bool is_reading_lam;               // the replies of the F8 of ccp_read_lam() are not noted
+    unsigned open_count;
+    struct camdrv_file *exclusive_owner;
+    unsigned crate_initialized;  // bit mask of the crates initialized since the SIO reset
+    unsigned selected_crate;     // of the last INITIALIZE_CCP, the target of WRITE_REG
+};
+
+// Per-file context: each open() has its own crate, transfer settings and
+// priority, and shares the controller with the other files
+struct camdrv_file {
+    struct camdrv_device *dev;
+    unsigned crate_number;
+    unsigned priority;
+    struct camdrv_block_transfer block_transfer;
+    struct camdrv_stream stream;
+    struct camdrv_file_statistics statistics;
+    bool is_lam_watching;
+    unsigned lam_mask;
+};
+
+static struct usb_device_id camdrv_table[] = {
+    { USB_DEVICE(CCP_VENDOR_ID, CCP_PRODUCT_ID) },
+    { }
+};
+MODULE_DEVICE_TABLE(usb, camdrv_table);
+
+static int camdrv_open(struct inode *inode, struct file *file);
+static int camdrv_release(struct inode *inode, struct file *file);
+static long camdrv_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
+static long camdrv_do_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
+static ssize_t camdrv_read(struct file *file, char __user *buf, size_t count, loff_t *ppos);
+static ssize_t camdrv_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos);
+static ssize_t camdrv_read_block(struct camdrv_file *context, char __user *buf, size_t count);
+static ssize_t camdrv_read_stream(struct camdrv_file *context, char __user *buf, size_t count);
+static ssize_t camdrv_write_stream(struct camdrv_file *context, const char __user *buf, size_t count);
+static int camdrv_lock(struct camdrv_file *context);
+static bool camdrv_is_excluded(struct camdrv_device *dev, struct camdrv_file *context);
+static int camdrv_mmap(struct file *file, struct vm_area_struct *vma);
+static __poll_t camdrv_poll(struct file *file, poll_table *wait);
+static int camdrv_start_lam_watch(struct camdrv_device *dev, struct camdrv_file *context);
+static void camdrv_stop_lam_watch(struct camdrv_device *dev, struct camdrv_file *context);
+static int camdrv_wait_lam_event(struct camdrv_device *dev, unsigned mask, u64 timeout_us, unsigned *data);
+static unsigned camdrv_take_lam(struct camdrv_device *dev, unsigned mask);
+static void camdrv_count_lam_watch(struct camdrv_device *dev, unsigned mask, int increment);
+static void camdrv_vm_open(struct vm_area_struct *vma);
+static void camdrv_vm_close(struct vm_area_struct *vma);
+static int camdrv_start_readout(struct camdrv_device *dev, struct camdrv_file *context, struct camdrv_readout __user *user_readout);
+static int camdrv_stop_readout(struct camdrv_device *dev, struct camdrv_file *context);
+static int camdrv_probe(struct usb_interface *interface, const struct usb_device_id *id);
+static void camdrv_disconnect(struct usb_interface *interface);
+static void camdrv_delete(struct kref *kref);
+
+static int ftdi_init_sync_fifo(struct camdrv_device *dev);
+static int ftdi_set_latency_timer(struct camdrv_device *dev, unsigned latency_timer_ms);
+static int ftdi_control_request(struct usb_device *udev, u8 request_type, u8 request, u16 value, u16 index, void *data, u16 size);
+
+static int ccp_lock(struct camdrv_device *dev, unsigned priority);
+static int ccp_alloc_urbs(struct camdrv_device *dev);
+static void ccp_free_urbs(struct camdrv_device *dev);
+static int ccp_start_reader(struct camdrv_device *dev);
+static void ccp_stop(struct camdrv_device *dev);
+static void ccp_reset_stream(struct camdrv_device *dev);
+static void ccp_purge(struct camdrv_device *dev);
+static void ccp_prepare(struct camdrv_device *dev);
+static int ccp_check_tuning(struct camdrv_device *dev, const struct camdrv_tuning *tuning);
+static int ccp_set_tuning(struct camdrv_device *dev, const struct camdrv_tuning *tuning);
+static int ccp_write(struct camdrv_device *dev, unsigned int write_size);
+static int ccp_expect_reply(struct camdrv_device *dev, unsigned int read_size, unsigned int *ticket);
+static int ccp_wait_reply(struct camdrv_device *dev, unsigned int ticket, unsigned char **reply);
+static int ccp_inout(struct camdrv_device *dev, unsigned int write_size, unsigned int read_size);
+static int ccp_init(struct camdrv_device *dev, unsigned char crate_number);
+static int ccp_init_crate(struct camdrv_device *dev, unsigned crate_number);
+static int ccp_select_crate(struct camdrv_device *dev, unsigned crate_number);
+static int ccp_initialize(struct camdrv_device *dev, unsigned crate_number);
+static int ccp_clear(struct camdrv_device *dev, unsigned crate_number);
+static int ccp_camac_action(struct camdrv_device *dev, unsigned crate, unsigned n, unsigned a, unsigned f, unsigned* data);
+static int ccp_camac_list(struct camdrv_device *dev, unsigned crate, struct camdrv_command *commands, unsigned number_of_commands);
+static int ccp_submit_camac(struct camdrv_device *dev, unsigned crate, unsigned n, unsigned a, unsigned f, unsigned data, unsigned *ticket);
+static void ccp_pack_word(unsigned char *bytes, unsigned data, unsigned word_size);
+static unsigned ccp_unpack_word(const unsigned char *bytes, unsigned word_size);
+static int ccp_block_transfer(struct camdrv_device *dev, unsigned crate, unsigned mode, unsigned *naf, unsigned *words, unsigned max_count, bool *is_finished);
+static int ccp_readout_thread(void *arg);
+static int ccp_lam_thread(void *arg);
+static void ccp_push_event(struct camdrv_device *dev, unsigned lam_pattern, struct camdrv_command *commands, unsigned number_of_commands);
+static int ccp_read_lam(struct camdrv_device *dev, unsigned char crate_number, unsigned mask, unsigned *data);
+static int ccp_wait_lam(struct camdrv_file *context, unsigned char crate_number, u64 timeout_us, unsigned* data);
+static void ccp_lam_poller_init(struct ccp_lam_poller *poller);
+static int ccp_lam_poll(struct camdrv_device *dev, struct ccp_lam_poller *poller, unsigned crate_number, unsigned mask, unsigned *lam);
+static void ccp_lam_poll_sleep(struct camdrv_device *dev, struct ccp_lam_poller *poller, unsigned crate_number);
+//static int ccp_read_register(struct camdrv_device *dev, unsigned char crate_number, unsigned address, unsigned *data);
+static int ccp_write_register(struct camdrv_device *dev, unsigned char crate_number, unsigned address, unsigned data);
+
+
+
+static ssize_t serial_number_show(struct device *device, struct device_attribute *attr, char *buf);
+static ssize_t bus_path_show(struct device *device, struct device_attribute *attr, char *buf);
+static ssize_t resync_count_show(struct device *device, struct device_attribute *attr, char *buf);
+static ssize_t lam_poll_strategy_show(struct device *device, struct device_attribute *attr, char *buf);
+static ssize_t lam_poll_strategy_store(struct device *device, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t lam_poll_interval_us_show(struct device *device, struct device_attribute *attr, char *buf);
+static ssize_t lam_poll_interval_us_store(struct device *device, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t lam_spin_budget_us_show(struct device *device, struct device_attribute *attr, char *buf);
+static ssize_t lam_spin_budget_us_store(struct device *device, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t lam_latency_show(struct device *device, struct device_attribute *attr, char *buf);
+static ssize_t statistics_show(struct device *device, struct device_attribute *attr, char *buf);
+static ssize_t statistics_store(struct device *device, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t histograms_show(struct device *device, struct device_attribute *attr, char *buf);
+static ssize_t latency_timer_ms_show(struct device *device, struct device_attribute *attr, char *buf);
+static ssize_t latency_timer_ms_store(struct device *device, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t in_transfer_size_show(struct device *device, struct device_attribute *attr, char *buf);
+static ssize_t in_transfer_size_store(struct device *device, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t pipeline_depth_show(struct device *device, struct device_attribute *attr, char *buf);
+static ssize_t pipeline_depth_store(struct device *device, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t timeout_ms_show(struct device *device, struct device_attribute *attr, char *buf);
+static ssize_t timeout_ms_store(struct device *device, struct device_attribute *attr, const char *buf, size_t count);
+static DEVICE_ATTR_RO(serial_number);
+static DEVICE_ATTR_RO(bus_path);
+static DEVICE_ATTR_RO(resync_count);
+static DEVICE_ATTR_RW(lam_poll_strategy);
+static DEVICE_ATTR_RW(lam_poll_interval_us);
+static DEVICE_ATTR_RW(lam_spin_budget_us);
+static DEVICE_ATTR_RO(lam_latency);
+static DEVICE_ATTR_RW(statistics);
+static DEVICE_ATTR_RO(histograms);
+static DEVICE_ATTR_RW(latency_timer_ms);
+static DEVICE_ATTR_RW(in_transfer_size);
+static DEVICE_ATTR_RW(pipeline_depth);
+static DEVICE_ATTR_RW(timeout_ms);
+
+// Attributes of the class device, /sys/class/camdrv/camdrvN
+static struct attribute *camdrv_attrs[] = {
+    &dev_attr_serial_number.attr,
+    &dev_attr_bus_path.attr,
+    &dev_attr_resync_count.attr,
+    &dev_attr_lam_poll_strategy.attr,
+    &dev_attr_lam_poll_interval_us.attr,
+    &dev_attr_lam_spin_budget_us.attr,
+    &dev_attr_lam_latency.attr,
+    &dev_attr_statistics.attr,
+    &dev_attr_histograms.attr,
+    &dev_attr_latency_timer_ms.attr,
+    &dev_attr_in_transfer_size.attr,
+    &dev_attr_pipeline_depth.attr,
+    &dev_attr_timeout_ms.attr,
+    NULL
+};
+
+// in the order of CAMDRV_LAM_POLL_*
+static const char * const lam_poll_strategy_names[] = {
+    "sleep", "busy", "hybrid", "hrtimer", "adaptive"
+};
+ATTRIBUTE_GROUPS(camdrv);
+
+
+static const struct file_operations camdrv_fops = {
+    .owner = THIS_MODULE,
+    .open = camdrv_open,
+    .release = camdrv_release,
+    .unlocked_ioctl = camdrv_ioctl,
+    .read = camdrv_read,
+    .write = camdrv_write,
+    .mmap = camdrv_mmap,
+    .poll = camdrv_poll,
+};
+
+static const struct vm_operations_struct camdrv_vm_ops = {
+    .open = camdrv_vm_open,
+    .close = camdrv_vm_close,
+};
+
+static struct usb_driver camdrv_driver = {
+    .name = DRIVER_NAME,
+    .probe = camdrv_probe,
+    .disconnect = camdrv_disconnect,
+    .id_table = camdrv_table,
+};
+
+
+static int __init camdrv_init(void)
+{
+    int result;
+    
+    result = alloc_chrdev_region(&dev_num, 0, MAX_DEVICES, DEVICE_NAME);
+    if (result < 0) {
+        pr_err("Failed to allocate chrdev region\n");
+        return result;
+    }
+    major_number = MAJOR(dev_num);
+    
+    camdrv_class = class_create(DEVICE_NAME);
+    if (IS_ERR(camdrv_class)) {
+        pr_err("Failed to create device class\n");
+        result = PTR_ERR(camdrv_class);
+        goto error_class;
+    }
+    
+    result = usb_register(&camdrv_driver);
+    if (result) {
+        pr_err("Failed to register USB driver\n");
+        goto error_usb;
+    }
+    
+    pr_info("CCP-USB(V2) kernel driver loaded\n");
+    return 0;
+    
+  error_usb:
+    class_destroy(camdrv_class);
+  error_class:
+    unregister_chrdev_region(dev_num, MAX_DEVICES);
+        
+    return result;
+}
+module_init(camdrv_init);
+
+
+static void __exit camdrv_exit(void)
+{
+    usb_deregister(&camdrv_driver);
+    class_destroy(camdrv_class);
+    unregister_chrdev_region(dev_num, MAX_DEVICES);
+    idr_destroy(&camdrv_idr);
+    pr_info("CCP-USB(V2) kernel driver unloaded\n");
+}
+module_exit(camdrv_exit);
+
+
+static int camdrv_probe(struct usb_interface *interface, const struct usb_device_id *id)
+{
+    struct usb_device *udev = interface_to_usbdev(interface);
+    struct usb_host_interface *iface_desc;
+    struct usb_endpoint_descriptor *endpoint;
+    struct camdrv_device *dev;
+    int result = -ENOMEM;
+    int i;
+    
+    dbg_print("camdrv_probe: device detected (vendor=0x%04x, product=0x%04x)\n",
+             le16_to_cpu(udev->descriptor.idVendor),
+             le16_to_cpu(udev->descriptor.idProduct));
+    
+    dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+    if (!dev) {
+        dev_err(&interface->dev, "camdrv_probe: failed to allocate device structure\n");
+        return -ENOMEM;
+    }
+    
+    kref_init(&dev->kref);
+    dev->udev = usb_get_dev(udev);
+    dev->interface = interface;
+    
+    // Find bulk endpoints
+    iface_desc = interface->cur_altsetting;
+    dbg_print("camdrv_probe: searching endpoints (num_endpoints=%u)\n",
+             iface_desc->desc.bNumEndpoints);
+    for (i = 0; i < iface_desc->desc.bNumEndpoints; i++) {
+        endpoint = &iface_desc->endpoint[i].desc;
+        dbg_print("camdrv_probe: endpoint[%d]: addr=0x%02x, type=%u, dir=%s\n",
+                 i, endpoint->bEndpointAddress,
+                 usb_endpoint_type(endpoint),
+                 usb_endpoint_dir_in(endpoint) ? "IN" : "OUT");
+        if (usb_endpoint_is_bulk_in(endpoint)) {
+            if (!dev->bulk_in) {
+                dev->bulk_in = endpoint;
+                dbg_print("camdrv_probe: found bulk IN endpoint: 0x%02x\n",
+                         endpoint->bEndpointAddress);
+            }
+        } else if (usb_endpoint_is_bulk_out(endpoint)) {
+            if (!dev->bulk_out) {
+                dev->bulk_out = endpoint;
+                dbg_print("camdrv_probe: found bulk OUT endpoint: 0x%02x\n",
+                         endpoint->bEndpointAddress);
+            }
+        }
+    }
+    
+    if (!dev->bulk_in || !dev->bulk_out) {
+        dev_err(&interface->dev, "Could not find bulk endpoints (in=%p, out=%p)\n",
+               dev->bulk_in, dev->bulk_out);
+        result = -ENODEV;
+        goto error;
+    }
+    
+    dev->tx_buffer = kmalloc(BUFFER_SIZE, GFP_KERNEL);
+    dev->rx_stream = kmalloc(RX_STREAM_SIZE, GFP_KERNEL);
+    dev->command_list = kmalloc(sizeof(struct camdrv_command_list), GFP_KERNEL);
+    dev->block_buffer = kmalloc_array(BLOCK_BUFFER_WORDS, sizeof(unsigned), GFP_KERNEL);
+    if (!dev->tx_buffer || !dev->rx_stream || !dev->command_list || !dev->block_buffer) {
+        dev_err(&interface->dev, "camdrv_probe: failed to allocate buffers\n");
+        result = -ENOMEM;
+        goto error;
+    }
+    dbg_print("camdrv_probe: allocated buffers (tx=%p, rx=%p)\n",
+             dev->tx_buffer, dev->rx_stream);
+    
+    result = ccp_alloc_urbs(dev);
+    if (result < 0) {
+        dev_err(&interface->dev, "camdrv_probe: failed to allocate URBs\n");
+        goto error;
+    }
+    
+    mutex_init(&dev->mutex);
+    for (i = 0; i < NUMBER_OF_PRIORITIES; i++) {
+        atomic_set(&dev->arbiter_waiting[i], 0);
+    }
+    init_waitqueue_head(&dev->arbiter_wait);
+    init_usb_anchor(&dev->tx_anchor);
+    init_usb_anchor(&dev->rx_anchor);
+    init_waitqueue_head(&dev->tx_wait);
+    init_waitqueue_head(&dev->rx_wait);
+    spin_lock_init(&dev->rx_lock);
+    dev->tuning.latency_timer_ms = latency_timer_ms;
+    dev->tuning.in_transfer_size = in_transfer_size;
+    dev->tuning.pipeline_depth = pipeline_depth;
+    dev->tuning.timeout_ms = timeout_ms;
+    if (ccp_check_tuning(dev, &dev->tuning) < 0) {
+        dev_warn(&interface->dev, "camdrv_probe: invalid module parameters, using the defaults\n");
+        dev->tuning.latency_timer_ms = LATENCY_TIME;
+        dev->tuning.in_transfer_size = USB_IN_TRANSFER_SIZE;
+        dev->tuning.pipeline_depth = 4;
+        dev->tuning.timeout_ms = TIMEOUT_MS;
+    }
+    dev->rx_head = dev->rx_tail = 0;
+    dev->rx_purge_needed = true;
+    dev->open_count = 0;
+    dev->exclusive_owner = NULL;
+    atomic_set(&dev->ring_map_count, 0);
+    init_waitqueue_head(&dev->lam_wait);
+    init_waitqueue_head(&dev->lam_request_wait);
+    dev->lam_polling.strategy = CAMDRV_LAM_POLL_SLEEP;
+    dev->lam_polling.interval_us = LAM_POLL_INTERVAL_US;
+    dev->lam_polling.spin_budget_us = 0;
+    
+    mutex_lock(&camdrv_idr_lock);
+    dev->minor = idr_alloc(&camdrv_idr, dev, 0, MAX_DEVICES, GFP_KERNEL);
+    mutex_unlock(&camdrv_idr_lock);
+    if (dev->minor < 0) {
+        dev_err(&interface->dev, "camdrv_probe: no free minor number (max %d devices)\n", MAX_DEVICES);
+        result = dev->minor;
+        goto error;
+    }
+    
+    dev->cdev = cdev_alloc();
+    if (!dev->cdev) {
+        result = -ENOMEM;
+        goto error_idr;
+    }
+    dev->cdev->ops = &camdrv_fops;
+    dev->cdev->owner = THIS_MODULE;
+    result = cdev_add(dev->cdev, MKDEV(major_number, dev->minor), 1);
+    if (result) {
+        dev_err(&interface->dev, "Error %d adding cdev\n", result);
+        kobject_put(&dev->cdev->kobj);
+        goto error_idr;
+    }
+    dbg_print("camdrv_probe: cdev added successfully, minor=%d\n", dev->minor);
+    
+    usb_set_intfdata(interface, dev);
+    
+    dev->class_device = device_create_with_groups(
+        camdrv_class, &interface->dev, MKDEV(major_number, dev->minor), dev, camdrv_groups,
+        DEVICE_NAME "%d", dev->minor
+    );
+    if (IS_ERR(dev->class_device)) {
+        dev_err(&interface->dev, "camdrv_probe: failed to create device\n");
+        result = PTR_ERR(dev->class_device);
+        usb_set_intfdata(interface, NULL);
+        cdev_del(dev->cdev);
+        goto error_idr;
+    }
+    
+    dev_info(&interface->dev, "CCP-USB(V2) device attached as %s%d\n", DEVICE_NAME, dev->minor);
+    dbg_print("camdrv_probe: probe completed successfully\n");
+    
+    return 0;
+    
+  error_idr:
+    mutex_lock(&camdrv_idr_lock);
+    idr_remove(&camdrv_idr, dev->minor);
+    mutex_unlock(&camdrv_idr_lock);
+  error:
+    kref_put(&dev->kref, camdrv_delete);
+    
+    dbg_print("camdrv_probe: probe failed with error %d\n", result);
+    return result;
+}
+
+
+static void camdrv_disconnect(struct usb_interface *interface)
+{
+    struct camdrv_device *dev = usb_get_intfdata(interface);
+
+    usb_set_intfdata(interface, NULL);
+    
+    if (dev) {
+        device_destroy(camdrv_class, MKDEV(major_number, dev->minor));
+        cdev_del(dev->cdev);
+        mutex_lock(&camdrv_idr_lock);
+        idr_remove(&camdrv_idr, dev->minor);
+        mutex_unlock(&camdrv_idr_lock);
+        mutex_lock(&dev->mutex);
+        dev->is_disconnected = true;
+        mutex_unlock(&dev->mutex);
+        camdrv_stop_readout(dev, NULL);
+        camdrv_stop_lam_watch(dev, NULL);
+        mutex_lock(&dev->mutex);
+        ccp_stop(dev);
+        mutex_unlock(&dev->mutex);
+        dev_info(&interface->dev, "CCP-USB(V2) device disconnected\n");
+        // freed here, or by the release of the last open file or mapping
+        kref_put(&dev->kref, camdrv_delete);
+    }
+}
+
+
+static void camdrv_delete(struct kref *kref)
+{
+    struct camdrv_device *dev = container_of(kref, struct camdrv_device, kref);
+
+    ccp_free_urbs(dev);
+    kfree(dev->tx_buffer);
+    kfree(dev->rx_stream);
+    kfree(dev->command_list);
+    kfree(dev->block_buffer);
+    kfree(dev->readout);
+    vfree(dev->ring);
+    usb_put_dev(dev->udev);
+    kfree(dev);
+}
+
+
+// The controller is initialized by the first open only; the later ones
+// share it. O_EXCL opens the device exclusively, as SET_EXCLUSIVE does.
+static int camdrv_open(struct inode *inode, struct file *file)
+{
+    struct camdrv_device *dev;
+    struct camdrv_file *context;
+    int result = 0;
+    
+    dbg_print("camdrv_open: called\n");
+    
+    // looked up by the minor: the device may be unplugged while the inode is held
+    mutex_lock(&camdrv_idr_lock);
+    dev = idr_find(&camdrv_idr, iminor(inode));
+    if (dev) {
+        kref_get(&dev->kref);
+    }
+    mutex_unlock(&camdrv_idr_lock);
+    if (!dev) {
+        return -ENODEV;
+    }
+    context = kzalloc(sizeof(struct camdrv_file), GFP_KERNEL);
+    if (!context) {
+        kref_put(&dev->kref, camdrv_delete);
+        return -ENOMEM;
+    }
+    context->dev = dev;
+    context->crate_number = 1;
+    context->priority = CAMDRV_PRIORITY_NORMAL;
+    context->lam_mask = CAMDRV_LAM_MASK_ALL;
+    
+    dbg_dev_print(dev, "camdrv_open: device found, open_count=%u\n", dev->open_count);
+    
+    if (mutex_lock_interruptible(&dev->mutex)) {
+        dbg_dev_print(dev, "camdrv_open: mutex lock interrupted\n");
+        kfree(context);
+        kref_put(&dev->kref, camdrv_delete);
+        return -ERESTARTSYS;
+    }
+    
+    if (dev->is_disconnected) {
+        result = -ENODEV;
+        goto err_unlock;
+    }
+    if (dev->exclusive_owner || ((file->f_flags & O_EXCL) && (dev->open_count > 0))) {
+        dbg_dev_print(dev, "camdrv_open: device opened exclusively\n");
+        result = -EBUSY;
+        goto err_unlock;
+    }
+    if (dev->open_count > 0) {
+        goto opened;
+    }
+    
+    dbg_dev_print(dev, "camdrv_open: initializing FTDI device\n");
+    result = ftdi_init_sync_fifo(dev);
+    if (result < 0) {
+        dev_err(&dev->udev->dev, "Failed to initialize FTDI device: %d\n", result);
+        goto err_unlock;
+    }
+    dbg_dev_print(dev, "camdrv_open: FTDI device initialized successfully\n");
+
+    result = ccp_start_reader(dev);
+    if (result < 0) {
+        dev_err(&dev->udev->dev, "Failed to start bulk IN pipeline: %d\n", result);
+        goto err_unlock;
+    }
+    dbg_dev_print(dev, "camdrv_open: bulk pipeline started, depth=%u\n", dev->tuning.pipeline_depth);
+    
+    dbg_dev_print(dev, "camdrv_open: initializing CCP interface, crate=%u\n", context->crate_number);
+    result = ccp_init(dev, context->crate_number);
+    if (result < 0) {
+        dev_err(&dev->udev->dev, "Failed to initialize CCP interface: %d\n", result);
+        ccp_stop(dev);
+        goto err_unlock;
+    }
+    dbg_dev_print(dev, "camdrv_open: CCP interface initialized, result=0x%02x\n", result);
+    pr_info("CCP-USB(V2) opened\n");
+    
+  opened:
+    dev->open_count++;
+    if (file->f_flags & O_EXCL) {
+        WRITE_ONCE(dev->exclusive_owner, context);
+    }
+    file->private_data = context;
+    mutex_unlock(&dev->mutex);
+    
+    dbg_dev_print(dev, "camdrv_open: successfully opened, open_count=%u\n", dev->open_count);
+    return 0;
+
+  err_unlock:
+    mutex_unlock(&dev->mutex);
+    kfree(context);
+    dbg_dev_print(dev, "camdrv_open: failed with error %d\n", result);
+    kref_put(&dev->kref, camdrv_delete);
+    return result;
+}
+
+
+static int camdrv_release(struct inode *inode, struct file *file)
+{
+    struct camdrv_file *context = file->private_data;
+    struct camdrv_device *dev;
+
+    if (context) {
+        dev = context->dev;
+        camdrv_stop_readout(dev, context);
+        camdrv_stop_lam_watch(dev, context);
+        mutex_lock(&dev->mutex);
+        if (dev->exclusive_owner == context) {
+            WRITE_ONCE(dev->exclusive_owner, NULL);
+        }
+        dev->open_count--;
+        if (dev->open_count == 0) {
+            ccp_stop(dev);
+            // a mapping can outlive the file; the ring then goes with the device
+            if (atomic_read(&dev->ring_map_count) == 0) {
+                vfree(dev->ring);
+                dev->ring = NULL;
+                dev->ring_size = 0;
+            }
+        }
+        mutex_unlock(&dev->mutex);
+        kfree(context);
+        kref_put(&dev->kref, camdrv_delete);
+    }
+
+    return 0;
+}
+
+
+// Takes the device for one transaction of the file, through the arbiter.
+// Fails with -EBUSY while another file holds the device exclusively, and
+// with -ENODEV once it is unplugged.
+static int camdrv_lock(struct camdrv_file *context)
+{
+    struct camdrv_device *dev = context->dev;
+    ktime_t start = ktime_get();
+    u64 wait_ns;
+    int result;
+
+    result = ccp_lock(dev, READ_ONCE(context->priority));
+    if (result < 0) {
+        return result;
+    }
+    if (dev->is_disconnected) {
+        mutex_unlock(&dev->mutex);
+        return -ENODEV;
+    }
+    if (camdrv_is_excluded(dev, context)) {
+        mutex_unlock(&dev->mutex);
+        return -EBUSY;
+    }
+
+    wait_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    context->statistics.transaction_count++;
+    context->statistics.wait_ns += wait_ns;
+    context->statistics.max_wait_ns = max(context->statistics.max_wait_ns, (unsigned long long) wait_ns);
+
+    return 0;
+}
+
+
+// Whether another file holds the device exclusively; NULL is none of the
+// files, e.g. sysfs. Read without the mutex for WAIT_LAM.
+static bool camdrv_is_excluded(struct camdrv_device *dev, struct camdrv_file *context)
+{
+    struct camdrv_file *owner = READ_ONCE(dev->exclusive_owner);
+
+    return owner && (owner != context);
+}
+
+
+static long camdrv_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct camdrv_file *context = file->private_data;
+    long result;
+
+    trace_camdrv_ioctl_enter(context->dev->minor, cmd, arg);
+    result = camdrv_do_ioctl(file, cmd, arg);
+    trace_camdrv_ioctl_exit(context->dev->minor, cmd, result);
+
+    return result;
+}
+
+
+static long camdrv_do_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    unsigned parameter = 0, data = 0;
+    unsigned *user_parameter_ptr, *user_data_ptr;
+    struct camdrv_command_list __user *user_list_ptr;
+    struct camdrv_block_transfer block_transfer;
+    struct camdrv_stream stream;
+    struct camdrv_lam_polling lam_polling;
+    struct camdrv_action action;
+    struct camdrv_tuning tuning;
+    unsigned crate_number, n, a, f;
+    u64 timeout_us;
+    int result = 0;
+
+    struct camdrv_file *context = file->private_data;
+    struct camdrv_device *dev = context->dev;
+    crate_number = context->crate_number;
+    
+    dbg_dev_print(dev, "camdrv_ioctl: cmd=0x%08x, arg=0x%08lx\n", cmd, arg);
+    
+    user_parameter_ptr = (unsigned *) arg;
+    user_data_ptr = (unsigned *) arg + 1;
+    user_list_ptr = (struct camdrv_command_list __user *) arg;
+
+    if (_IOC_TYPE(cmd) != CAMDRV_IOC_MAGIC) {
+        dbg_dev_print(dev, "camdrv_ioctl: invalid IOC magic (got 0x%02x, expected 0x%02x)\n", 
+                     _IOC_TYPE(cmd), CAMDRV_IOC_MAGIC);
+        return -EINVAL;
+    }
+    if ((cmd == CAMDRV_IOC_START_READOUT) || (cmd == CAMDRV_IOC_STOP_READOUT)) {
+        // the readout thread takes the mutex, so it is stopped without it
+        result = camdrv_stop_readout(dev, context);
+        if ((result < 0) || (cmd == CAMDRV_IOC_STOP_READOUT)) {
+            return result;
+        }
+        return camdrv_start_readout(dev, context, (struct camdrv_readout __user *) arg);
+    }
+    if (cmd == CAMDRV_IOC_ENABLE_INTERRUPT) {
+        dbg_dev_print(dev, "camdrv_ioctl: ENABLE_INTERRUPT, crate=%u\n", crate_number);
+        return camdrv_start_lam_watch(dev, context);
+    }
+    if (cmd == CAMDRV_IOC_DISABLE_INTERRUPT) {
+        dbg_dev_print(dev, "camdrv_ioctl: DISABLE_INTERRUPT\n");
+        camdrv_stop_lam_watch(dev, context);
+        return 0;
+    }
+    if (cmd == CAMDRV_IOC_GET_STATISTICS) {
+        if (copy_to_user((void __user *) arg, &context->statistics, sizeof(struct camdrv_file_statistics))) {
+            return -EFAULT;
+        }
+        return 0;
+    }
+    if (cmd == CAMDRV_IOC_GET_TUNING) {
+        tuning.latency_timer_ms = READ_ONCE(dev->tuning.latency_timer_ms);
+        tuning.in_transfer_size = READ_ONCE(dev->tuning.in_transfer_size);
+        tuning.pipeline_depth = READ_ONCE(dev->tuning.pipeline_depth);
+        tuning.timeout_ms = READ_ONCE(dev->tuning.timeout_ms);
+        if (copy_to_user((void __user *) arg, &tuning, sizeof(tuning))) {
+            return -EFAULT;
+        }
+        return 0;
+    }
+    if ((cmd == CAMDRV_IOC_WAIT_LAM) || (cmd == CAMDRV_IOC_WAIT_LAM_US)) {
+        // WAIT_LAM does not hold the mutex while waiting: either the LAM
+        // thread polls for this file and this only sleeps on its waitqueue,
+        // or ccp_wait_lam() takes the mutex for each poll only. The thread
+        // serves the watching files only, all on its crate; the others,
+        // e.g. on another crate, poll for themselves.
+        if (get_user(parameter, user_parameter_ptr) < 0) {
+            return -EFAULT;
+        }
+        // the timeout is in seconds for WAIT_LAM, and in microseconds for WAIT_LAM_US
+        timeout_us = (cmd == CAMDRV_IOC_WAIT_LAM) ? (u64) parameter * USEC_PER_SEC : parameter;
+        dbg_dev_print(dev, "camdrv_ioctl: WAIT_LAM, crate=%u, timeout=%llu us\n", crate_number, timeout_us);
+        if (camdrv_is_excluded(dev, context)) {
+            // ccp_wait_lam() checks it in camdrv_lock(); the LAM thread does not
+            result = -EBUSY;
+        }
+        else if (READ_ONCE(context->is_lam_watching) && READ_ONCE(dev->lam_thread) && (READ_ONCE(dev->lam_crate) == crate_number)) {
+            result = camdrv_wait_lam_event(dev, READ_ONCE(context->lam_mask), timeout_us, &data);
+        }
+        else {
+            result = ccp_wait_lam(context, crate_number, timeout_us, &data);
+        }
+        dbg_dev_print(dev, "camdrv_ioctl: WAIT_LAM result=%d, data=0x%08x\n", result, data);
+        put_user(data, user_data_ptr);
+        return result;
+    }
+    if (_IOC_DIR(cmd) & (_IOC_READ | _IOC_WRITE)) {
+        if (get_user(parameter, user_parameter_ptr) < 0) {
+            dbg_dev_print(dev, "camdrv_ioctl: failed to get parameter\n");
+            return -EFAULT;
+        }
+        if (get_user(data, user_data_ptr) < 0) {
+            dbg_dev_print(dev, "camdrv_ioctl: failed to get data\n");
+            return -EFAULT;
+        }
+        dbg_dev_print(dev, "camdrv_ioctl: parameter=0x%08x, data=0x%08x\n", parameter, data);
+    }
+
+    result = camdrv_lock(context);
+    if (result < 0) {
+        dbg_dev_print(dev, "camdrv_ioctl: device lock failed: %d\n", result);
+        return result;
+    }
+    
+    switch (cmd) {
+      case CAMDRV_IOC_INITIALIZE:
+        dbg_dev_print(dev, "camdrv_ioctl: INITIALIZE, crate=%u\n", crate_number);
+        result = ccp_initialize(dev, crate_number);
+        break;
+      case CAMDRV_IOC_CLEAR:
+        dbg_dev_print(dev, "camdrv_ioctl: CLEAR, crate=%u\n", crate_number);
+        result = ccp_clear(dev, crate_number);
+        break;
+      case CAMDRV_IOC_INHIBIT:
+        dbg_dev_print(dev, "camdrv_ioctl: INHIBIT (not supported)\n");
+        result = -EINVAL;
+        break;
+      case CAMDRV_IOC_RELEASE_INHIBIT:
+        dbg_dev_print(dev, "camdrv_ioctl: RELEASE_INHIBIT (not supported)\n");
+        result = -EINVAL;
+        break;
+      case CAMDRV_IOC_CAMAC_ACTION:
+        n = (parameter >> 9) & 0x1f;
+        a = (parameter >> 5) & 0x0f;
+        f = (parameter >> 0) & 0x1f;
+        dbg_dev_print(
+            dev,
+            "camdrv_ioctl: CAMAC_ACTION, crate=%u, n=%u, a=%u, f=%u, data=0x%08x\n",
+            crate_number, n, a, f, data
+        );
+        result = ccp_camac_action(dev, crate_number, n, a, f, &data);
+        dbg_dev_print(dev, "camdrv_ioctl: CAMAC_ACTION result=%d, data=0x%08x\n", result, data);
+        put_user(data, user_data_ptr);
+        break;
+      case CAMDRV_IOC_READ_LAM:
+        dbg_dev_print(dev, "camdrv_ioctl: READ_LAM, crate=%u\n", crate_number);
+        result = ccp_read_lam(dev, crate_number, context->lam_mask, &data);
+        result = min(result, 0);
+        camdrv_take_lam(dev, context->lam_mask);
+        dbg_dev_print(dev, "camdrv_ioctl: READ_LAM result=%d, data=0x%08x\n", result, data);
+        put_user(data, user_data_ptr);
+        break;
+      case CAMDRV_IOC_SET_CRATE:
+        dbg_dev_print(dev, "camdrv_ioctl: SET_CRATE, old=%u, new=%u\n", crate_number, parameter);
+        // a crate already initialized is only selected, without the SIO reset
+        result = ccp_select_crate(dev, parameter);
+        if (result == 0) {
+            context->crate_number = parameter;
+        }
+        dbg_dev_print(dev, "camdrv_ioctl: SET_CRATE result=%d\n", result);
+        break;
+      case CAMDRV_IOC_CAMAC_ACTION_EX:
+        if (copy_from_user(&action, (void __user *) arg, sizeof(action))) {
+            result = -EFAULT;
+            break;
+        }
+        dbg_dev_print(
+            dev, "camdrv_ioctl: CAMAC_ACTION_EX, version=%u, crate=%u, n=%u, a=%u, f=%u, data=0x%08x\n",
+            action.version, action.crate, action.n, action.a, action.f, action.data
+        );
+        if ((action.version == 0) || (action.version > CAMDRV_ACTION_VERSION)) {
+            result = -EINVAL;
+            break;
+        }
+        result = ccp_select_crate(dev, action.crate);
+        if (result < 0) {
+            break;
+        }
+        result = ccp_camac_action(dev, action.crate, action.n, action.a, action.f, &action.data);
+        if (result < 0) {
+            break;
+        }
+        action.status = result;
+        action.timestamp_ns = (action.flags & CAMDRV_ACTION_TIMESTAMP) ? ktime_get_ns() : 0;
+        if (copy_to_user((void __user *) arg, &action, sizeof(action))) {
+            result = -EFAULT;
+        }
+        break;
+      case CAMDRV_IOC_CAMAC_LIST:
+        dbg_dev_print(dev, "camdrv_ioctl: CAMAC_LIST, crate=%u, number_of_commands=%u\n", crate_number, parameter);
+        if (parameter > CAMDRV_MAX_COMMANDS) {
+            result = -EINVAL;
+            break;
+        }
+        if (copy_from_user(dev->command_list->commands, user_list_ptr->commands, parameter * sizeof(struct camdrv_command))) {
+            result = -EFAULT;
+            break;
+        }
+        result = ccp_camac_list(dev, crate_number, dev->command_list->commands, parameter);
+        dbg_dev_print(dev, "camdrv_ioctl: CAMAC_LIST result=%d\n", result);
+        if (result < 0) {
+            break;
+        }
+        if (copy_to_user(user_list_ptr->commands, dev->command_list->commands, parameter * sizeof(struct camdrv_command))) {
+            result = -EFAULT;
+        }
+        break;
+      case CAMDRV_IOC_SET_BLOCK_TRANSFER:
+        if (copy_from_user(&block_transfer, (void __user *) arg, sizeof(block_transfer))) {
+            result = -EFAULT;
+            break;
+        }
+        n = (block_transfer.naf >> 9) & 0x1f;
+        a = (block_transfer.naf >> 5) & 0x0f;
+        f = (block_transfer.naf >> 0) & 0x1f;
+        dbg_dev_print(
+            dev, "camdrv_ioctl: SET_BLOCK_TRANSFER, mode=0x%x, n=%u, a=%u, f=%u, max_count=%u\n",
+            block_transfer.mode, n, a, f, block_transfer.max_count
+        );
+        switch (block_transfer.mode & CAMDRV_BLOCK_MODE_MASK) {
+          case CAMDRV_BLOCK_QSTOP:
+          case CAMDRV_BLOCK_QREPEAT:
+          case CAMDRV_BLOCK_ADDRESS_SCAN:
+            break;
+          default:
+            result = -EINVAL;
+        }
+        if (n == 0 || n >= 24 || f > 7) {
+            // only read functions can fill a read() buffer
+            result = -EINVAL;
+        }
+        if (result == 0) {
+            context->block_transfer = block_transfer;
+        }
+        break;
+      case CAMDRV_IOC_SET_LAM_POLLING:
+        if (copy_from_user(&lam_polling, (void __user *) arg, sizeof(lam_polling))) {
+            result = -EFAULT;
+            break;
+        }
+        dbg_dev_print(
+            dev, "camdrv_ioctl: SET_LAM_POLLING, strategy=%u, interval=%u us, spin_budget=%u us\n",
+            lam_polling.strategy, lam_polling.interval_us, lam_polling.spin_budget_us
+        );
+        if (lam_polling.strategy >= ARRAY_SIZE(lam_poll_strategy_names)) {
+            result = -EINVAL;
+            break;
+        }
+        if ((lam_polling.interval_us < LAM_POLL_MIN_INTERVAL_US) || (lam_polling.interval_us > LAM_POLL_MAX_INTERVAL_US)) {
+            result = -EINVAL;
+            break;
+        }
+        if (lam_polling.spin_budget_us > LAM_SPIN_MAX_BUDGET_US) {
+            result = -EINVAL;
+            break;
+        }
+        // as SET_TUNING, the polling applies to all the files
+        if ((dev->open_count > 1) && (dev->exclusive_owner != context)) {
+            result = -EBUSY;
+            break;
+        }
+        WRITE_ONCE(dev->lam_polling.strategy, lam_polling.strategy);
+        WRITE_ONCE(dev->lam_polling.interval_us, lam_polling.interval_us);
+        WRITE_ONCE(dev->lam_polling.spin_budget_us, lam_polling.spin_budget_us);
+        memset(&dev->lam_statistics, 0, sizeof(dev->lam_statistics));
+        break;
+      case CAMDRV_IOC_SET_STREAM:
+        if (copy_from_user(&stream, (void __user *) arg, sizeof(stream))) {
+            result = -EFAULT;
+            break;
+        }
+        n = (stream.naf >> 9) & 0x1f;
+        a = (stream.naf >> 5) & 0x0f;
+        f = (stream.naf >> 0) & 0x1f;
+        dbg_dev_print(
+            dev, "camdrv_ioctl: SET_STREAM, crate=%u, n=%u, a=%u, f=%u, format=%u\n",
+            stream.crate, n, a, f, stream.format
+        );
+        if ((stream.format != CAMDRV_FORMAT_24BIT) && (stream.format != CAMDRV_FORMAT_32BIT)) {
+            result = -EINVAL;
+        }
+        if ((stream.crate > 7) || (n == 0) || (n >= 24) || ((f >= 8) && (f < 16)) || (f >= 24)) {
+            // only read and write functions carry data words
+            result = -EINVAL;
+        }
+        if (result == 0) {
+            context->stream = stream;
+            if (f < 8) {
+                // a read binding replaces the block transfer for read()
+                context->block_transfer.mode = 0;
+            }
+        }
+        break;
+      case CAMDRV_IOC_SET_EXCLUSIVE:
+        // camdrv_lock() has failed already if another file holds it
+        dbg_dev_print(dev, "camdrv_ioctl: SET_EXCLUSIVE, %u\n", parameter);
+        WRITE_ONCE(dev->exclusive_owner, parameter ? context : NULL);
+        break;
+      case CAMDRV_IOC_SET_LAM_MASK:
+        dbg_dev_print(dev, "camdrv_ioctl: SET_LAM_MASK, 0x%06x\n", parameter);
+        parameter &= CAMDRV_LAM_MASK_ALL;
+        if (context->is_lam_watching) {
+            camdrv_count_lam_watch(dev, context->lam_mask, -1);
+            camdrv_count_lam_watch(dev, parameter, +1);
+        }
+        WRITE_ONCE(context->lam_mask, parameter);
+        break;
+      case CAMDRV_IOC_SET_TUNING:
+        if (copy_from_user(&tuning, (void __user *) arg, sizeof(tuning))) {
+            result = -EFAULT;
+            break;
+        }
+        dbg_dev_print(
+            dev, "camdrv_ioctl: SET_TUNING, latency_timer=%u ms, in_transfer_size=%u, pipeline_depth=%u, timeout=%u ms\n",
+            tuning.latency_timer_ms, tuning.in_transfer_size, tuning.pipeline_depth, tuning.timeout_ms
+        );
+        // the tuning applies to all the files: not under the others' feet
+        if ((dev->open_count > 1) && (dev->exclusive_owner != context)) {
+            result = -EBUSY;
+            break;
+        }
+        result = ccp_set_tuning(dev, &tuning);
+        break;
+      case CAMDRV_IOC_SET_PRIORITY:
+        dbg_dev_print(dev, "camdrv_ioctl: SET_PRIORITY, %u\n", parameter);
+        if (parameter > CAMDRV_PRIORITY_HIGH) {
+            result = -EINVAL;
+            break;
+        }
+        WRITE_ONCE(context->priority, parameter);
+        break;
+      default:
+        dbg_dev_print(dev, "camdrv_ioctl: unknown command 0x%08x\n", cmd);
+        result = -EINVAL;
+    }
+
+    mutex_unlock(&dev->mutex);
+    
+    dbg_dev_print(dev, "camdrv_ioctl: returning %d\n", result);
+    return result;
+}
+
+
+// The device is taken for each bulk transfer rather than for the whole
+// read() or write(), so that the other files are served in between
+static ssize_t camdrv_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+    struct camdrv_file *context = file->private_data;
+    ssize_t result;
+
+    // A block transfer, if set, takes precedence over the stream binding
+    if (context->block_transfer.mode != 0) {
+        result = camdrv_read_block(context, buf, count);
+    }
+    else if ((context->stream.format != 0) && ((context->stream.naf & 0x1f) < 8)) {
+        result = camdrv_read_stream(context, buf, count);
+    }
+    else {
+        result = -EINVAL;
+    }
+    
+    dbg_print("camdrv_read: returning %zd\n", result);
+
+    return result;
+}
+
+
+static ssize_t camdrv_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+    struct camdrv_file *context = file->private_data;
+    ssize_t result;
+
+    if ((context->stream.format != 0) && ((context->stream.naf & 0x1f) >= 16) && ((context->stream.naf & 0x1f) < 24)) {
+        result = camdrv_write_stream(context, buf, count);
+    }
+    else {
+        result = -EINVAL;
+    }
+    
+    dbg_print("camdrv_write: returning %zd\n", result);
+
+    return result;
+}
+
+
+// Each read() is one block transfer, starting from the configured NAF
+static ssize_t camdrv_read_block(struct camdrv_file *context, char __user *buf, size_t count)
+{
+    struct camdrv_device *dev = context->dev;
+    unsigned mode, naf, max_count, total = 0;
+    bool is_finished = false;
+    int result = 0;
+
+    mode = context->block_transfer.mode;
+    naf = context->block_transfer.naf;
+    max_count = count / sizeof(unsigned);
+    if (context->block_transfer.max_count > 0) {
+        max_count = min(max_count, context->block_transfer.max_count);
+    }
+    dbg_dev_print(dev, "camdrv_read_block: mode=0x%x, naf=0x%04x, max_count=%u\n", mode, naf, max_count);
+
+    while ((total < max_count) && !is_finished) {
+        result = camdrv_lock(context);
+        if (result < 0) {
+            break;
+        }
+        result = ccp_block_transfer(
+            dev, context->crate_number, mode, &naf,
+            dev->block_buffer, min(max_count - total, (unsigned) BLOCK_BUFFER_WORDS), &is_finished
+        );
+        if ((result > 0) && copy_to_user(buf + total * sizeof(unsigned), dev->block_buffer, result * sizeof(unsigned))) {
+            result = -EFAULT;
+        }
+        mutex_unlock(&dev->mutex);
+        if (result < 0) {
+            break;
+        }
+        total += result;
+        if (signal_pending(current)) {
+            break;
+        }
+    }
+    
+    if (total > 0) {
+        return total * sizeof(unsigned);
+    }
+    return result;
+}
+
+
+// Repeats the bound read NAF once per word, CAMDRV_MAX_COMMANDS frames per
+// bulk transfer. Stops early at X=0.
+static ssize_t camdrv_read_stream(struct camdrv_file *context, char __user *buf, size_t count)
+{
+    struct camdrv_device *dev = context->dev;
+    struct camdrv_command *commands = dev->command_list->commands;
+    unsigned char *bytes = (unsigned char *) dev->block_buffer;
+    unsigned word_size = context->stream.format / 8;
+    unsigned number_of_words, i = 0;
+    size_t total = 0;
+    bool is_finished = false;
+    int result = 0;
+
+    while (!is_finished && (count - total >= word_size)) {
+        number_of_words = min((size_t) CAMDRV_MAX_COMMANDS, (count - total) / word_size);
+        result = camdrv_lock(context);
+        if (result < 0) {
+            break;
+        }
+        // the command buffer is shared by the files, so it is filled under the lock
+        for (i = 0; i < number_of_words; i++) {
+            commands[i].naf = context->stream.naf;
+            commands[i].data = 0;
+        }
+        result = ccp_select_crate(dev, context->stream.crate);
+        if (result == 0) {
+            result = ccp_camac_list(dev, context->stream.crate, commands, number_of_words);
+        }
+        for (i = 0; (result == 0) && (i < number_of_words); i++) {
+            if (commands[i].status & 0x02) {
+                is_finished = true;
+                break;
+            }
+            ccp_pack_word(bytes + i * word_size, commands[i].data, word_size);
+        }
+        if ((result == 0) && copy_to_user(buf + total, bytes, i * word_size)) {
+            result = -EFAULT;
+        }
+        mutex_unlock(&dev->mutex);
+        if (result < 0) {
+            break;
+        }
+        total += i * word_size;
+        if (signal_pending(current)) {
+            break;
+        }
+    }
+
+    if (total > 0) {
+        return total;
+    }
+    if (result < 0) {
+        return result;
+    }
+    return is_finished ? -EIO : 0;
+}
+
+
+// Writes each word of the buffer with the bound write NAF. Stops early at X=0.
+static ssize_t camdrv_write_stream(struct camdrv_file *context, const char __user *buf, size_t count)
+{
+    struct camdrv_device *dev = context->dev;
+    struct camdrv_command *commands = dev->command_list->commands;
+    unsigned char *bytes = (unsigned char *) dev->block_buffer;
+    unsigned word_size = context->stream.format / 8;
+    unsigned number_of_words, i;
+    size_t total = 0;
+    bool is_finished = false;
+    int result = 0;
+
+    if (count < word_size) {
+        return -EINVAL;
+    }
+    
+    while (!is_finished && (count - total >= word_size)) {
+        number_of_words = min((size_t) CAMDRV_MAX_COMMANDS, (count - total) / word_size);
+        result = camdrv_lock(context);
+        if (result < 0) {
+            break;
+        }
+        if (copy_from_user(bytes, buf + total, number_of_words * word_size)) {
+            result = -EFAULT;
+        }
+        for (i = 0; (result == 0) && (i < number_of_words); i++) {
+            commands[i].naf = context->stream.naf;
+            commands[i].data = ccp_unpack_word(bytes + i * word_size, word_size);
+        }
+        if (result == 0) {
+            result = ccp_select_crate(dev, context->stream.crate);
+        }
+        if (result == 0) {
+            result = ccp_camac_list(dev, context->stream.crate, commands, number_of_words);
+        }
+        for (i = 0; (result == 0) && (i < number_of_words); i++) {
+            if (commands[i].status & 0x02) {
+                is_finished = true;
+                break;
+            }
+        }
+        mutex_unlock(&dev->mutex);
+        if (result < 0) {
+            break;
+        }
+        total += i * word_size;
+        if (signal_pending(current)) {
+            break;
+        }
+    }
+
+    if (total > 0) {
+        return total;
+    }
+    if (result < 0) {
+        return result;
+    }
+    return -EIO;
+}
+
+
+// Maps the ring control page and the data area set up by START_READOUT
+static int camdrv_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct camdrv_file *context = file->private_data;
+    struct camdrv_device *dev = context->dev;
+    int result;
+
+    if (mutex_lock_interruptible(&dev->mutex)) {
+        return -ERESTARTSYS;
+    }
+    
+    if (dev->is_disconnected) {
+        result = -ENODEV;
+    }
+    else if (!dev->ring) {
+        result = -EINVAL;
+    }
+    else {
+        result = remap_vmalloc_range(vma, dev->ring, vma->vm_pgoff);
+    }
+    if (result == 0) {
+        vma->vm_ops = &camdrv_vm_ops;
+        vma->vm_private_data = dev;
+        camdrv_vm_open(vma);
+    }
+    
+    mutex_unlock(&dev->mutex);
+    dbg_dev_print(dev, "camdrv_mmap: size=%lu, result=%d\n", vma->vm_end - vma->vm_start, result);
+
+    return result;
+}
+
+
+static void camdrv_vm_open(struct vm_area_struct *vma)
+{
+    struct camdrv_device *dev = vma->vm_private_data;
+    kref_get(&dev->kref);
+    atomic_inc(&dev->ring_map_count);
+}
+
+
+static void camdrv_vm_close(struct vm_area_struct *vma)
+{
+    struct camdrv_device *dev = vma->vm_private_data;
+    atomic_dec(&dev->ring_map_count);
+    kref_put(&dev->kref, camdrv_delete);
+}
+
+
+// Called without the mutex; the previous readout must have been stopped.
+// The readout belongs to the file that started it.
+static int camdrv_start_readout(struct camdrv_device *dev, struct camdrv_file *context, struct camdrv_readout __user *user_readout)
+{
+    struct camdrv_readout *readout;
+    struct camdrv_ring_control *control;
+    struct task_struct *thread;
+    unsigned i, n, ring_size;
+    int result = 0;
+
+    readout = memdup_user(user_readout, sizeof(struct camdrv_readout));
+    if (IS_ERR(readout)) {
+        return PTR_ERR(readout);
+    }
+    
+    ring_size = (readout->ring_size > 0) ? readout->ring_size : CAMDRV_RING_DEFAULT_SIZE;
+    dbg_dev_print(
+        dev, "camdrv_start_readout: crate=%u, lam_mask=0x%06x, ring_size=%u, number_of_commands=%u\n",
+        readout->crate, readout->lam_mask, ring_size, readout->number_of_commands
+    );
+    if ((readout->crate > 7) || (readout->lam_mask == 0)) {
+        result = -EINVAL;
+    }
+    if ((readout->number_of_commands == 0) || (readout->number_of_commands > CAMDRV_MAX_COMMANDS)) {
+        result = -EINVAL;
+    }
+    if (!is_power_of_2(ring_size) || (ring_size < PAGE_SIZE) || (ring_size > CAMDRV_RING_MAX_SIZE)) {
+        result = -EINVAL;
+    }
+    for (i = 0; (result == 0) && (i < readout->number_of_commands); i++) {
+        // checked here rather than failing on every LAM
+        n = (readout->commands[i].naf >> 9) & 0x1f;
+        if (n == 0 || n >= 24) {
+            result = -EINVAL;
+        }
+    }
+    if (result < 0) {
+        kfree(readout);
+        return result;
+    }
+
+    if (mutex_lock_interruptible(&dev->mutex)) {
+        kfree(readout);
+        return -ERESTARTSYS;
+    }
+    if (dev->is_disconnected) {
+        result = -ENODEV;
+        goto unlock;
+    }
+    if (dev->lam_thread || dev->readout_thread) {
+        // both would poll LAM; the readout takes the LAMs itself
+        result = -EBUSY;
+        goto unlock;
+    }
+    if (camdrv_is_excluded(dev, context)) {
+        result = -EBUSY;
+        goto unlock;
+    }
+
+    if (dev->ring && (dev->ring_size != ring_size)) {
+        if (atomic_read(&dev->ring_map_count) > 0) {
+            // the old ring is still mapped with its old size
+            result = -EBUSY;
+            goto unlock;
+        }
+        vfree(dev->ring);
+        dev->ring = NULL;
+    }
+    if (!dev->ring) {
+        dev->ring = vmalloc_user(CAMDRV_RING_DATA_OFFSET + ring_size);
+        if (!dev->ring) {
+            result = -ENOMEM;
+            goto unlock;
+        }
+        dev->ring_size = ring_size;
+    }
+    control = dev->ring;
+    WRITE_ONCE(control->head, 0);
+    WRITE_ONCE(control->tail, 0);
+    control->size = ring_size;
+    control->event_count = 0;
+    control->dropped_count = 0;
+
+    kfree(dev->readout);
+    dev->readout = readout;
+    readout = NULL;
+    
+    thread = kthread_run(ccp_readout_thread, dev, "camdrv_readout");
+    if (IS_ERR(thread)) {
+        result = PTR_ERR(thread);
+        goto unlock;
+    }
+    dev->readout_thread = thread;
+    dev->readout_owner = context;
+
+  unlock:
+    mutex_unlock(&dev->mutex);
+    kfree(readout);
+
+    return result;
+}
+
+
+// Called without the mutex, which the readout thread takes on every poll.
+// Only the file that started the readout stops it; NULL stops any.
+static int camdrv_stop_readout(struct camdrv_device *dev, struct camdrv_file *context)
+{
+    struct task_struct *thread;
+
+    mutex_lock(&dev->mutex);
+    thread = dev->readout_thread;
+    if (thread && context && (dev->readout_owner != context)) {
+        mutex_unlock(&dev->mutex);
+        return -EBUSY;
+    }
+    dev->readout_thread = NULL;
+    dev->readout_owner = NULL;
+    mutex_unlock(&dev->mutex);
+    
+    if (thread) {
+        kthread_stop(thread);
+        dbg_dev_print(dev, "camdrv_stop_readout: readout stopped\n");
+    }
+
+    return 0;
+}
+
+
+// Readable (with EPOLLPRI) while the LAM thread sees a LAM, and readable
+// while the readout ring holds events
+static __poll_t camdrv_poll(struct file *file, poll_table *wait)
+{
+    struct camdrv_file *context = file->private_data;
+    struct camdrv_device *dev = context->dev;
+    struct camdrv_ring_control *control;
+    __poll_t mask = 0;
+
+    poll_wait(file, &dev->lam_wait, wait);
+
+    // the LAM pattern is of the crate of the watching files only
+    if (
+        READ_ONCE(context->is_lam_watching) && (READ_ONCE(dev->lam_crate) == READ_ONCE(context->crate_number)) &&
+        (READ_ONCE(dev->lam_pattern) & READ_ONCE(context->lam_mask))
+    ){
+        mask |= EPOLLIN | EPOLLRDNORM | EPOLLPRI;
+    }
+    control = READ_ONCE(dev->ring);
+    if (control && (smp_load_acquire(&control->head) != READ_ONCE(control->tail))) {
+        mask |= EPOLLIN | EPOLLRDNORM;
+    }
+
+    return mask;
+}
+
+
+// Called without the mutex. The files watching LAM share one LAM thread,
+// which polls the crate of the first one.
+static int camdrv_start_lam_watch(struct camdrv_device *dev, struct camdrv_file *context)
+{
+    struct task_struct *thread;
+    int result = 0;
+
+    if (mutex_lock_interruptible(&dev->mutex)) {
+        return -ERESTARTSYS;
+    }
+    
+    if (dev->is_disconnected) {
+        result = -ENODEV;
+    }
+    else if (camdrv_is_excluded(dev, context)) {
+        result = -EBUSY;
+    }
+    else if (context->is_lam_watching) {
+        result = 0;
+    }
+    else if (dev->readout_thread) {
+        result = -EBUSY;
+    }
+    else if (dev->lam_thread && (dev->lam_crate != context->crate_number)) {
+        result = -EBUSY;
+    }
+    else if (!dev->lam_thread) {
+        WRITE_ONCE(dev->lam_pattern, 0);
+        dev->lam_crate = context->crate_number;
+        thread = kthread_run(ccp_lam_thread, dev, "camdrv_lam");
+        if (IS_ERR(thread)) {
+            result = PTR_ERR(thread);
+        }
+        else {
+            WRITE_ONCE(dev->lam_thread, thread);
+        }
+    }
+    if ((result == 0) && !context->is_lam_watching) {
+        context->is_lam_watching = true;
+        dev->lam_watch_count++;
+        camdrv_count_lam_watch(dev, context->lam_mask, +1);
+    }
+    
+    mutex_unlock(&dev->mutex);
+    
+    return result;
+}
+
+
+// Called without the mutex, which the LAM thread takes on every poll. The
+// thread stops when the last watching file stops; NULL stops it anyway.
+static void camdrv_stop_lam_watch(struct camdrv_device *dev, struct camdrv_file *context)
+{
+    struct task_struct *thread = NULL;
+
+    mutex_lock(&dev->mutex);
+    if (context && context->is_lam_watching) {
+        context->is_lam_watching = false;
+        dev->lam_watch_count--;
+        camdrv_count_lam_watch(dev, context->lam_mask, -1);
+    }
+    if (!context || (dev->lam_watch_count == 0)) {
+        thread = dev->lam_thread;
+        WRITE_ONCE(dev->lam_thread, NULL);
+        // before the mutex is dropped and a new watcher can start a thread
+        WRITE_ONCE(dev->lam_pattern, 0);
+    }
+    mutex_unlock(&dev->mutex);
+    
+    if (thread) {
+        kthread_stop(thread);
+        wake_up_interruptible_all(&dev->lam_wait);
+        dbg_dev_print(dev, "camdrv_stop_lam_watch: LAM thread stopped\n");
+    }
+}
+
+
+// The LAM thread tests the stations in the masks of the watching files;
+// called with the mutex held
+static void camdrv_count_lam_watch(struct camdrv_device *dev, unsigned mask, int increment)
+{
+    unsigned i;
+
+    dev->lam_watch_mask = 0;
+    for (i = 0; i < 23; i++) {
+        if (mask & (0x0001 << i)) {
+            dev->lam_watchers[i] += increment;
+        }
+        if (dev->lam_watchers[i] > 0) {
+            dev->lam_watch_mask |= 0x0001 << i;
+        }
+    }
+}
+
+
+// Takes the LAMs of the mask from lam_pattern, leaving the others to the
+// files watching them
+static unsigned camdrv_take_lam(struct camdrv_device *dev, unsigned mask)
+{
+    unsigned pattern, taken;
+
+    do {
+        pattern = READ_ONCE(dev->lam_pattern);
+        taken = pattern & mask;
+        if (taken == 0) {
+            break;
+        }
+    } while (cmpxchg(&dev->lam_pattern, pattern, pattern & ~taken) != pattern);
+
+    return taken;
+}
+
+
+// Waits for the LAM thread to see a LAM of the mask, and takes it
+static int camdrv_wait_lam_event(struct camdrv_device *dev, unsigned mask, u64 timeout_us, unsigned *data)
+{
+    int result;
+
+    result = wait_event_interruptible_hrtimeout(
+        dev->lam_wait, (READ_ONCE(dev->lam_pattern) & mask) || !READ_ONCE(dev->lam_thread),
+        ns_to_ktime(timeout_us * NSEC_PER_USEC)
+    );
+    if (result == -ERESTARTSYS) {
+        *data = 0;
+        return result;
+    }
+    
+    *data = camdrv_take_lam(dev, mask);
+    if (*data == 0) {
+        return -ETIMEDOUT;
+    }
+    ccp_histogram_add(&dev->statistics.lam_wake_ns, ktime_to_ns(ktime_sub(ktime_get(), READ_ONCE(dev->lam_seen_time))));
+
+    return *data;
+}
+
+
+static ssize_t serial_number_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct camdrv_device *dev = dev_get_drvdata(device);
+
+    if (!dev) {
+        return -ENODEV;
+    }
+    
+    return sysfs_emit(buf, "%s\n", dev->udev->serial ? dev->udev->serial : "");
+}
+
+
+// USB bus path of the interface, e.g. 1-1.2:1.0
+static ssize_t bus_path_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct camdrv_device *dev = dev_get_drvdata(device);
+
+    if (!dev) {
+        return -ENODEV;
+    }
+    
+    return sysfs_emit(buf, "%s\n", dev_name(&dev->interface->dev));
+}
+
+
+static ssize_t resync_count_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct camdrv_device *dev = dev_get_drvdata(device);
+
+    if (!dev) {
+        return -ENODEV;
+    }
+    
+    return sysfs_emit(buf, "%lu\n", dev->resync_count);
+}
+
+
+static ssize_t lam_poll_strategy_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct camdrv_device *dev = dev_get_drvdata(device);
+
+    if (!dev) {
+        return -ENODEV;
+    }
+    
+    return sysfs_emit(buf, "%s\n", lam_poll_strategy_names[READ_ONCE(dev->lam_polling.strategy)]);
+}
+
+
+static ssize_t lam_poll_strategy_store(struct device *device, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct camdrv_device *dev = dev_get_drvdata(device);
+    int strategy;
+
+    if (!dev) {
+        return -ENODEV;
+    }
+    strategy = sysfs_match_string(lam_poll_strategy_names, buf);
+    if (strategy < 0) {
+        return strategy;
+    }
+    
+    mutex_lock(&dev->mutex);
+    if (camdrv_is_excluded(dev, NULL)) {
+        mutex_unlock(&dev->mutex);
+        return -EBUSY;
+    }
+    WRITE_ONCE(dev->lam_polling.strategy, strategy);
+    memset(&dev->lam_statistics, 0, sizeof(dev->lam_statistics));
+    mutex_unlock(&dev->mutex);
+
+    return count;
+}
+
+
+static ssize_t lam_poll_interval_us_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct camdrv_device *dev = dev_get_drvdata(device);
+
+    if (!dev) {
+        return -ENODEV;
+    }
+    
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev->lam_polling.interval_us));
+}
+
+
+static ssize_t lam_poll_interval_us_store(struct device *device, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct camdrv_device *dev = dev_get_drvdata(device);
+    unsigned value;
+    int result;
+
+    if (!dev) {
+        return -ENODEV;
+    }
+    result = kstrtouint(buf, 0, &value);
+    if (result < 0) {
+        return result;
+    }
+    if ((value < LAM_POLL_MIN_INTERVAL_US) || (value > LAM_POLL_MAX_INTERVAL_US)) {
+        return -EINVAL;
+    }
+    
+    mutex_lock(&dev->mutex);
+    if (camdrv_is_excluded(dev, NULL)) {
+        mutex_unlock(&dev->mutex);
+        return -EBUSY;
+    }
+    WRITE_ONCE(dev->lam_polling.interval_us, value);
+    mutex_unlock(&dev->mutex);
+
+    return count;
+}
+
+
+static ssize_t lam_spin_budget_us_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct camdrv_device *dev = dev_get_drvdata(device);
+
+    if (!dev) {
+        return -ENODEV;
+    }
+    
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev->lam_polling.spin_budget_us));
+}
+
+
+static ssize_t lam_spin_budget_us_store(struct device *device, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct camdrv_device *dev = dev_get_drvdata(device);
+    unsigned value;
+    int result;
+
+    if (!dev) {
+        return -ENODEV;
+    }
+    result = kstrtouint(buf, 0, &value);
+    if (result < 0) {
+        return result;
+    }
+    if (value > LAM_SPIN_MAX_BUDGET_US) {
+        return -EINVAL;
+    }
+    
+    mutex_lock(&dev->mutex);
+    if (camdrv_is_excluded(dev, NULL)) {
+        mutex_unlock(&dev->mutex);
+        return -EBUSY;
+    }
+    WRITE_ONCE(dev->lam_polling.spin_budget_us, value);
+    mutex_unlock(&dev->mutex);
+
+    return count;
+}
+
+
+// Statistics since the last change of the strategy
+static ssize_t lam_latency_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct camdrv_device *dev = dev_get_drvdata(device);
+    struct ccp_lam_statistics statistics;
+
+    if (!dev) {
+        return -ENODEV;
+    }
+    
+    mutex_lock(&dev->mutex);
+    statistics = dev->lam_statistics;
+    mutex_unlock(&dev->mutex);
+    
+    return sysfs_emit(
+        buf, "polls=%lu poll_mean_us=%llu detections=%lu latency_mean_us=%llu latency_max_us=%llu requests=%lu spared=%lu\n",
+        statistics.poll_count,
+        statistics.poll_count ? div_u64(div_u64(statistics.poll_ns, NSEC_PER_USEC), statistics.poll_count) : 0,
+        statistics.detection_count,
+        statistics.detection_count ? div_u64(div_u64(statistics.latency_ns, NSEC_PER_USEC), statistics.detection_count) : 0,
+        div_u64(statistics.max_latency_ns, NSEC_PER_USEC),
+        statistics.request_count,
+        statistics.spared_count
+    );
+}
+
+
+// Counters since the last reset; a write of anything resets them and the histograms
+static ssize_t statistics_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct camdrv_device *dev = dev_get_drvdata(device);
+    struct ccp_statistics *statistics;
+    unsigned long *command_count;
+    unsigned long resync_count;
+    ssize_t length;
+
+    if (!dev) {
+        return -ENODEV;
+    }
+    statistics = &dev->statistics;
+    command_count = statistics->command_count;
+    
+    mutex_lock(&dev->mutex);
+    resync_count = READ_ONCE(dev->resync_count);
+    length = sysfs_emit(
+        buf,
+        "camac=%lu lam=%lu write_reg=%lu read_reg=%lu initialize=%lu other=%lu "
+        "bytes_out=%llu bytes_in=%llu usb_errors=%lu timeouts=%lu resyncs=%lu lam_polls=%lu lam_hits=%lu\n",
+        command_count[CCP_COUNT_CAMAC], command_count[CCP_COUNT_LAM],
+        command_count[CCP_COUNT_WRITE_REG], command_count[CCP_COUNT_READ_REG],
+        command_count[CCP_COUNT_INITIALIZE], command_count[CCP_COUNT_OTHER],
+        statistics->bytes_out, statistics->bytes_in,
+        statistics->usb_error_count, statistics->timeout_count, resync_count,
+        statistics->lam_poll_count, statistics->lam_hit_count
+    );
+    mutex_unlock(&dev->mutex);
+
+    return length;
+}
+
+
+static void ccp_histogram_reset(struct ccp_histogram *histogram)
+{
+    unsigned i;
+
+    for (i = 0; i < CCP_HISTOGRAM_BINS; i++) {
+        atomic_long_set(&histogram->bins[i], 0);
+    }
+}
+
+
+static ssize_t statistics_store(struct device *device, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct camdrv_device *dev = dev_get_drvdata(device);
+    struct ccp_statistics *statistics;
+
+    if (!dev) {
+        return -ENODEV;
+    }
+    statistics = &dev->statistics;
+    
+    mutex_lock(&dev->mutex);
+    memset(statistics->command_count, 0, sizeof(statistics->command_count));
+    statistics->bytes_out = statistics->bytes_in = 0;
+    statistics->usb_error_count = statistics->timeout_count = 0;
+    statistics->lam_poll_count = statistics->lam_hit_count = 0;
+    ccp_histogram_reset(&statistics->write_ns);
+    ccp_histogram_reset(&statistics->read_ns);
+    ccp_histogram_reset(&statistics->lam_wake_ns);
+    spin_lock_irq(&dev->rx_lock);
+    dev->resync_count = 0;
+    spin_unlock_irq(&dev->rx_lock);
+    mutex_unlock(&dev->mutex);
+
+    return count;
+}
+
+
+// One line per histogram: the name and the counts of the CCP_HISTOGRAM_BINS bins
+static ssize_t histograms_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct camdrv_device *dev = dev_get_drvdata(device);
+    const struct ccp_histogram *histograms[3];
+    static const char * const names[3] = { "write_ns", "read_ns", "lam_wake_ns" };
+    ssize_t length = 0;
+    unsigned i, k;
+
+    if (!dev) {
+        return -ENODEV;
+    }
+    histograms[0] = &dev->statistics.write_ns;
+    histograms[1] = &dev->statistics.read_ns;
+    histograms[2] = &dev->statistics.lam_wake_ns;
+    
+    for (i = 0; i < 3; i++) {
+        length += sysfs_emit_at(buf, length, "%s", names[i]);
+        for (k = 0; k < CCP_HISTOGRAM_BINS; k++) {
+            length += sysfs_emit_at(buf, length, " %ld", atomic_long_read(&histograms[i]->bins[k]));
+        }
+        length += sysfs_emit_at(buf, length, "\n");
+    }
+
+    return length;
+}
+
+
+// Sets one member of the tuning, by its offset, keeping the others. As
+// SET_TUNING of the other files, fails while a file holds the device
+// exclusively.
+static ssize_t tuning_store(struct device *device, const char *buf, size_t count, size_t offset)
+{
+    struct camdrv_device *dev = dev_get_drvdata(device);
+    struct camdrv_tuning tuning;
+    unsigned value;
+    int result;
+
+    if (!dev) {
+        return -ENODEV;
+    }
+    result = kstrtouint(buf, 0, &value);
+    if (result < 0) {
+        return result;
+    }
+    
+    mutex_lock(&dev->mutex);
+    if (camdrv_is_excluded(dev, NULL)) {
+        mutex_unlock(&dev->mutex);
+        return -EBUSY;
+    }
+    tuning = dev->tuning;
+    *(unsigned *) ((char *) &tuning + offset) = value;
+    result = ccp_set_tuning(dev, &tuning);
+    mutex_unlock(&dev->mutex);
+
+    return (result < 0) ? result : count;
+}
+
+
+static ssize_t latency_timer_ms_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct camdrv_device *dev = dev_get_drvdata(device);
+
+    if (!dev) {
+        return -ENODEV;
+    }
+    
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev->tuning.latency_timer_ms));
+}
+
+
+static ssize_t latency_timer_ms_store(struct device *device, struct device_attribute *attr, const char *buf, size_t count)
+{
+    return tuning_store(device, buf, count, offsetof(struct camdrv_tuning, latency_timer_ms));
+}
+
+
+static ssize_t in_transfer_size_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct camdrv_device *dev = dev_get_drvdata(device);
+
+    if (!dev) {
+        return -ENODEV;
+    }
+    
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev->tuning.in_transfer_size));
+}
+
+
+static ssize_t in_transfer_size_store(struct device *device, struct device_attribute *attr, const char *buf, size_t count)
+{
+    return tuning_store(device, buf, count, offsetof(struct camdrv_tuning, in_transfer_size));
+}
+
+
+static ssize_t pipeline_depth_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct camdrv_device *dev = dev_get_drvdata(device);
+
+    if (!dev) {
+        return -ENODEV;
+    }
+    
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev->tuning.pipeline_depth));
+}
+
+
+static ssize_t pipeline_depth_store(struct device *device, struct device_attribute *attr, const char *buf, size_t count)
+{
+    return tuning_store(device, buf, count, offsetof(struct camdrv_tuning, pipeline_depth));
+}
+
+
+static ssize_t timeout_ms_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct camdrv_device *dev = dev_get_drvdata(device);
+
+    if (!dev) {
+        return -ENODEV;
+    }
+    
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev->tuning.timeout_ms));
+}
+
+
+static ssize_t timeout_ms_store(struct device *device, struct device_attribute *attr, const char *buf, size_t count)
+{
+    return tuning_store(device, buf, count, offsetof(struct camdrv_tuning, timeout_ms));
+}
+
+
+//// FTDI ////
+
+#define FTDI_SIO_RESET_REQUEST_TYPE 0x40
+#define FTDI_SIO_RESET_REQUEST 0x00
+#define FTDI_SIO_RESET_SIO 0
+#define FTDI_SIO_FLUSH_HOST_OUT 1
+#define FTDI_SIO_FLUSH_HOST_IN 2
+
+#define FTDI_SIO_SET_BITMODE_REQUEST_TYPE 0x40
+#define FTDI_SIO_SET_BITMODE_REQUEST 0x0b
+#define FTDI_BITMODE_RESET 0x00
+#define FTDI_BITMODE_SYNC_FIFO 0x40
+
+#define FTDI_SIO_SET_LATENCY_TIMER_REQUEST_TYPE 0x40
+#define FTDI_SIO_SET_LATENCY_TIMER_REQUEST 0x09
+
+#define FTDI_SIO_SET_EVENT_CHAR_REQUEST_TYPE 0x40
+#define FTDI_SIO_SET_EVENT_CHAR_REQUEST 0x06
+
+#define FTDI_INTERFACE_A 1
+
+
+// Helper function to send FTDI control request
+static int ftdi_control_request(struct usb_device *udev, u8 request_type, u8 request, u16 value, u16 index, void *data, u16 size)
+{
+    int result;
+    result = usb_control_msg(
+        udev, usb_sndctrlpipe(udev, 0),
+        request, request_type, value, index,
+        data, size, TIMEOUT_MS
+    );
+    trace_camdrv_ftdi_control(request_type, request, value, index, result);
+    if (result < 0) {
+        dev_err(&udev->dev, "FTDI control request failed: %d\n", result);
+    }
+    
+    return result;
+}
+
+
+// Initialize FTDI device for synchronous FIFO mode
+static int ftdi_init_sync_fifo(struct camdrv_device *dev)
+{
+    struct usb_device *udev = dev->udev;
+    int result;
+
+    dbg_dev_print(dev, "ftdi_init_sync_fifo: starting initialization\n");
+
+    // Reset device
+    dbg_dev_print(dev, "ftdi_init_sync_fifo: resetting device\n");
+    result = ftdi_control_request(
+        udev, FTDI_SIO_RESET_REQUEST_TYPE,
+        FTDI_SIO_RESET_REQUEST,
+        FTDI_SIO_RESET_SIO, FTDI_INTERFACE_A,
+        NULL, 0
+    );
+    if (result < 0) {
+        dev_err(&udev->dev, "ftdi_init_sync_fifo: reset failed: %d\n", result);
+        return result;
+    }
+    dbg_dev_print(dev, "ftdi_init_sync_fifo: reset successful\n");
+
+    // Reset bit mode
+    dbg_dev_print(dev, "ftdi_init_sync_fifo: resetting bit mode\n");
+    result = ftdi_control_request(
+        udev, FTDI_SIO_SET_BITMODE_REQUEST_TYPE,
+        FTDI_SIO_SET_BITMODE_REQUEST,
+        FTDI_BITMODE_RESET, FTDI_INTERFACE_A,
+        NULL, 0
+    );
+    if (result < 0) {
+        dev_err(&udev->dev, "ftdi_init_sync_fifo: bit mode reset failed: %d\n", result);
+        return result;
+    }
+    dbg_dev_print(dev, "ftdi_init_sync_fifo: bit mode reset successful\n");
+
+    // Set synchronous FIFO mode (0xF0 = pin direction, 0x40 = sync FIFO mode)
+    dbg_dev_print(dev, "ftdi_init_sync_fifo: setting sync FIFO mode (value=0x%04x)\n", (FTDI_BITMODE_SYNC_FIFO << 8) | 0xF0);
+    result = ftdi_control_request(
+        udev, FTDI_SIO_SET_BITMODE_REQUEST_TYPE,
+        FTDI_SIO_SET_BITMODE_REQUEST,
+        (FTDI_BITMODE_SYNC_FIFO << 8) | 0xF0,
+        FTDI_INTERFACE_A, NULL, 0
+    );
+    if (result < 0) {
+        dev_err(&udev->dev, "ftdi_init_sync_fifo: set sync FIFO mode failed: %d\n", result);
+        return result;
+    }
+    dbg_dev_print(dev, "ftdi_init_sync_fifo: sync FIFO mode set successfully\n");
+
+    // Set latency timer
+    result = ftdi_set_latency_timer(dev, dev->tuning.latency_timer_ms);
+    if (result < 0) {
+        dev_err(&udev->dev, "ftdi_init_sync_fifo: set latency timer failed: %d\n", result);
+        return result;
+    }
+    dbg_dev_print(dev, "ftdi_init_sync_fifo: latency timer set successfully\n");
+
+    dbg_dev_print(dev, "ftdi_init_sync_fifo: initialization completed successfully\n");
+    return 0;
+}
+
+
+// The latency timer flushes a short IN packet after this many ms; it can
+// be changed at any time, also in the sync FIFO mode
+static int ftdi_set_latency_timer(struct camdrv_device *dev, unsigned latency_timer_ms)
+{
+    dbg_dev_print(dev, "ftdi_set_latency_timer: setting latency timer to %u\n", latency_timer_ms);
+    return ftdi_control_request(
+        dev->udev, FTDI_SIO_SET_LATENCY_TIMER_REQUEST_TYPE,
+        FTDI_SIO_SET_LATENCY_TIMER_REQUEST,
+        latency_timer_ms, FTDI_INTERFACE_A,
+        NULL, 0
+    );
+}
+
+
+//// CCP ////
+
+enum ccp_command {
+    cmdINITIALIZE_CCP = 0x49,
+    cmdCAMAC = 0x43,
+    cmdLAM = 0x4c,
+    cmdWRITE_REG = 0x57,
+    cmdREAD_REG = 0x52
+};
+
+enum ccp_ctrlbits {
+    ctrlINITIALIZE = 0x40,
+    ctrlCLEAR = 0x80
+};
+
+enum ccp_statbits {
+    statQ = 0x01,
+    statX = 0x02,
+    statI = 0x04,
+    statLE = 0x08,
+    statREQ = 0x40,
+    statDEM = 0x80
+};
+
+#define CCP_START_MARKER 0x43
+#define CCP_CAMAC_FRAME_SIZE 16
+
+// Replies carry one byte per two USB bytes, in the low nibbles
+static inline unsigned ccp_decode_byte(const unsigned char *buffer)
+{
+    return ((buffer[1] & 0x0F) << 4) | (buffer[0] & 0x0F);
+}
+
+// Commands are written in the same encoding as the replies, one frame
+// after another; lists and block transfers are all of CAMAC frames
+static void ccp_count_commands(struct camdrv_device *dev, unsigned int write_size)
+{
+    unsigned long *command_count = dev->statistics.command_count;
+
+    switch (ccp_decode_byte(dev->tx_buffer) & 0xff) {
+      case cmdCAMAC:
+        command_count[CCP_COUNT_CAMAC] += write_size / CCP_CAMAC_FRAME_SIZE;
+        break;
+      case cmdLAM:
+        command_count[CCP_COUNT_LAM]++;
+        break;
+      case cmdWRITE_REG:
+        command_count[CCP_COUNT_WRITE_REG]++;
+        break;
+      case cmdREAD_REG:
+        command_count[CCP_COUNT_READ_REG]++;
+        break;
+      case cmdINITIALIZE_CCP:
+        command_count[CCP_COUNT_INITIALIZE]++;
+        break;
+      default:
+        command_count[CCP_COUNT_OTHER]++;
+        break;
+    }
+}
+
+//// Arbiter ////
+
+// All the transactions on a device, from the files and from the kernel
+// threads, are serialized by the device mutex, one ioctl or one bulk
+// transfer at a time. The mutex hands over roughly in arrival order; on top
+// of that a request waits while one of a higher priority is waiting, so a
+// low-priority monitor delays a readout by one transaction at most.
+
+static bool ccp_is_outranked(struct camdrv_device *dev, unsigned priority)
+{
+    unsigned i;
+
+    for (i = priority + 1; i < NUMBER_OF_PRIORITIES; i++) {
+        if (atomic_read(&dev->arbiter_waiting[i]) > 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+// Takes the device mutex; interrupted by signals, which kernel threads do not get
+static int ccp_lock(struct camdrv_device *dev, unsigned priority)
+{
+    int result;
+
+    atomic_inc(&dev->arbiter_waiting[priority]);
+    result = wait_event_interruptible(dev->arbiter_wait, !ccp_is_outranked(dev, priority));
+    if (result == 0) {
+        result = mutex_lock_interruptible(&dev->mutex);
+    }
+    if (atomic_dec_and_test(&dev->arbiter_waiting[priority]) && (priority > CAMDRV_PRIORITY_LOW)) {
+        wake_up_interruptible_all(&dev->arbiter_wait);
+    }
+
+    return result ? -ERESTARTSYS : 0;
+}
+
+
+//// Bulk pipeline ////
+
+// Bulk transfers go through pre-allocated URBs: up to pipeline_depth OUT
+// URBs may be in flight at once, and the same number of IN URBs are kept
+// submitted while the device is open. The IN completion handler appends the
+// data to the RX stream and cuts it into reply frames, which are matched in
+// order to the replies registered by ccp_expect_reply().
+
+static void ccp_write_callback(struct urb *urb);
+static void ccp_read_callback(struct urb *urb);
+
+
+static int ccp_alloc_urbs(struct camdrv_device *dev)
+{
+    struct usb_device *udev = dev->udev;
+    int i;
+
+    for (i = 0; i < MAX_PIPELINE_DEPTH; i++) {
+        dev->tx_slots[i].urb = usb_alloc_urb(0, GFP_KERNEL);
+        dev->tx_slots[i].buffer = kmalloc(USB_OUT_TRANSFER_SIZE, GFP_KERNEL);
+        dev->rx_slots[i].urb = usb_alloc_urb(0, GFP_KERNEL);
+        dev->rx_slots[i].buffer = kmalloc(MAX_IN_TRANSFER_SIZE, GFP_KERNEL);
+        if (!dev->tx_slots[i].urb || !dev->tx_slots[i].buffer || !dev->rx_slots[i].urb || !dev->rx_slots[i].buffer) {
+            return -ENOMEM;
+        }
+        usb_fill_bulk_urb(
+            dev->tx_slots[i].urb, udev,
+            usb_sndbulkpipe(udev, dev->bulk_out->bEndpointAddress),
+            dev->tx_slots[i].buffer, USB_OUT_TRANSFER_SIZE,
+            ccp_write_callback, &dev->tx_slots[i]
+        );
+        usb_fill_bulk_urb(
+            dev->rx_slots[i].urb, udev,
+            usb_rcvbulkpipe(udev, dev->bulk_in->bEndpointAddress),
+            dev->rx_slots[i].buffer, MAX_IN_TRANSFER_SIZE,
+            ccp_read_callback, &dev->rx_slots[i]
+        );
+        dev->tx_slots[i].dev = dev->rx_slots[i].dev = dev;
+    }
+
+    return 0;
+}
+
+
+static void ccp_free_urbs(struct camdrv_device *dev)
+{
+    int i;
+
+    for (i = 0; i < MAX_PIPELINE_DEPTH; i++) {
+        usb_free_urb(dev->tx_slots[i].urb);
+        kfree(dev->tx_slots[i].buffer);
+        usb_free_urb(dev->rx_slots[i].urb);
+        kfree(dev->rx_slots[i].buffer);
+        dev->tx_slots[i].urb = dev->rx_slots[i].urb = NULL;
+        dev->tx_slots[i].buffer = dev->rx_slots[i].buffer = NULL;
+    }
+}
+
+
+static int ccp_start_reader(struct camdrv_device *dev)
+{
+    unsigned i;
+    int result;
+
+    ccp_reset_stream(dev);
+    for (i = 0; i < dev->tuning.pipeline_depth; i++) {
+        dev->rx_slots[i].urb->transfer_buffer_length = dev->tuning.in_transfer_size;
+        usb_anchor_urb(dev->rx_slots[i].urb, &dev->rx_anchor);
+        result = usb_submit_urb(dev->rx_slots[i].urb, GFP_KERNEL);
+        if (result < 0) {
+            dev_err(&dev->udev->dev, "ccp_start_reader: submitting bulk IN URB failed: %d\n", result);
+            usb_unanchor_urb(dev->rx_slots[i].urb);
+            usb_kill_anchored_urbs(&dev->rx_anchor);
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+
+// Cancels all the URBs in flight
+static void ccp_stop(struct camdrv_device *dev)
+{
+    unsigned i;
+    
+    usb_kill_anchored_urbs(&dev->tx_anchor);
+    usb_kill_anchored_urbs(&dev->rx_anchor);
+    for (i = 0; i < MAX_PIPELINE_DEPTH; i++) {
+        dev->tx_slots[i].is_busy = false;
+    }
+    dev->tx_next = 0;
+    dev->tx_error = 0;
+}
+
+
+static void ccp_reset_stream(struct camdrv_device *dev)
+{
+    spin_lock_irq(&dev->rx_lock);
+    dev->rx_head = dev->rx_tail = 0;
+    dev->reply_head = dev->reply_tail = 0;
+    dev->rx_error = 0;
+    dev->is_resyncing = false;
+    spin_unlock_irq(&dev->rx_lock);
+}
+
+
+// Discards everything received so far, both in the FTDI chip and in the stream.
+// This is needed only after an error or a command without a reply.
+static void ccp_purge(struct camdrv_device *dev)
+{
+    dbg_dev_print(dev, "ccp_purge: purging RX buffer (%u bytes in stream)\n", dev->rx_tail - dev->rx_head);
+    usb_wait_anchor_empty_timeout(&dev->tx_anchor, dev->tuning.timeout_ms);
+    ccp_stop(dev);
+    ftdi_control_request(
+        dev->udev, FTDI_SIO_RESET_REQUEST_TYPE,
+        FTDI_SIO_RESET_REQUEST,
+        FTDI_SIO_FLUSH_HOST_IN, FTDI_INTERFACE_A,
+        NULL, 0
+    );
+    ccp_start_reader(dev);
+    dev->rx_purge_needed = false;
+}
+
+
+// Purges if the previous transaction failed or left an unknown reply behind
+static void ccp_prepare(struct camdrv_device *dev)
+{
+    if (dev->rx_purge_needed || READ_ONCE(dev->rx_error)) {
+        ccp_purge(dev);
+    }
+}
+
+
+static int ccp_check_tuning(struct camdrv_device *dev, const struct camdrv_tuning *tuning)
+{
+    unsigned packet_size = usb_endpoint_maxp(dev->bulk_in);
+
+    if ((tuning->latency_timer_ms < 1) || (tuning->latency_timer_ms > 255)) {
+        return -EINVAL;
+    }
+    if ((tuning->in_transfer_size < packet_size) || (tuning->in_transfer_size > MAX_IN_TRANSFER_SIZE) || (tuning->in_transfer_size % packet_size)) {
+        return -EINVAL;
+    }
+    if ((tuning->pipeline_depth < 1) || (tuning->pipeline_depth > MAX_PIPELINE_DEPTH)) {
+        return -EINVAL;
+    }
+    if ((tuning->timeout_ms < MIN_TIMEOUT_MS) || (tuning->timeout_ms > MAX_TIMEOUT_MS)) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+
+// Called with the mutex held. While the device is open, the latency timer
+// is set at once, and the bulk pipeline is restarted through a purge for a
+// new depth or IN transfer size; otherwise all are applied at the next open.
+static int ccp_set_tuning(struct camdrv_device *dev, const struct camdrv_tuning *tuning)
+{
+    bool is_restart_needed;
+    int result;
+
+    result = ccp_check_tuning(dev, tuning);
+    if (result < 0) {
+        return result;
+    }
+    if ((dev->open_count > 0) && (tuning->latency_timer_ms != dev->tuning.latency_timer_ms)) {
+        result = ftdi_set_latency_timer(dev, tuning->latency_timer_ms);
+        if (result < 0) {
+            return result;
+        }
+    }
+    is_restart_needed = (
+        (dev->open_count > 0) &&
+        ((tuning->pipeline_depth != dev->tuning.pipeline_depth) || (tuning->in_transfer_size != dev->tuning.in_transfer_size))
+    );
+
+    WRITE_ONCE(dev->tuning.latency_timer_ms, tuning->latency_timer_ms);
+    WRITE_ONCE(dev->tuning.in_transfer_size, tuning->in_transfer_size);
+    WRITE_ONCE(dev->tuning.pipeline_depth, tuning->pipeline_depth);
+    WRITE_ONCE(dev->tuning.timeout_ms, tuning->timeout_ms);
+    if (is_restart_needed) {
+        ccp_purge(dev);
+    }
+    dev_info(
+        &dev->udev->dev, "tuning: latency_timer=%u ms, in_transfer_size=%u, pipeline_depth=%u, timeout=%u ms\n",
+        tuning->latency_timer_ms, tuning->in_transfer_size, tuning->pipeline_depth, tuning->timeout_ms
+    );
+
+    return 0;
+}
+
+
+static void ccp_write_callback(struct urb *urb)
+{
+    struct ccp_urb_slot *slot = urb->context;
+    struct camdrv_device *dev = slot->dev;
+
+    trace_camdrv_bulk_out_complete(dev->minor, urb->status, urb->actual_length);
+    if (urb->status) {
+        if (urb->status != -ENOENT && urb->status != -ECONNRESET && urb->status != -ESHUTDOWN) {
+            dev_err_ratelimited(&dev->udev->dev, "ccp_write_callback: bulk OUT failed: %d\n", urb->status);
+        }
+        dev->tx_error = urb->status;
+    }
+    WRITE_ONCE(slot->is_busy, false);
+    wake_up(&dev->tx_wait);
+}
+
+
+// Cuts the RX stream into frames for the replies waiting in order.
+// Called with rx_lock held.
+static void ccp_dispatch_replies(struct camdrv_device *dev)
+{
+    struct ccp_reply_slot *slot;
+    unsigned int position;
+
+    while (dev->reply_head != dev->reply_tail) {
+        slot = &dev->reply_slots[dev->reply_head % MAX_PENDING_REPLIES];
+        if (dev->rx_tail - dev->rx_head < 2) {
+            break;
+        }
+        if (ccp_decode_byte(dev->rx_stream + dev->rx_head) != CCP_START_MARKER) {
+            if (!dev->is_resyncing) {
+                dev->is_resyncing = true;
+                dev->resync_count++;
+                dev_warn_ratelimited(&dev->udev->dev, "ccp_dispatch_replies: start marker not found, resyncing\n");
+            }
+            for (position = dev->rx_head + 1; position + 1 < dev->rx_tail; position++) {
+                if (ccp_decode_byte(dev->rx_stream + position) == CCP_START_MARKER) {
+                    break;
+                }
+            }
+            dev->rx_head = position;
+            continue;
+        }
+        if (dev->rx_tail - dev->rx_head < slot->read_size) {
+            break;
+        }
+        memcpy(slot->frame, dev->rx_stream + dev->rx_head, slot->read_size);
+        dev->rx_head += slot->read_size;
+        dev->is_resyncing = false;
+        WRITE_ONCE(slot->is_done, true);
+        dev->reply_head++;
+    }
+}
+
+
+// Appends the data from one bulk IN transfer to the RX stream.
+// Every USB packet from the FTDI chip begins with two modem status bytes,
+// which are removed here.
+static void ccp_read_callback(struct urb *urb)
+{
+    struct ccp_urb_slot *slot = urb->context;
+    struct camdrv_device *dev = slot->dev;
+    unsigned int packet_size, offset, chunk_size, reply_head;
+    unsigned long flags;
+    int result;
+
+    if (urb->status) {
+        trace_camdrv_bulk_in_complete(dev->minor, urb->status, urb->actual_length, 0, 0);
+    }
+    switch (urb->status) {
+      case 0:
+        break;
+      case -ENOENT:
+      case -ECONNRESET:
+      case -ESHUTDOWN:
+        return;
+      default:
+        dev_err_ratelimited(&dev->udev->dev, "ccp_read_callback: bulk IN failed: %d\n", urb->status);
+        spin_lock_irqsave(&dev->rx_lock, flags);
+        dev->rx_error = -EIO;
+        spin_unlock_irqrestore(&dev->rx_lock, flags);
+        wake_up(&dev->rx_wait);
+        return;
+    }
+
+    spin_lock_irqsave(&dev->rx_lock, flags);
+    if (dev->rx_head == dev->rx_tail) {
+        dev->rx_head = dev->rx_tail = 0;
+    }
+    else if (dev->rx_tail + urb->actual_length > RX_STREAM_SIZE) {
+        memmove(dev->rx_stream, dev->rx_stream + dev->rx_head, dev->rx_tail - dev->rx_head);
+        dev->rx_tail -= dev->rx_head;
+        dev->rx_head = 0;
+    }
+    packet_size = usb_endpoint_maxp(dev->bulk_in);
+    for (offset = 0; offset < urb->actual_length; offset += packet_size) {
+        chunk_size = min((unsigned int) urb->actual_length - offset, packet_size);
+        if (chunk_size <= 2) {
+            continue;
+        }
+        if (dev->rx_tail + chunk_size - 2 > RX_STREAM_SIZE) {
+            dev_err_ratelimited(&dev->udev->dev, "ccp_read_callback: RX stream overflow\n");
+            dev->rx_error = -EOVERFLOW;
+            break;
+        }
+        memcpy(dev->rx_stream + dev->rx_tail, slot->buffer + offset + 2, chunk_size - 2);
+        dev->rx_tail += chunk_size - 2;
+    }
+    reply_head = dev->reply_head;
+    ccp_dispatch_replies(dev);
+    trace_camdrv_bulk_in_complete(dev->minor, 0, urb->actual_length, dev->reply_head - reply_head, dev->rx_tail - dev->rx_head);
+    spin_unlock_irqrestore(&dev->rx_lock, flags);
+    wake_up(&dev->rx_wait);
+
+    usb_anchor_urb(urb, &dev->rx_anchor);
+    result = usb_submit_urb(urb, GFP_ATOMIC);
+    if (result < 0) {
+        usb_unanchor_urb(urb);
+        if (result != -EPERM && result != -ENODEV) {
+            dev_err_ratelimited(&dev->udev->dev, "ccp_read_callback: resubmitting bulk IN URB failed: %d\n", result);
+        }
+        spin_lock_irqsave(&dev->rx_lock, flags);
+        dev->rx_error = -EIO;
+        spin_unlock_irqrestore(&dev->rx_lock, flags);
+        wake_up(&dev->rx_wait);
+    }
+}
+
+
+// Registers a reply to wait for; must be called before the command is written
+static int ccp_expect_reply(struct camdrv_device *dev, unsigned int read_size, unsigned int *ticket)
+{
+    struct ccp_reply_slot *slot;
+    int result = 0;
+    
+    spin_lock_irq(&dev->rx_lock);
+    if (dev->reply_tail - dev->reply_head >= MAX_PENDING_REPLIES) {
+        dev->rx_purge_needed = true;
+        result = -EBUSY;
+    }
+    else {
+        *ticket = dev->reply_tail;
+        slot = &dev->reply_slots[*ticket % MAX_PENDING_REPLIES];
+        slot->read_size = read_size;
+        slot->is_done = false;
+        dev->reply_tail++;
+    }
+    spin_unlock_irq(&dev->rx_lock);
+
+    return result;
+}
+
+
+// Waits for a registered reply. On return, *reply points just after the start marker.
+static int ccp_wait_reply(struct camdrv_device *dev, unsigned int ticket, unsigned char **reply)
+{
+    struct ccp_reply_slot *slot = &dev->reply_slots[ticket % MAX_PENDING_REPLIES];
+    int result;
+
+    wait_event_timeout(
+        dev->rx_wait, READ_ONCE(slot->is_done) || READ_ONCE(dev->rx_error),
+        msecs_to_jiffies(dev->tuning.timeout_ms)
+    );
+
+    spin_lock_irq(&dev->rx_lock);
+    if (slot->is_done) {
+        *reply = slot->frame + 2;
+        result = 0;
+    }
+    else {
+        result = dev->rx_error ? dev->rx_error : -ETIMEDOUT;
+    }
+    spin_unlock_irq(&dev->rx_lock);
+
+    if (result < 0) {
+        dev_err(
+            &dev->udev->dev, "ccp_wait_reply: Read failed: %d (%u bytes in stream)\n",
+            result, dev->rx_tail - dev->rx_head
+        );
+        if (result == -ETIMEDOUT) {
+            dev->statistics.timeout_count++;
+        }
+        else {
+            dev->statistics.usb_error_count++;
+        }
+        dev->rx_purge_needed = true;
+        return -EIO;
+    }
+    dev->statistics.bytes_in += slot->read_size;
+    dbg_dev_print(dev, "ccp_wait_reply: frame of %u bytes\n", slot->read_size);
+    
+    return 0;
+}
+
+
+// Writes write_size bytes from tx_buffer, split into URBs of up to
+// USB_OUT_TRANSFER_SIZE. This returns as soon as the last URB is submitted.
+static int ccp_write(struct camdrv_device *dev, unsigned int write_size)
+{
+    struct usb_device *udev = dev->udev;
+    struct ccp_urb_slot *slot;
+    unsigned int offset, chunk_size, i;
+    int result;
+    
+    dbg_dev_print(dev, "ccp_write: write_size=%u\n", write_size);
+    
+    if (!dev->bulk_in || !dev->bulk_out) {
+        dev_err(&udev->dev, "ccp_write: bulk endpoints not found\n");
+        return -ENODEV;
+    }
+    if (write_size > BUFFER_SIZE) {
+        dev_err(&udev->dev, "ccp_write: write size too large: %u\n", write_size);
+        return -EINVAL;
+    }
+
+    // Print TX buffer
+    dbg_dev_print(dev, "ccp_write: TX buffer (%u bytes): ", write_size);
+    for (i = 0; i < write_size && i < 32; i++) {
+        dbg_print("TX %d: %02x ", i, dev->tx_buffer[i]);
+    }
+    dbg_print("==(end TX)==\n");
+
+    for (offset = 0; offset < write_size; offset += chunk_size) {
+        chunk_size = min(write_size - offset, (unsigned int) USB_OUT_TRANSFER_SIZE);
+        slot = &dev->tx_slots[dev->tx_next];
+        
+        // Wait for the oldest URB in the ring to complete
+        if (!wait_event_timeout(dev->tx_wait, !READ_ONCE(slot->is_busy), msecs_to_jiffies(dev->tuning.timeout_ms))) {
+            dev_err(&udev->dev, "ccp_write: Write timed out\n");
+            dev->statistics.timeout_count++;
+            dev->rx_purge_needed = true;
+            return -EIO;
+        }
+        if (dev->tx_error) {
+            dev_err(&udev->dev, "ccp_write: Write failed: %d\n", dev->tx_error);
+            dev->statistics.usb_error_count++;
+            dev->tx_error = 0;
+            dev->rx_purge_needed = true;
+            return -EIO;
+        }
+
+        memcpy(slot->buffer, dev->tx_buffer + offset, chunk_size);
+        slot->urb->transfer_buffer_length = chunk_size;
+        slot->is_busy = true;
+        trace_camdrv_bulk_out_submit(dev->minor, dev->tx_next, chunk_size);
+        usb_anchor_urb(slot->urb, &dev->tx_anchor);
+        result = usb_submit_urb(slot->urb, GFP_KERNEL);
+        if (result < 0) {
+            dev_err(&udev->dev, "ccp_write: submitting bulk OUT URB failed: %d\n", result);
+            usb_unanchor_urb(slot->urb);
+            slot->is_busy = false;
+            dev->statistics.usb_error_count++;
+            dev->rx_purge_needed = true;
+            return -EIO;
+        }
+        dev->tx_next = (dev->tx_next + 1) % dev->tuning.pipeline_depth;
+    }
+    dbg_dev_print(dev, "ccp_write: submitted %u bytes\n", write_size);
+    ccp_count_commands(dev, write_size);
+    dev->statistics.bytes_out += write_size;
+
+    return 0;
+}
+
+
+static int ccp_inout(struct camdrv_device *dev, unsigned int write_size, unsigned int read_size)
+{
+    unsigned int ticket = 0;
+    ktime_t start, written;
+    int result;
+    
+    dbg_dev_print(dev, "ccp_inout: write_size=%u, read_size=%u\n", write_size, read_size);
+
+    ccp_prepare(dev);
+    if (read_size > 0) {
+        result = ccp_expect_reply(dev, read_size, &ticket);
+        if (result < 0) {
+            return result;
+        }
+    }
+    
+    start = ktime_get();
+    result = ccp_write(dev, write_size);
+    if (result < 0) {
+        return result;
+    }
+    written = ktime_get();
+    ccp_histogram_add(&dev->statistics.write_ns, ktime_to_ns(ktime_sub(written, start)));
+
+    if (read_size == 0) {
+        // a reply, if any, cannot be told apart from the next one
+        dev->rx_purge_needed = true;
+        if (!usb_wait_anchor_empty_timeout(&dev->tx_anchor, dev->tuning.timeout_ms) || dev->tx_error) {
+            dev_err(&dev->udev->dev, "ccp_inout: Write failed: %d\n", dev->tx_error);
+            dev->statistics.usb_error_count++;
+            return -EIO;
+        }
+        return 0;
+    }
+
+    result = ccp_wait_reply(dev, ticket, &dev->reply);
+    if (result == 0) {
+        ccp_histogram_add(&dev->statistics.read_ns, ktime_to_ns(ktime_sub(ktime_get(), written)));
+    }
+
+    return result;
+}
+
+
+static int ccp_init(struct camdrv_device *dev, unsigned char crate_number)
+{
+    int result;
+
+    dbg_dev_print(dev, "ccp_init: initializing crate %u\n", crate_number);
+
+#if 0
+    if (crate_number < 1 || crate_number > 7) {
+        dev_err(&dev->udev->dev, "ccp_init: invalid crate number %u (must be 1-7)\n", crate_number);
+#else
+    if (crate_number > 7) {
+        dev_err(&dev->udev->dev, "ccp_init: invalid crate number %u (must be 0-7)\n", crate_number);
+#endif
+        return -EINVAL;
+    }
+
+    // Reset device
+    dbg_dev_print(dev, "ccp_init: resetting device\n");
+    result = ftdi_control_request(
+        dev->udev, FTDI_SIO_RESET_REQUEST_TYPE,
+        FTDI_SIO_RESET_REQUEST,
+        FTDI_SIO_RESET_SIO, FTDI_INTERFACE_A,
+        NULL, 0
+    );
+    if (result < 0) {
+        dev_err(&dev->udev->dev, "ccp_init: device reset failed: %d\n", result);
+        return result;
+    }
+    ccp_reset_stream(dev);
+    dev->rx_purge_needed = false;
+    dev->crate_initialized = 0;
+    dev->selected_crate = CCP_NO_CRATE;
+
+    return ccp_init_crate(dev, crate_number);
+}
+
+
+// INITIALIZE_CCP for one crate, without the SIO reset
+static int ccp_init_crate(struct camdrv_device *dev, unsigned crate_number)
+{
+    unsigned char cmd = cmdINITIALIZE_CCP;
+    int result;
+
+    if (crate_number > 7) {
+        return -EINVAL;
+    }
+    
+    // Prepare command
+    dev->tx_buffer[0] = (cmd << 4);
+    dev->tx_buffer[1] = (cmd & 0xF0);
+    dev->tx_buffer[2] = (crate_number << 4);
+    dev->tx_buffer[3] = (crate_number & 0xF0);
+    dbg_dev_print(
+        dev, "ccp_init_crate: prepared command: 0x%02x 0x%02x 0x%02x 0x%02x\n",
+        dev->tx_buffer[0], dev->tx_buffer[1], dev->tx_buffer[2], dev->tx_buffer[3]
+    );
+    
+    // Send and receive
+    result = ccp_inout(dev, 4, 4);
+    if (result < 0) {
+        dev_err(&dev->udev->dev, "ccp_init_crate: ccp_inout failed: %d\n", result);
+        return result;
+    }
+
+    // Extract result
+    result = (
+        ((dev->reply[1] & 0x0F) << 4) | (dev->reply[0] & 0x0F)
+    );
+    dbg_dev_print(dev, "ccp_init_crate: received result: 0x%02x\n", result);
+    dev->crate_initialized |= (0x01 << crate_number);
+    dev->selected_crate = crate_number;
+
+    return result;
+}
+
+
+// Initializes the crate on its first use; the CAMAC and LAM frames carry the
+// crate number, so nothing has to be sent for a crate already initialized.
+// WRITE_REG does not: ccp_write_register() selects the crate itself.
+static int ccp_select_crate(struct camdrv_device *dev, unsigned crate_number)
+{
+    int result;
+    
+    if (crate_number > 7) {
+        dev_err(&dev->udev->dev, "ccp_select_crate: invalid crate number %u\n", crate_number);
+        return -EINVAL;
+    }
+    if (dev->crate_initialized & (0x01 << crate_number)) {
+        return 0;
+    }
+
+    result = ccp_init_crate(dev, crate_number);
+    
+    return (result < 0) ? result : 0;
+}
+
+
+static int ccp_initialize(struct camdrv_device *dev, unsigned crate_number)
+{
+     return ccp_write_register(dev, crate_number, 5, ctrlINITIALIZE);
+}
+
+
+static int ccp_clear(struct camdrv_device *dev, unsigned crate_number)
+{
+     return ccp_write_register(dev, crate_number, 5, ctrlCLEAR);
+}
+
+
+static void ccp_fill_camac_frame(unsigned char *frame, unsigned crate_number, unsigned n, unsigned a, unsigned f, unsigned data)
+{
+    unsigned char cmd = cmdCAMAC;
+    unsigned dl, dm, dh;
+
+    dl = (data & 0x0000ff);
+    dm = (data & 0x00ff00) >> 8;
+    dh = (data & 0xff0000) >> 16;
+    
+    frame[0] = (cmd << 4);
+    frame[1] = (cmd & 0xF0);
+    frame[2] = (crate_number << 4);
+    frame[3] = (crate_number & 0xF0);
+    frame[4] = (n << 4);
+    frame[5] = (n & 0xF0);
+    frame[6] = (a << 4);
+    frame[7] = (a & 0xF0);
+    frame[8] = (f << 4);
+    frame[9] = (f & 0xF0);
+    frame[10] = (dl << 4);
+    frame[11] = (dl & 0xF0);
+    frame[12] = (dm << 4);
+    frame[13] = (dm & 0xF0);
+    frame[14] = (dh << 4);
+    frame[15] = (dh & 0xF0);
+}
+
+
+// Every CAMAC reply carries the REQ bit of its crate, set while a LAM is
+// pending. A LAM wakes the pollers of the crate before their interval ends,
+// and a reply without LAM spares their next poll.
+static void ccp_note_lam_status(struct camdrv_device *dev, unsigned crate_number, unsigned status)
+{
+    if (dev->is_reading_lam) {
+        return;
+    }
+    if (status & statREQ) {
+        dev->lam_idle_time[crate_number] = 0;
+        if (!test_and_set_bit(crate_number, &dev->lam_requests)) {
+            dev->lam_statistics.request_count++;
+            wake_up_interruptible_all(&dev->lam_request_wait);
+        }
+    }
+    else {
+        dev->lam_idle_time[crate_number] = ktime_get();
+    }
+}
+
+
+// reply points just after the start marker; returns (NX << 1) | NQ
+static unsigned ccp_parse_camac_reply(struct camdrv_device *dev, unsigned crate_number, const unsigned char *reply, unsigned n, unsigned a, unsigned f, unsigned *data)
+{
+    unsigned status, nq, nx;
+    
+    if ((f <= 15) && data) {
+        *data = (
+            ((unsigned int)(reply[7] & 0x0F) << 20) |
+            ((unsigned int)(reply[6] & 0x0F) << 16) |
+            ((unsigned int)(reply[5] & 0x0F) << 12) |
+            ((unsigned int)(reply[4] & 0x0F) << 8) |
+            ((unsigned int)(reply[3] & 0x0F) << 4) |
+            ((unsigned int)(reply[2] & 0x0F))
+        );
+    }
+    status = ccp_decode_byte(reply);
+    trace_camdrv_camac(dev->minor, crate_number, n, a, f, status, ((f <= 15) && data) ? *data : 0);
+    ccp_note_lam_status(dev, crate_number, status);
+    nq = (status & statQ) ? 0x00 : 0x01;
+    nx = (status & statX) ? 0x00 : 0x01;
+
+    return (nx << 1) | nq;
+}
+
+
+static int ccp_camac_action(struct camdrv_device *dev, unsigned crate_number, unsigned n, unsigned a, unsigned f, unsigned* data)
+{
+    unsigned int read_size;
+    unsigned nxq;
+    int result;
+    
+    dbg_dev_print(dev, "ccp_camac_action: crate=%u, n=%u, a=%u, f=%u, &data=%p\n", crate_number, n, a, f, data);
+#if 0    
+    if (crate_number < 1  || crate_number > 7) {
+#else
+    if (crate_number > 7) {
+#endif
+        dev_err(&dev->udev->dev, "ccp_camac_action: invalid crate number %u\n", crate_number);
+        return -EINVAL;
+    }
+    if (n == 0 || n >= 24 || a >= 16 || f >= 32) {
+        dev_err(&dev->udev->dev, "ccp_camac_action: invalid parameters n=%u, a=%u, f=%u\n", n, a, f);
+        return -EINVAL;
+    }
+    if (f > 15) {
+        read_size = 4;
+    }
+    else {
+        read_size = 10;
+    }
+    dbg_dev_print(dev, "ccp_camac_action: read_size=%u\n", read_size);
+    
+    ccp_fill_camac_frame(dev->tx_buffer, crate_number, n, a, f, data ? *data : 0);
+    if (data) {
+        *data = 0;
+    }
+    
+    result = ccp_inout(dev, CCP_CAMAC_FRAME_SIZE, read_size);
+    if (result < 0) {
+        dev_err(&dev->udev->dev, "ccp_camac_action: ccp_inout failed: %d\n", result);
+#if 0
+        nq = 1;
+        nx = 1;
+        return (nx << 1) | nq;
+#else
+        return result;
+#endif
+    }
+
+    nxq = ccp_parse_camac_reply(dev, crate_number, dev->reply, n, a, f, data);
+    dbg_dev_print(dev, "ccp_camac_action: NXQ=%u, data=0x%08x\n", nxq, data ? *data : 0);
+
+    return nxq;
+}
+
+
+static int ccp_camac_list(struct camdrv_device *dev, unsigned crate_number, struct camdrv_command *commands, unsigned number_of_commands)
+{
+    unsigned int write_size = 0, first_ticket = 0, ticket;
+    unsigned char *reply;
+    unsigned i, n, a, f;
+    int result;
+    
+    dbg_dev_print(dev, "ccp_camac_list: crate=%u, number_of_commands=%u\n", crate_number, number_of_commands);
+    if (crate_number > 7) {
+        dev_err(&dev->udev->dev, "ccp_camac_list: invalid crate number %u\n", crate_number);
+        return -EINVAL;
+    }
+    if (number_of_commands == 0) {
+        return 0;
+    }
+
+    // Pack all the frames back to back
+    for (i = 0; i < number_of_commands; i++) {
+        n = (commands[i].naf >> 9) & 0x1f;
+        a = (commands[i].naf >> 5) & 0x0f;
+        f = (commands[i].naf >> 0) & 0x1f;
+        if (n == 0 || n >= 24) {
+            dev_err(&dev->udev->dev, "ccp_camac_list: invalid parameters at %u: n=%u, a=%u, f=%u\n", i, n, a, f);
+            return -EINVAL;
+        }
+        ccp_fill_camac_frame(dev->tx_buffer + write_size, crate_number, n, a, f, commands[i].data);
+        write_size += CCP_CAMAC_FRAME_SIZE;
+    }
+
+    ccp_prepare(dev);
+    
+    // The replies come back to back, in the order of the commands
+    for (i = 0; i < number_of_commands; i++) {
+        f = commands[i].naf & 0x1f;
+        result = ccp_expect_reply(dev, (f > 15) ? 4 : 10, &ticket);
+        if (result < 0) {
+            return result;
+        }
+        if (i == 0) {
+            first_ticket = ticket;
+        }
+    }
+    
+    // The frames go out in several URBs, and the first replies come back
+    // while the later frames are still being written
+    result = ccp_write(dev, write_size);
+    if (result < 0) {
+        dev_err(&dev->udev->dev, "ccp_camac_list: ccp_write failed: %d\n", result);
+        return result;
+    }
+
+    for (i = 0; i < number_of_commands; i++) {
+        n = (commands[i].naf >> 9) & 0x1f;
+        a = (commands[i].naf >> 5) & 0x0f;
+        f = commands[i].naf & 0x1f;
+        result = ccp_wait_reply(dev, first_ticket + i, &reply);
+        if (result < 0) {
+            dev_err(&dev->udev->dev, "ccp_camac_list: reply %u of %u not received\n", i, number_of_commands);
+            return result;
+        }
+        commands[i].data = 0;
+        commands[i].status = ccp_parse_camac_reply(dev, crate_number, reply, n, a, f, &commands[i].data);
+    }
+
+    return 0;
+}
+
+
+// Writes one CAMAC frame without waiting for the reply
+static int ccp_submit_camac(struct camdrv_device *dev, unsigned crate_number, unsigned n, unsigned a, unsigned f, unsigned data, unsigned *ticket)
+{
+    int result;
+
+    result = ccp_expect_reply(dev, (f > 15) ? 4 : 10, ticket);
+    if (result < 0) {
+        return result;
+    }
+    ccp_fill_camac_frame(dev->tx_buffer, crate_number, n, a, f, data);
+
+    return ccp_write(dev, CCP_CAMAC_FRAME_SIZE);
+}
+
+
+// Stream words are little endian: 3 bytes for 24-bit, 4 bytes for 32-bit
+static void ccp_pack_word(unsigned char *bytes, unsigned data, unsigned word_size)
+{
+    unsigned k;
+    for (k = 0; k < word_size; k++) {
+        bytes[k] = (data >> (8*k)) & 0xff;
+    }
+}
+
+
+static unsigned ccp_unpack_word(const unsigned char *bytes, unsigned word_size)
+{
+    unsigned data = 0, k;
+    for (k = 0; k < word_size; k++) {
+        data |= (unsigned) bytes[k] << (8*k);
+    }
+    return data & 0x00ffffff;
+}
+
+
+// Runs a block transfer until max_count words are taken or the end
+// condition of the mode is met (*is_finished is then set). On return,
+// *naf holds the address to continue from. Returns the number of words.
+//
+// Without CAMDRV_BLOCK_PIPELINED, each command is issued after the reply
+// to the previous one. With it, up to pipeline_depth commands are issued
+// ahead (in address scan, assuming Q=1), and the replies after the end
+// condition or a station change are discarded. Note that the commands thus
+// issued beyond the end are still executed by the modules. Q-stop and
+// Q-repeat always run one command at a time: repeating one NAF ahead
+// would take words off the module that are then discarded.
+static int ccp_block_transfer(struct camdrv_device *dev, unsigned crate_number, unsigned mode, unsigned *naf, unsigned *words, unsigned max_count, bool *is_finished)
+{
+    unsigned n, a, f, next_n, next_a;
+    unsigned window, pending = 0, discard = 0, failures = 0;
+    unsigned oldest_ticket = 0, ticket, count = 0;
+    unsigned data, nxq, q, x;
+    unsigned char *reply;
+    bool is_issuing = true;
+    int result;
+
+    n = (*naf >> 9) & 0x1f;
+    a = (*naf >> 5) & 0x0f;
+    f = (*naf >> 0) & 0x1f;
+    next_n = n;
+    next_a = a;
+    
+    window = (mode & CAMDRV_BLOCK_PIPELINED) ? dev->tuning.pipeline_depth : 1;
+    mode &= CAMDRV_BLOCK_MODE_MASK;
+    if (mode != CAMDRV_BLOCK_ADDRESS_SCAN) {
+        window = 1;
+    }
+    *is_finished = false;
+    
+    dbg_dev_print(dev, "ccp_block_transfer: mode=%u, n=%u, a=%u, f=%u, max_count=%u, window=%u\n", mode, n, a, f, max_count, window);
+    if (crate_number > 7) {
+        dev_err(&dev->udev->dev, "ccp_block_transfer: invalid crate number %u\n", crate_number);
+        return -EINVAL;
+    }
+    
+    ccp_prepare(dev);
+
+    while (true) {
+        // Keep up to window commands in flight
+        while (is_issuing && (pending + discard < window) && (count + pending < max_count)) {
+            if (next_n == 0 || next_n >= 24) {
+                is_issuing = false;
+                break;
+            }
+            result = ccp_submit_camac(dev, crate_number, next_n, next_a, f, 0, &ticket);
+            if (result < 0) {
+                return result;
+            }
+            if (pending + discard == 0) {
+                oldest_ticket = ticket;
+            }
+            pending++;
+            if ((mode == CAMDRV_BLOCK_ADDRESS_SCAN) && (++next_a >= 16)) {
+                next_a = 0;
+                next_n++;
+            }
+        }
+        if (pending + discard == 0) {
+            break;
+        }
+        
+        result = ccp_wait_reply(dev, oldest_ticket++, &reply);
+        if (result < 0) {
+            return result;
+        }
+        if (discard > 0) {
+            discard--;
+            continue;
+        }
+        pending--;
+        
+        data = 0;
+        nxq = ccp_parse_camac_reply(dev, crate_number, reply, n, a, f, &data);
+        q = !(nxq & 0x01);
+        x = !(nxq & 0x02);
+        
+        switch (mode) {
+          case CAMDRV_BLOCK_QSTOP:
+            if (q && x) {
+                words[count++] = data;
+            }
+            else {
+                *is_finished = true;
+            }
+            break;
+          case CAMDRV_BLOCK_QREPEAT:
+            if (!x) {
+                *is_finished = true;
+            }
+            else if (q) {
+                words[count++] = data;
+                failures = 0;
+            }
+            else if (++failures >= BLOCK_QREPEAT_LIMIT) {
+                dev_warn(&dev->udev->dev, "ccp_block_transfer: no Q after %u repeats, n=%u, a=%u, f=%u\n", failures, n, a, f);
+                *is_finished = true;
+            }
+            break;
+          case CAMDRV_BLOCK_ADDRESS_SCAN:
+            if (!x) {
+                *is_finished = true;
+            }
+            else if (q) {
+                words[count++] = data;
+                if (++a >= 16) {
+                    a = 0;
+                    n++;
+                }
+            }
+            else {
+                // continue from the next station; the commands in flight were mispredicted
+                a = 0;
+                n++;
+                next_n = n;
+                next_a = a;
+                discard += pending;
+                pending = 0;
+            }
+            if (n >= 24) {
+                *is_finished = true;
+            }
+            break;
+          default:
+            return -EINVAL;
+        }
+
+        if (*is_finished) {
+            is_issuing = false;
+            discard += pending;
+            pending = 0;
+        }
+    }
+
+    *naf = ((n << 9) | (a << 5) | f) & 0x00003fff;
+    dbg_dev_print(dev, "ccp_block_transfer: %u words, finished=%d\n", count, *is_finished);
+    
+    return count;
+}
+
+
+// Polls LAM and runs the readout list on each LAM in the mask. The mutex
+// is taken per poll, so ioctl calls are served between the polls.
+static int ccp_readout_thread(void *arg)
+{
+    struct camdrv_device *dev = arg;
+    struct camdrv_readout *readout = dev->readout;
+    struct camdrv_command *commands = dev->command_list->commands;
+    struct ccp_lam_poller poller;
+    unsigned lam, i;
+    int result;
+
+    dbg_dev_print(dev, "ccp_readout_thread: started\n");
+    ccp_lam_poller_init(&poller);
+    while (!kthread_should_stop()) {
+        lam = 0;
+        if (ccp_lock(dev, CAMDRV_PRIORITY_HIGH) < 0) {
+            // the mutex is not held: kernel threads get no signals, but do not unlock it
+            continue;
+        }
+        result = ccp_select_crate(dev, readout->crate);
+        if (result == 0) {
+            result = ccp_lam_poll(dev, &poller, readout->crate, readout->lam_mask, &lam);
+        }
+        if ((result == 0) && (lam & readout->lam_mask)) {
+            for (i = 0; i < readout->number_of_commands; i++) {
+                commands[i].naf = readout->commands[i].naf;
+                commands[i].data = readout->commands[i].data;
+            }
+            result = ccp_camac_list(dev, readout->crate, commands, readout->number_of_commands);
+            if (result == 0) {
+                ccp_push_event(dev, lam, commands, readout->number_of_commands);
+                wake_up_interruptible(&dev->lam_wait);
+            }
+        }
+        mutex_unlock(&dev->mutex);
+        
+        if (result < 0) {
+            dev_err_ratelimited(&dev->udev->dev, "ccp_readout_thread: readout failed: %d\n", result);
+            msleep(100);
+        }
+        else if (!(lam & readout->lam_mask)) {
+            ccp_lam_poll_sleep(dev, &poller, readout->crate);
+        }
+    }
+    dbg_dev_print(dev, "ccp_readout_thread: stopped\n");
+
+    return 0;
+}
+
+
+// Polls LAM on the crate of the watching files and wakes the waiters when it is seen.
+// lam_pattern stays set until a READ_LAM or WAIT_LAM takes it, and is set
+// again on the next poll if the LAM is still there.
+static int ccp_lam_thread(void *arg)
+{
+    struct camdrv_device *dev = arg;
+    struct ccp_lam_poller poller;
+    unsigned lam;
+    int result;
+
+    dbg_dev_print(dev, "ccp_lam_thread: started\n");
+    ccp_lam_poller_init(&poller);
+    while (!kthread_should_stop()) {
+        lam = 0;
+        if (ccp_lock(dev, CAMDRV_PRIORITY_HIGH) < 0) {
+            // the mutex is not held: kernel threads get no signals, but do not unlock it
+            continue;
+        }
+        result = ccp_lam_poll(dev, &poller, dev->lam_crate, dev->lam_watch_mask, &lam);
+        // set under the mutex, and only while this thread is not stopped, so
+        // that the pattern of a next LAM thread is not overwritten
+        if ((result == 0) && (lam != 0) && (dev->lam_thread == current)) {
+            WRITE_ONCE(dev->lam_seen_time, ktime_get());
+            WRITE_ONCE(dev->lam_pattern, lam);
+        }
+        else {
+            lam = 0;
+        }
+        mutex_unlock(&dev->mutex);
+        
+        if (result < 0) {
+            dev_err_ratelimited(&dev->udev->dev, "ccp_lam_thread: ccp_read_lam failed: %d\n", result);
+            msleep(100);
+            continue;
+        }
+        if (lam != 0) {
+            wake_up_interruptible(&dev->lam_wait);
+        }
+        ccp_lam_poll_sleep(dev, &poller, dev->lam_crate);
+    }
+    dbg_dev_print(dev, "ccp_lam_thread: stopped\n");
+
+    return 0;
+}
+
+
+// Single producer: only the readout thread writes head, and only the
+// reader writes tail
+static void ccp_push_event(struct camdrv_device *dev, unsigned lam_pattern, struct camdrv_command *commands, unsigned number_of_commands)
+{
+    struct camdrv_ring_control *control = dev->ring;
+    unsigned char *data_area = (unsigned char *) dev->ring + CAMDRV_RING_DATA_OFFSET;
+    struct camdrv_event_header *header;
+    unsigned *words;
+    unsigned head, tail, offset, remaining, size, needed, i;
+    u64 timestamp;
+
+    size = sizeof(struct camdrv_event_header) + number_of_commands * sizeof(unsigned);
+    head = control->head;
+    tail = smp_load_acquire(&control->tail);
+    offset = head & (dev->ring_size - 1);
+    remaining = dev->ring_size - offset;
+    needed = (remaining < size) ? remaining + size : size;
+    
+    if ((head - tail > dev->ring_size) || (dev->ring_size - (head - tail) < needed)) {
+        control->dropped_count++;
+        return;
+    }
+    
+    if (remaining < size) {
+        if (remaining >= sizeof(struct camdrv_event_header)) {
+            header = (struct camdrv_event_header *) (data_area + offset);
+            memset(header, 0, sizeof(*header));
+            header->size = remaining;
+            header->flags = CAMDRV_EVENT_PADDING;
+        }
+        head += remaining;
+        offset = 0;
+    }
+
+    timestamp = ktime_get_real_ns();
+    header = (struct camdrv_event_header *) (data_area + offset);
+    words = (unsigned *) (header + 1);
+    header->size = size;
+    header->flags = 0;
+    header->event_number = control->event_count;
+    header->lam_pattern = lam_pattern;
+    header->timestamp_nsec = do_div(timestamp, NSEC_PER_SEC);
+    header->timestamp_sec = timestamp;
+    header->number_of_words = number_of_commands;
+    header->status_summary = 0;
+    for (i = 0; i < number_of_commands; i++) {
+        words[i] = (commands[i].data & 0x00ffffff) | ((commands[i].status & 0x03) << 24);
+        header->status_summary |= words[i] & 0x03000000;
+    }
+
+    control->event_count++;
+    smp_store_release(&control->head, head + size);
+}
+
+
+// The LAMs of the stations in the mask, as a bit pattern. The controller
+// reports the lowest station only; the stations of the mask above it are
+// tested with F8, all in one pipelined list. Returns the lowest station
+// with LAM whether in the mask or not, 0 for none.
+static int ccp_read_lam(struct camdrv_device *dev, unsigned char crate_number, unsigned mask, unsigned *data)
+{
+    unsigned char cmd = cmdLAM;
+    unsigned reply, encoded_lam = 0;
+    struct camdrv_command commands[23];
+    unsigned number_of_commands, i, n;
+    int result;
+    
+    dbg_dev_print(dev, "ccp_read_lam: crate=%u, mask=0x%06x\n", crate_number, mask);
+#if 0    
+    if (crate_number < 1 || crate_number > 7) {
+#else
+    if (crate_number > 7) {
+#endif
+        dev_err(&dev->udev->dev, "ccp_read_lam: invalid crate number %u\n", crate_number);
+        return -EINVAL;
+    }
+
+    dev->tx_buffer[0] = (cmd << 4);
+    dev->tx_buffer[1] = (cmd & 0xF0);
+    dev->tx_buffer[2] = (crate_number << 4);
+    dev->tx_buffer[3] = (crate_number & 0xF0);
+    *data = 0;
+    
+    result = ccp_inout(dev, 4, 6);
+    if (result < 0) {
+        dev_err(&dev->udev->dev, "ccp_read_lam: ccp_inout failed: %d\n", result);
+        return result;
+    }
+                
+    reply = (
+        ((unsigned short)(dev->reply[3] & 0x0F) << 12) |
+        ((unsigned short)(dev->reply[2] & 0x0F) << 8) |
+        ((unsigned short)(dev->reply[1] & 0x0F) << 4) |
+        ((unsigned short)(dev->reply[0] & 0x0F))
+    );
+    dbg_dev_print(dev, "ccp_read_lam: reply=0x%04x\n", reply);
+
+    encoded_lam = (reply & 0xff00) >> 8;
+    dbg_dev_print(dev, "ccp_read_lam: encoded_lam=0x%x, status=0x%x\n", encoded_lam, (reply & 0xff));
+    dev->statistics.lam_poll_count++;
+    if ((encoded_lam == 0) || (encoded_lam >= 24)) {
+        trace_camdrv_lam_poll(dev->minor, crate_number, mask, encoded_lam, 0, false);
+        return 0;
+    }
+    dev->statistics.lam_hit_count++;
+    *data = (0x0001 << (encoded_lam - 1)) & mask;
+
+    number_of_commands = 0;
+    for (n = encoded_lam + 1; n < 24; n++) {
+        if (mask & (0x0001 << (n - 1))) {
+            commands[number_of_commands].naf = (n << 9) | 8;
+            commands[number_of_commands].data = 0;
+            number_of_commands++;
+        }
+    }
+    if (number_of_commands > 0) {
+        dev->is_reading_lam = true;
+        result = ccp_camac_list(dev, crate_number, commands, number_of_commands);
+        dev->is_reading_lam = false;
+        if (result < 0) {
+            dev_err(&dev->udev->dev, "ccp_read_lam: F8 of the stations failed: %d\n", result);
+            return result;
+        }
+        for (i = 0; i < number_of_commands; i++) {
+            // Q of F8: LAM pending
+            if ((commands[i].status & 0x03) == 0) {
+                *data |= 0x0001 << (((commands[i].naf >> 9) & 0x1f) - 1);
+            }
+        }
+    }
+    dbg_dev_print(dev, "ccp_read_lam: pattern=0x%06x\n", *data);
+    trace_camdrv_lam_poll(dev->minor, crate_number, mask, encoded_lam, *data, false);
+
+    return encoded_lam;
+}
+
+
+static void ccp_lam_poller_init(struct ccp_lam_poller *poller)
+{
+    poller->last_poll = 0;
+    poller->spin_start = ktime_get();
+    poller->last_lam = 0;
+    poller->period_ns = 0;
+    poller->was_lam = false;
+    poller->is_lam_pending = false;
+}
+
+
+// One LAM poll, called with the mutex held. A LAM seen after a poll
+// without it counts as a detection in the statistics. The poll is spared
+// when a reply of another transaction since the previous poll showed no LAM;
+// the next sleep then ends one interval after that reply.
+static int ccp_lam_poll(struct camdrv_device *dev, struct ccp_lam_poller *poller, unsigned crate_number, unsigned mask, unsigned *lam)
+{
+    struct ccp_lam_statistics *statistics = &dev->lam_statistics;
+    ktime_t start, end, idle_time;
+    u64 latency;
+    int result;
+
+    idle_time = dev->lam_idle_time[crate_number];
+    if (idle_time && poller->last_poll && !poller->is_lam_pending && ktime_after(idle_time, poller->last_poll)) {
+        statistics->spared_count++;
+        poller->last_poll = idle_time;
+        *lam = 0;
+        trace_camdrv_lam_poll(dev->minor, crate_number, mask, 0, 0, true);
+        return 0;
+    }
+
+    clear_bit(crate_number, &dev->lam_requests);
+    start = ktime_get();
+    result = ccp_read_lam(dev, crate_number, mask, lam);
+    end = ktime_get();
+    if (result < 0) {
+        poller->last_poll = 0;
+        return result;
+    }
+    poller->is_lam_pending = (result > 0);
+    
+    statistics->poll_count++;
+    statistics->poll_ns += ktime_to_ns(ktime_sub(end, start));
+    
+    if ((*lam != 0) && !poller->was_lam) {
+        if (poller->last_poll) {
+            latency = ktime_to_ns(ktime_sub(end, poller->last_poll));
+            statistics->detection_count++;
+            statistics->latency_ns += latency;
+            statistics->max_latency_ns = max(statistics->max_latency_ns, latency);
+        }
+        if (poller->last_lam) {
+            latency = ktime_to_ns(ktime_sub(end, poller->last_lam));
+            poller->period_ns = poller->period_ns ? (7 * poller->period_ns + latency) / 8 : latency;
+        }
+        poller->last_lam = end;
+        poller->spin_start = end;
+    }
+    poller->was_lam = (*lam != 0);
+    poller->last_poll = end;
+
+    return 0;
+}
+
+
+// Sleeps between two polls, following the strategy of the device, until one
+// interval after the previous poll (or the reply that spared it). A LAM
+// shown by the reply of another transaction ends the sleep, unless the
+// previous poll saw it already.
+static void ccp_lam_poll_sleep(struct camdrv_device *dev, struct ccp_lam_poller *poller, unsigned crate_number)
+{
+    unsigned interval_us = READ_ONCE(dev->lam_polling.interval_us);
+    u64 interval_ns, slack_ns, elapsed_ns;
+    ktime_t expires;
+    enum hrtimer_mode mode;
+    DEFINE_WAIT(wait);
+
+    interval_ns = (u64) interval_us * NSEC_PER_USEC;
+    switch (READ_ONCE(dev->lam_polling.strategy)) {
+      case CAMDRV_LAM_POLL_BUSY:
+        cond_resched();
+        return;
+      case CAMDRV_LAM_POLL_HYBRID:
+        if (ktime_us_delta(ktime_get(), poller->spin_start) < READ_ONCE(dev->lam_polling.spin_budget_us)) {
+            cond_resched();
+            return;
+        }
+        slack_ns = interval_ns * 3 / 2;
+        break;
+      case CAMDRV_LAM_POLL_HRTIMER:
+        slack_ns = interval_ns / 16;
+        break;
+      case CAMDRV_LAM_POLL_ADAPTIVE:
+        // 1/16 of the LAM period, or of the time since the last LAM if longer
+        if (poller->last_lam) {
+            elapsed_ns = ktime_to_ns(ktime_sub(ktime_get(), poller->last_lam));
+            interval_ns = min(interval_ns, max(poller->period_ns, elapsed_ns) / 16);
+        }
+        interval_ns = max(interval_ns, (u64) LAM_POLL_MIN_INTERVAL_US * NSEC_PER_USEC);
+        slack_ns = interval_ns / 16;
+        break;
+      default:
+        // as usleep_range(interval, 2.5 * interval)
+        slack_ns = interval_ns * 3 / 2;
+        break;
+    }
+    
+    if (poller->last_poll) {
+        expires = ktime_add_ns(poller->last_poll, interval_ns);
+        mode = HRTIMER_MODE_ABS;
+    }
+    else {
+        expires = ns_to_ktime(interval_ns);
+        mode = HRTIMER_MODE_REL;
+    }
+    prepare_to_wait(&dev->lam_request_wait, &wait, TASK_INTERRUPTIBLE);
+    if (poller->is_lam_pending || !test_bit(crate_number, &dev->lam_requests)) {
+        schedule_hrtimeout_range(&expires, slack_ns, mode);
+    }
+    finish_wait(&dev->lam_request_wait, &wait);
+}
+
+
+// Called without the mutex: it is taken for each poll only, so that other
+// ioctl calls are served between the polls
+static int ccp_wait_lam(struct camdrv_file *context, unsigned char crate_number, u64 timeout_us, unsigned* data)
+{
+    struct camdrv_device *dev = context->dev;
+    ktime_t deadline = ktime_add_us(ktime_get(), timeout_us);
+    struct ccp_lam_poller poller;
+    int result;
+
+    ccp_lam_poller_init(&poller);
+
+    /* The hardware does not support "interrupt on LAM". */
+    /* The following code is a "polling loop" to wait for any LAM bits. */
+    while (true) {
+        result = camdrv_lock(context);
+        if (result < 0) {
+            *data = 0;
+            return result;
+        }
+        result = ccp_lam_poll(dev, &poller, crate_number, READ_ONCE(context->lam_mask), data);
+        mutex_unlock(&dev->mutex);
+        if (result < 0) {
+            return result;
+        }
+        if (*data != 0) {
+            return *data;
+        }
+
+        if (!ktime_before(ktime_get(), deadline)) {
+            *data = 0;
+            return -ETIMEDOUT;
+        }
+        if (signal_pending(current)) {
+            *data = 0;
+            return -ERESTARTSYS;
+        }
+        
+        ccp_lam_poll_sleep(dev, &poller, crate_number);
+    }
+
+    return *data;
+}
+
+
+static int ccp_write_register(struct camdrv_device *dev, unsigned char crate_number, unsigned address, unsigned data)
+{
+    unsigned char cmd = cmdWRITE_REG;
+    int result;
+
+#if 0    
+    if (crate_number < 1 || crate_number > 7) {
+#else
+    if (crate_number > 7) {
+#endif
+        return -EINVAL;
+    }
+
+    // the frame has no crate number: it goes to the crate of the last INITIALIZE_CCP
+    if (dev->selected_crate != crate_number) {
+        result = ccp_init_crate(dev, crate_number);
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    dev->tx_buffer[0] = (cmd << 4);
+    dev->tx_buffer[1] = (cmd & 0xF0);
+    dev->tx_buffer[2] = (address << 4);
+    dev->tx_buffer[3] = (address & 0xF0);
+    dev->tx_buffer[4] = ((data & 0x0f) << 4);
+    dev->tx_buffer[5] = (data & 0xf0);
+
+    result = ccp_inout(dev, 6, 0);
+    if (result < 0) {
+        return result;
+    }
+
+    return 0;
+}
+
+#if 0
+// not used
+static int ccp_read_register(struct camdrv_device *dev, unsigned char crate_number, unsigned /*address*/, unsigned *data)
+{
+    unsigned char cmd = cmdREAD_REG;
+    unsigned reply;
+    int result;
+
+#if 0
+    if (crate_number < 1 || crate_number > 7) {
+#else
+    if (crate_number > 7) {
+#endif
+        return -EINVAL;
+    }
+
+    dev->tx_buffer[0] = (cmd << 4);
+    dev->tx_buffer[1] = (cmd & 0xF0);
+    dev->tx_buffer[2] = (crate_number << 4);
+    dev->tx_buffer[3] = (crate_number & 0xF0);
+
+    //??? where does the address go?
+    
+    result = ccp_inout(dev, 4, 4);
+    if (result < 0) {
+        return result;
+    }
+
+    reply = (
+        ((unsigned short)(dev->reply[3] & 0x0F) << 12) |
+        ((unsigned short)(dev->reply[2] & 0x0F) << 8) |
+        ((unsigned short)(dev->reply[1] & 0x0F) << 4) |
+        ((unsigned short)(dev->reply[0] & 0x0F))
+    );
+
+    if (data) {
+        *data = reply;
+    }
+
+    return 0;
+}
+#endif
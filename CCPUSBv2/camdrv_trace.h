@@ -0,0 +1,190 @@
+/* camdrv_trace.h */
+/* Created on 16 October 2026. */
+
+// Tracepoints of the CCP transaction path, for ftrace and perf:
+//   perf trace -e 'camdrv:*'
+//   echo 1 > /sys/kernel/tracing/events/camdrv/enable
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM camdrv
+
+#if !defined(_CAMDRV_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _CAMDRV_TRACE_H
+
+#include <linux/tracepoint.h>
+
+
+TRACE_EVENT(camdrv_ioctl_enter,
+    TP_PROTO(int minor, unsigned int cmd, unsigned long arg),
+    TP_ARGS(minor, cmd, arg),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(unsigned int, cmd)
+        __field(unsigned long, arg)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->cmd = cmd;
+        __entry->arg = arg;
+    ),
+    TP_printk("camdrv%d nr=%u cmd=0x%08x arg=0x%lx", __entry->minor, _IOC_NR(__entry->cmd), __entry->cmd, __entry->arg)
+);
+
+TRACE_EVENT(camdrv_ioctl_exit,
+    TP_PROTO(int minor, unsigned int cmd, long result),
+    TP_ARGS(minor, cmd, result),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(unsigned int, cmd)
+        __field(long, result)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->cmd = cmd;
+        __entry->result = result;
+    ),
+    TP_printk("camdrv%d nr=%u result=%ld", __entry->minor, _IOC_NR(__entry->cmd), __entry->result)
+);
+
+TRACE_EVENT(camdrv_ftdi_control,
+    TP_PROTO(u8 request_type, u8 request, u16 value, u16 index, int result),
+    TP_ARGS(request_type, request, value, index, result),
+    TP_STRUCT__entry(
+        __field(u8, request_type)
+        __field(u8, request)
+        __field(u16, value)
+        __field(u16, index)
+        __field(int, result)
+    ),
+    TP_fast_assign(
+        __entry->request_type = request_type;
+        __entry->request = request;
+        __entry->value = value;
+        __entry->index = index;
+        __entry->result = result;
+    ),
+    TP_printk(
+        "type=0x%02x request=0x%02x value=0x%04x index=%u result=%d",
+        __entry->request_type, __entry->request, __entry->value, __entry->index, __entry->result
+    )
+);
+
+TRACE_EVENT(camdrv_bulk_out_submit,
+    TP_PROTO(int minor, unsigned int slot, unsigned int size),
+    TP_ARGS(minor, slot, size),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(unsigned int, slot)
+        __field(unsigned int, size)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->slot = slot;
+        __entry->size = size;
+    ),
+    TP_printk("camdrv%d slot=%u size=%u", __entry->minor, __entry->slot, __entry->size)
+);
+
+TRACE_EVENT(camdrv_bulk_out_complete,
+    TP_PROTO(int minor, int status, unsigned int actual_length),
+    TP_ARGS(minor, status, actual_length),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(int, status)
+        __field(unsigned int, actual_length)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->status = status;
+        __entry->actual_length = actual_length;
+    ),
+    TP_printk("camdrv%d status=%d actual_length=%u", __entry->minor, __entry->status, __entry->actual_length)
+);
+
+// replies: replies completed by this transfer; stream: bytes left undispatched
+TRACE_EVENT(camdrv_bulk_in_complete,
+    TP_PROTO(int minor, int status, unsigned int actual_length, unsigned int replies, unsigned int stream),
+    TP_ARGS(minor, status, actual_length, replies, stream),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(int, status)
+        __field(unsigned int, actual_length)
+        __field(unsigned int, replies)
+        __field(unsigned int, stream)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->status = status;
+        __entry->actual_length = actual_length;
+        __entry->replies = replies;
+        __entry->stream = stream;
+    ),
+    TP_printk(
+        "camdrv%d status=%d actual_length=%u replies=%u stream=%u",
+        __entry->minor, __entry->status, __entry->actual_length, __entry->replies, __entry->stream
+    )
+);
+
+TRACE_EVENT(camdrv_camac,
+    TP_PROTO(int minor, unsigned crate, unsigned n, unsigned a, unsigned f, unsigned status, unsigned data),
+    TP_ARGS(minor, crate, n, a, f, status, data),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(u8, crate)
+        __field(u8, n)
+        __field(u8, a)
+        __field(u8, f)
+        __field(u8, status)
+        __field(unsigned, data)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->crate = crate;
+        __entry->n = n;
+        __entry->a = a;
+        __entry->f = f;
+        __entry->status = status;
+        __entry->data = data;
+    ),
+    TP_printk(
+        "camdrv%d C%u N%u A%u F%u Q=%d X=%d data=0x%06x status=0x%02x",
+        __entry->minor, __entry->crate, __entry->n, __entry->a, __entry->f,
+        (__entry->status & 0x01) ? 1 : 0, (__entry->status & 0x02) ? 1 : 0, __entry->data, __entry->status
+    )
+);
+
+// lowest: the station encoded by the controller; spared: no cmdLAM was sent
+TRACE_EVENT(camdrv_lam_poll,
+    TP_PROTO(int minor, unsigned crate, unsigned mask, unsigned lowest, unsigned pattern, bool spared),
+    TP_ARGS(minor, crate, mask, lowest, pattern, spared),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(u8, crate)
+        __field(unsigned, mask)
+        __field(u8, lowest)
+        __field(unsigned, pattern)
+        __field(bool, spared)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->crate = crate;
+        __entry->mask = mask;
+        __entry->lowest = lowest;
+        __entry->pattern = pattern;
+        __entry->spared = spared;
+    ),
+    TP_printk(
+        "camdrv%d C%u mask=0x%06x lowest=%u pattern=0x%06x%s",
+        __entry->minor, __entry->crate, __entry->mask, __entry->lowest, __entry->pattern,
+        __entry->spared ? " spared" : ""
+    )
+);
+
+#endif
+
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE camdrv_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,779 @@
+/* ccpemu.c */
+/* Created on 16 October 2026. */
+
+/* CCP-USB(V2) emulator on the Linux USB Raw Gadget.                       */
+/* With dummy_hcd loaded, the emulated controller is attached to the local */
+/* host, and camdrv binds to it as to the real one.                        */
+/*                                                                          */
+/* Usage: ccpemu [-c config] [-l latency_us] [-j jitter_us] [-s serial]     */
+/*               [-D udc_driver] [-d udc_device] [-v]                       */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#include <linux/usb/ch9.h>
+#include <linux/usb/raw_gadget.h>
+#include "camcrate.h"
+
+
+#define CCP_VENDOR_ID 0x24b9
+#define CCP_PRODUCT_ID 0x0020
+
+#define EP0_MAX_DATA 256
+#define BULK_MAX_PACKET 512
+#define BULK_BUFFER_SIZE 16384
+
+/* FTDI vendor requests, as sent by ftdi_init_sync_fifo() */
+#define FTDI_SIO_RESET_REQUEST 0x00
+#define FTDI_SIO_RESET_SIO 0
+#define FTDI_SIO_FLUSH_HOST_OUT 1
+#define FTDI_SIO_FLUSH_HOST_IN 2
+#define FTDI_SIO_GET_MODEM_STATUS_REQUEST 0x05
+#define FTDI_SIO_GET_LATENCY_TIMER_REQUEST 0x0a
+#define FTDI_SIO_READ_PINS_REQUEST 0x0c
+#define FTDI_MODEM_STATUS_0 0x01
+#define FTDI_MODEM_STATUS_1 0x60
+
+/* CCP protocol */
+#define cmdINITIALIZE_CCP 0x49
+#define cmdCAMAC 0x43
+#define cmdLAM 0x4c
+#define cmdWRITE_REG 0x57
+#define cmdREAD_REG 0x52
+#define CCP_START_MARKER 0x43
+#define ctrlINITIALIZE 0x40
+#define ctrlCLEAR 0x80
+#define statQ 0x01
+#define statX 0x02
+#define statI 0x04
+#define statLE 0x08
+#define statREQ 0x40
+
+/* the modules are those of the simulator transport, in camcrate.c */
+struct emulator {
+    struct camcrate crates[CAMCRATE_NUMBER_OF_CRATES];
+    int selected_crate;  /* of the last INITIALIZE_CCP, -1 for none */
+    struct camcrate_settings settings;
+    const char *serial;
+    int verbose;
+    /* statistics */
+    unsigned long frame_count, camac_count, lam_count, init_count, register_count;
+    unsigned long drop_count, garble_count;
+    double start_time;
+};
+
+static struct emulator emulator;
+static int gadget_fd = -1;
+static int ep_in = -1, ep_out = -1;
+static volatile sig_atomic_t is_stopped = 0;
+static pthread_t bulk_thread;
+static int is_bulk_running = 0;
+
+
+static void sleep_until(double deadline)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t) deadline;
+    ts.tv_nsec = (long) ((deadline - ts.tv_sec) * 1e9);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+        ;
+    }
+}
+
+static int happens(double rate)
+{
+    return (rate > 0) && (drand48() < rate);
+}
+
+
+
+/**** Crate ****/
+
+/* returns the status byte; *data is the read data */
+static unsigned crate_camac(struct camcrate *crate, unsigned n, unsigned a, unsigned f, unsigned *data)
+{
+    unsigned status = 0;
+    int q, x;
+
+    camcrate_camac(crate, n, a, f, data, &q, &x);
+    if (happens(emulator.settings.noq_rate)) {
+        q = 0;
+    }
+    status |= q ? statQ : 0;
+    status |= x ? statX : 0;
+    status |= crate->is_inhibited ? statI : 0;
+    status |= camcrate_lam_pattern(crate) ? statREQ : 0;
+
+    return status;
+}
+
+static void crate_write_register(struct camcrate *crate, unsigned address, unsigned value)
+{
+    if (address != 5) {
+        return;
+    }
+    if (value & (ctrlINITIALIZE | ctrlCLEAR)) {
+        camcrate_clear(crate);
+    }
+    if (value & ctrlINITIALIZE) {
+        crate->is_inhibited = 0;
+    }
+}
+
+/* crate 1: register at N1, scaler at N2, adc with a 1 kHz LAM at N3 */
+static void default_config(void)
+{
+    struct camcrate *crate = &emulator.crates[1];
+
+    crate->modules[1].type = camcrateREGISTER;
+    crate->modules[2].type = camcrateSCALER;
+    crate->modules[2].rate = 1000;
+    crate->modules[3].type = camcrateADC;
+    crate->modules[3].channels = 8;
+    crate->modules[3].period_us = 1000;
+}
+
+
+
+/**** CCP protocol ****/
+
+/* replies, nibble-encoded as by the FTDI side of the controller */
+struct reply_buffer {
+    unsigned char bytes[2 * BULK_BUFFER_SIZE];
+    unsigned length;
+};
+
+static void put_byte(struct reply_buffer *reply, unsigned value)
+{
+    reply->bytes[reply->length++] = value & 0x0f;
+    reply->bytes[reply->length++] = (value >> 4) & 0x0f;
+}
+
+static void put_marker(struct reply_buffer *reply)
+{
+    if (happens(emulator.settings.garble_rate)) {
+        emulator.garble_count++;
+        put_byte(reply, 0x00);
+        return;
+    }
+    put_byte(reply, CCP_START_MARKER);
+}
+
+/* length of a command in decoded bytes, or 0 for an unknown command */
+static unsigned command_length(unsigned command)
+{
+    switch (command) {
+      case cmdCAMAC:
+        return 8;
+      case cmdLAM:
+      case cmdINITIALIZE_CCP:
+      case cmdREAD_REG:
+        return 2;
+      case cmdWRITE_REG:
+        return 3;
+      default:
+        return 0;
+    }
+}
+
+static void process_command(const unsigned char *command, struct reply_buffer *reply)
+{
+    struct camcrate *crate;
+    unsigned crate_number, n, a, f, data, status, pattern, encoded_lam;
+
+    emulator.frame_count++;
+    if ((command[0] != cmdWRITE_REG) && happens(emulator.settings.drop_rate)) {
+        emulator.drop_count++;
+        return;
+    }
+
+    switch (command[0]) {
+      case cmdINITIALIZE_CCP:
+        emulator.init_count++;
+        crate_number = command[1] & 0x07;
+        emulator.selected_crate = crate_number;
+        put_marker(reply);
+        put_byte(reply, 0x00);
+        break;
+      case cmdCAMAC:
+        emulator.camac_count++;
+        crate = &emulator.crates[command[1] & 0x07];
+        n = command[2];
+        a = command[3];
+        f = command[4];
+        data = command[5] | (command[6] << 8) | (command[7] << 16);
+        status = crate_camac(crate, n, a, f, &data);
+        put_marker(reply);
+        put_byte(reply, status);
+        if (f <= 15) {
+            put_byte(reply, data & 0xff);
+            put_byte(reply, (data >> 8) & 0xff);
+            put_byte(reply, (data >> 16) & 0xff);
+        }
+        if (emulator.verbose > 1) {
+            fprintf(stderr, "CAMAC C%u N%u A%u F%u: data=0x%06x, status=0x%02x\n", command[1], n, a, f, data, status);
+        }
+        break;
+      case cmdLAM:
+        emulator.lam_count++;
+        crate = &emulator.crates[command[1] & 0x07];
+        pattern = camcrate_lam_pattern(crate);
+        /* the lowest station with LAM, 1-based */
+        for (encoded_lam = 0; pattern != 0; pattern >>= 1) {
+            encoded_lam++;
+            if (pattern & 0x01) {
+                break;
+            }
+        }
+        put_marker(reply);
+        put_byte(reply, encoded_lam ? statLE : 0);
+        put_byte(reply, encoded_lam);
+        break;
+      case cmdWRITE_REG:
+        /* no reply; the frame does not carry the crate: Z and C go to */
+        /* the crate of the last INITIALIZE_CCP only                   */
+        emulator.register_count++;
+        if (emulator.selected_crate >= 0) {
+            crate_write_register(&emulator.crates[emulator.selected_crate], command[1], command[2]);
+        }
+        break;
+      case cmdREAD_REG:
+        emulator.register_count++;
+        put_marker(reply);
+        put_byte(reply, 0x00);
+        put_byte(reply, 0x00);
+        break;
+    }
+}
+
+/* decoded command bytes not yet processed, carried over between transfers */
+static unsigned char pending[BULK_BUFFER_SIZE];
+static unsigned pending_length = 0;
+
+/* returns the number of commands processed */
+static unsigned process_bulk_out(const unsigned char *bytes, unsigned length, struct reply_buffer *reply)
+{
+    unsigned i, position, size, number_of_commands = 0;
+
+    for (i = 0; (i + 1 < length) && (pending_length < sizeof(pending)); i += 2) {
+        pending[pending_length++] = (bytes[i] >> 4) | (bytes[i + 1] & 0xf0);
+    }
+
+    position = 0;
+    while (position < pending_length) {
+        size = command_length(pending[position]);
+        if (size == 0) {
+            if (emulator.verbose) {
+                fprintf(stderr, "unknown command byte 0x%02x skipped\n", pending[position]);
+            }
+            position++;
+            continue;
+        }
+        if (position + size > pending_length) {
+            break;
+        }
+        process_command(pending + position, reply);
+        position += size;
+        number_of_commands++;
+    }
+    memmove(pending, pending + position, pending_length - position);
+    pending_length -= position;
+
+    return number_of_commands;
+}
+
+static void reset_protocol(void)
+{
+    pending_length = 0;
+}
+
+
+
+/**** USB Raw Gadget ****/
+
+static const struct usb_device_descriptor device_descriptor = {
+    .bLength = USB_DT_DEVICE_SIZE,
+    .bDescriptorType = USB_DT_DEVICE,
+    .bcdUSB = __constant_cpu_to_le16(0x0200),
+    .bDeviceClass = 0,
+    .bDeviceSubClass = 0,
+    .bDeviceProtocol = 0,
+    .bMaxPacketSize0 = 64,
+    .idVendor = __constant_cpu_to_le16(CCP_VENDOR_ID),
+    .idProduct = __constant_cpu_to_le16(CCP_PRODUCT_ID),
+    .bcdDevice = __constant_cpu_to_le16(0x0700),
+    .iManufacturer = 1,
+    .iProduct = 2,
+    .iSerialNumber = 3,
+    .bNumConfigurations = 1,
+};
+
+/* struct usb_endpoint_descriptor without the audio fields */
+struct endpoint_descriptor {
+    __u8 bLength;
+    __u8 bDescriptorType;
+    __u8 bEndpointAddress;
+    __u8 bmAttributes;
+    __le16 wMaxPacketSize;
+    __u8 bInterval;
+} __attribute__((packed));
+
+struct configuration {
+    struct usb_config_descriptor config;
+    struct usb_interface_descriptor interface;
+    struct endpoint_descriptor ep_in;
+    struct endpoint_descriptor ep_out;
+} __attribute__((packed));
+
+static const struct configuration configuration = {
+    .config = {
+        .bLength = USB_DT_CONFIG_SIZE,
+        .bDescriptorType = USB_DT_CONFIG,
+        .wTotalLength = __constant_cpu_to_le16(sizeof(struct configuration)),
+        .bNumInterfaces = 1,
+        .bConfigurationValue = 1,
+        .iConfiguration = 0,
+        .bmAttributes = USB_CONFIG_ATT_ONE,
+        .bMaxPower = 50,
+    },
+    .interface = {
+        .bLength = USB_DT_INTERFACE_SIZE,
+        .bDescriptorType = USB_DT_INTERFACE,
+        .bInterfaceNumber = 0,
+        .bAlternateSetting = 0,
+        .bNumEndpoints = 2,
+        .bInterfaceClass = USB_CLASS_VENDOR_SPEC,
+        .bInterfaceSubClass = USB_CLASS_VENDOR_SPEC,
+        .bInterfaceProtocol = USB_CLASS_VENDOR_SPEC,
+        .iInterface = 2,
+    },
+    .ep_in = {
+        .bLength = USB_DT_ENDPOINT_SIZE,
+        .bDescriptorType = USB_DT_ENDPOINT,
+        .bEndpointAddress = USB_DIR_IN | 1,
+        .bmAttributes = USB_ENDPOINT_XFER_BULK,
+        .wMaxPacketSize = __constant_cpu_to_le16(BULK_MAX_PACKET),
+        .bInterval = 0,
+    },
+    .ep_out = {
+        .bLength = USB_DT_ENDPOINT_SIZE,
+        .bDescriptorType = USB_DT_ENDPOINT,
+        .bEndpointAddress = USB_DIR_OUT | 2,
+        .bmAttributes = USB_ENDPOINT_XFER_BULK,
+        .wMaxPacketSize = __constant_cpu_to_le16(BULK_MAX_PACKET),
+        .bInterval = 0,
+    },
+};
+
+struct ep0_io {
+    struct usb_raw_ep_io io;
+    unsigned char data[EP0_MAX_DATA];
+};
+
+struct bulk_io {
+    struct usb_raw_ep_io io;
+    unsigned char data[2 * BULK_BUFFER_SIZE + 2 * (2 * BULK_BUFFER_SIZE / (BULK_MAX_PACKET - 2) + 1)];
+};
+
+/* USB string descriptor from ASCII */
+static int string_descriptor(unsigned index, unsigned char *buffer, unsigned size)
+{
+    const char *strings[] = { NULL, "Hoshin Electronics", "CCP-USB(V2) emulator", emulator.serial };
+    const char *string;
+    unsigned i, length;
+
+    if (index == 0) {
+        buffer[0] = 4;
+        buffer[1] = USB_DT_STRING;
+        buffer[2] = 0x09;  /* English (US) */
+        buffer[3] = 0x04;
+        return 4;
+    }
+    if (index > 3) {
+        return -1;
+    }
+    string = strings[index];
+    length = strlen(string);
+    if (2 + 2 * length > size) {
+        length = (size - 2) / 2;
+    }
+    buffer[0] = 2 + 2 * length;
+    buffer[1] = USB_DT_STRING;
+    for (i = 0; i < length; i++) {
+        buffer[2 + 2 * i] = string[i];
+        buffer[3 + 2 * i] = 0;
+    }
+
+    return buffer[0];
+}
+
+/* Each USB packet of the FTDI chip starts with two modem status bytes */
+static int write_bulk_in(struct reply_buffer *reply)
+{
+    static struct bulk_io bulk;
+    unsigned offset, chunk_size, length = 0;
+    int result;
+
+    for (offset = 0; offset < reply->length; offset += chunk_size) {
+        chunk_size = reply->length - offset;
+        if (chunk_size > BULK_MAX_PACKET - 2) {
+            chunk_size = BULK_MAX_PACKET - 2;
+        }
+        bulk.data[length++] = FTDI_MODEM_STATUS_0;
+        bulk.data[length++] = FTDI_MODEM_STATUS_1;
+        memcpy(bulk.data + length, reply->bytes + offset, chunk_size);
+        length += chunk_size;
+    }
+    bulk.io.ep = ep_in;
+    bulk.io.flags = 0;
+    bulk.io.length = length;
+
+    result = ioctl(gadget_fd, USB_RAW_IOCTL_EP_WRITE, &bulk);
+    if ((result < 0) && (errno != ESHUTDOWN)) {
+        perror("ioctl(USB_RAW_IOCTL_EP_WRITE)");
+    }
+
+    return result;
+}
+
+static void *bulk_loop(void *arg)
+{
+    static struct bulk_io bulk;
+    static struct reply_buffer reply;
+    unsigned number_of_commands;
+    double deadline, jitter;
+    int result;
+
+    while (! is_stopped) {
+        bulk.io.ep = ep_out;
+        bulk.io.flags = 0;
+        bulk.io.length = BULK_BUFFER_SIZE;
+        result = ioctl(gadget_fd, USB_RAW_IOCTL_EP_READ, &bulk);
+        if (result < 0) {
+            if (errno != ESHUTDOWN && errno != EINTR) {
+                perror("ioctl(USB_RAW_IOCTL_EP_READ)");
+            }
+            break;
+        }
+
+        reply.length = 0;
+        deadline = camcrate_now();
+        number_of_commands = process_bulk_out(bulk.data, result, &reply);
+        if (emulator.settings.latency_us > 0) {
+            jitter = emulator.settings.jitter_us ? (2 * drand48() - 1) * emulator.settings.jitter_us : 0;
+            deadline += 1e-6 * (number_of_commands * (double) emulator.settings.latency_us + jitter);
+            sleep_until(deadline);
+        }
+        if (reply.length > 0) {
+            if (write_bulk_in(&reply) < 0) {
+                break;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static int enable_endpoints(void)
+{
+    struct usb_endpoint_descriptor descriptor;
+    sigset_t signals, old_signals;
+    int result;
+
+    memset(&descriptor, 0, sizeof(descriptor));
+    if (ep_in < 0) {
+        memcpy(&descriptor, &configuration.ep_in, sizeof(configuration.ep_in));
+        ep_in = ioctl(gadget_fd, USB_RAW_IOCTL_EP_ENABLE, &descriptor);
+        if (ep_in < 0) {
+            perror("ioctl(USB_RAW_IOCTL_EP_ENABLE, IN)");
+            return -1;
+        }
+    }
+    if (ep_out < 0) {
+        memcpy(&descriptor, &configuration.ep_out, sizeof(configuration.ep_out));
+        ep_out = ioctl(gadget_fd, USB_RAW_IOCTL_EP_ENABLE, &descriptor);
+        if (ep_out < 0) {
+            perror("ioctl(USB_RAW_IOCTL_EP_ENABLE, OUT)");
+            return -1;
+        }
+    }
+    ioctl(gadget_fd, USB_RAW_IOCTL_VBUS_DRAW, 2 * configuration.config.bMaxPower);
+    if (ioctl(gadget_fd, USB_RAW_IOCTL_CONFIGURE, 0) < 0) {
+        perror("ioctl(USB_RAW_IOCTL_CONFIGURE)");
+        return -1;
+    }
+
+    if (! is_bulk_running) {
+        /* SIGINT and SIGTERM go to the ep0 loop; SIGUSR1 stops the bulk loop */
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+        result = pthread_create(&bulk_thread, NULL, bulk_loop, NULL);
+        pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+        if (result != 0) {
+            fprintf(stderr, "pthread_create(): %s\n", strerror(result));
+            return -1;
+        }
+        is_bulk_running = 1;
+    }
+
+    return 0;
+}
+
+/* returns the length of the data stage, or -1 to stall */
+static int handle_control(const struct usb_ctrlrequest *request, struct ep0_io *ep0)
+{
+    unsigned type = request->bRequestType & USB_TYPE_MASK;
+    unsigned value = __le16_to_cpu(request->wValue);
+    unsigned length = __le16_to_cpu(request->wLength);
+    int size = -1;
+
+    if (emulator.verbose) {
+        fprintf(
+            stderr, "control: type=0x%02x, request=0x%02x, value=0x%04x, index=0x%04x, length=%u\n",
+            request->bRequestType, request->bRequest, value, __le16_to_cpu(request->wIndex), length
+        );
+    }
+
+    if (type == USB_TYPE_STANDARD) {
+        switch (request->bRequest) {
+          case USB_REQ_GET_DESCRIPTOR:
+            switch (value >> 8) {
+              case USB_DT_DEVICE:
+                memcpy(ep0->data, &device_descriptor, sizeof(device_descriptor));
+                size = sizeof(device_descriptor);
+                break;
+              case USB_DT_CONFIG:
+                memcpy(ep0->data, &configuration, sizeof(configuration));
+                size = sizeof(configuration);
+                break;
+              case USB_DT_STRING:
+                size = string_descriptor(value & 0xff, ep0->data, EP0_MAX_DATA);
+                break;
+            }
+            break;
+          case USB_REQ_SET_CONFIGURATION:
+            size = (enable_endpoints() == 0) ? 0 : -1;
+            break;
+          case USB_REQ_SET_INTERFACE:
+            size = 0;
+            break;
+          case USB_REQ_GET_CONFIGURATION:
+            ep0->data[0] = 1;
+            size = 1;
+            break;
+          case USB_REQ_GET_INTERFACE:
+            ep0->data[0] = 0;
+            size = 1;
+            break;
+          case USB_REQ_GET_STATUS:
+            ep0->data[0] = 0;
+            ep0->data[1] = 0;
+            size = 2;
+            break;
+        }
+    }
+    else if (type == USB_TYPE_VENDOR) {
+        /* FTDI: reset, bit mode, latency timer and the like are acknowledged */
+        switch (request->bRequest) {
+          case FTDI_SIO_RESET_REQUEST:
+            if ((value == FTDI_SIO_RESET_SIO) || (value == FTDI_SIO_FLUSH_HOST_OUT)) {
+                reset_protocol();
+            }
+            size = 0;
+            break;
+          case FTDI_SIO_GET_MODEM_STATUS_REQUEST:
+            ep0->data[0] = FTDI_MODEM_STATUS_0;
+            ep0->data[1] = FTDI_MODEM_STATUS_1;
+            size = 2;
+            break;
+          case FTDI_SIO_GET_LATENCY_TIMER_REQUEST:
+          case FTDI_SIO_READ_PINS_REQUEST:
+            ep0->data[0] = 0;
+            size = 1;
+            break;
+          default:
+            size = 0;
+        }
+    }
+
+    if ((size > 0) && ((unsigned) size > length)) {
+        size = length;
+    }
+
+    return size;
+}
+
+static int ep0_loop(void)
+{
+    struct {
+        struct usb_raw_event event;
+        struct usb_ctrlrequest request;
+    } event;
+    struct ep0_io ep0;
+    const struct usb_ctrlrequest *request = &event.request;
+    int size, result;
+
+    while (! is_stopped) {
+        event.event.type = 0;
+        event.event.length = sizeof(struct usb_ctrlrequest);
+        if (ioctl(gadget_fd, USB_RAW_IOCTL_EVENT_FETCH, &event) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("ioctl(USB_RAW_IOCTL_EVENT_FETCH)");
+            return -1;
+        }
+        if (event.event.type == USB_RAW_EVENT_CONNECT) {
+            if (emulator.verbose) {
+                fprintf(stderr, "connected\n");
+            }
+            continue;
+        }
+        if (event.event.type != USB_RAW_EVENT_CONTROL) {
+            continue;
+        }
+
+        size = handle_control(request, &ep0);
+        ep0.io.ep = 0;
+        ep0.io.flags = 0;
+        if (size < 0) {
+            ioctl(gadget_fd, USB_RAW_IOCTL_EP0_STALL, 0);
+            continue;
+        }
+        if (request->bRequestType & USB_DIR_IN) {
+            ep0.io.length = size;
+            result = ioctl(gadget_fd, USB_RAW_IOCTL_EP0_WRITE, &ep0);
+        }
+        else {
+            ep0.io.length = __le16_to_cpu(request->wLength);
+            result = ioctl(gadget_fd, USB_RAW_IOCTL_EP0_READ, &ep0);
+        }
+        if ((result < 0) && (errno != ESHUTDOWN)) {
+            perror("ioctl(USB_RAW_IOCTL_EP0_*)");
+        }
+    }
+
+    return 0;
+}
+
+static void print_statistics(void)
+{
+    double elapsed = camcrate_now() - emulator.start_time;
+
+    fprintf(
+        stderr,
+        "%lu frames in %.1f s (%.0f frames/s): %lu CAMAC, %lu LAM, %lu INIT, %lu register; %lu dropped, %lu garbled\n",
+        emulator.frame_count, elapsed, emulator.frame_count / (elapsed > 0 ? elapsed : 1),
+        emulator.camac_count, emulator.lam_count, emulator.init_count, emulator.register_count,
+        emulator.drop_count, emulator.garble_count
+    );
+}
+
+static void stop(int signal_number)
+{
+    is_stopped = 1;
+}
+
+
+
+int main(int argc, char **argv)
+{
+    const char *udc_driver = "dummy_udc", *udc_device = "dummy_udc.0", *config_path = NULL;
+    struct usb_raw_init init;
+    struct sigaction action;
+    int option;
+
+    emulator.serial = "CCPEMU0001";
+    emulator.selected_crate = -1;
+    while ((option = getopt(argc, argv, "c:l:j:s:D:d:v")) != -1) {
+        switch (option) {
+          case 'c':
+            config_path = optarg;
+            break;
+          case 'l':
+            emulator.settings.latency_us = strtoul(optarg, NULL, 0);
+            break;
+          case 'j':
+            emulator.settings.jitter_us = strtoul(optarg, NULL, 0);
+            break;
+          case 's':
+            emulator.serial = optarg;
+            break;
+          case 'D':
+            udc_driver = optarg;
+            break;
+          case 'd':
+            udc_device = optarg;
+            break;
+          case 'v':
+            emulator.verbose++;
+            break;
+          default:
+            fprintf(stderr, "Usage: %s [-c config] [-l latency_us] [-j jitter_us] [-s serial] [-D udc_driver] [-d udc_device] [-v]\n", argv[0]);
+            return -1;
+        }
+    }
+
+    if (config_path) {
+        if (camcrate_load_config(emulator.crates, &emulator.settings, config_path) < 0) {
+            return -1;
+        }
+    }
+    else {
+        default_config();
+    }
+    srand48(time(NULL));
+    if (camcrate_init(emulator.crates) < 0) {
+        fprintf(stderr, "%s: cannot allocate the module memories\n", argv[0]);
+        return -1;
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGUSR1, &action, NULL);
+
+    gadget_fd = open("/dev/raw-gadget", O_RDWR);
+    if (gadget_fd < 0) {
+        perror("/dev/raw-gadget (is raw_gadget loaded?)");
+        return -1;
+    }
+    memset(&init, 0, sizeof(init));
+    strncpy((char *) init.driver_name, udc_driver, UDC_NAME_LENGTH_MAX - 1);
+    strncpy((char *) init.device_name, udc_device, UDC_NAME_LENGTH_MAX - 1);
+    init.speed = USB_SPEED_HIGH;
+    if (ioctl(gadget_fd, USB_RAW_IOCTL_INIT, &init) < 0) {
+        perror("ioctl(USB_RAW_IOCTL_INIT)");
+        return -1;
+    }
+    if (ioctl(gadget_fd, USB_RAW_IOCTL_RUN, 0) < 0) {
+        perror("ioctl(USB_RAW_IOCTL_RUN)");
+        return -1;
+    }
+    fprintf(stderr, "CCP-USB(V2) emulator running on %s (serial %s)\n", udc_device, emulator.serial);
+
+    emulator.start_time = camcrate_now();
+    ep0_loop();
+
+    /* interrupts the blocked bulk I/O */
+    if (is_bulk_running) {
+        pthread_kill(bulk_thread, SIGUSR1);
+        pthread_join(bulk_thread, NULL);
+    }
+    close(gadget_fd);
+    print_statistics();
+
+    return 0;
+}
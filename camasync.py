@@ -0,0 +1,213 @@
+# camasync.py #
+# Created on 16 October 2026. #
+
+# asyncio layer over the camdrv ioctl()s, for slow-control and monitoring
+# applications serving other things in the same event loop.
+#
+#     cam = AsyncCamac(crate_number=1)
+#     q, x, data, status = await cam.camac(n, a, f)
+#     lam, status = await cam.wait_lam(mask=0x0004, timeout=1.0)
+#
+# Each AsyncCamac opens a file of its own, so many crates and controllers
+# can be multiplexed in one event loop.
+
+
+import os, fcntl, struct, errno, asyncio, concurrent.futures
+
+from camlib import (
+    DEVICE_FILE, CAMDRV_MAX_COMMANDS, CAMDRV_ACTION_VERSION,
+    CAMDRV_IOC_CAMAC_ACTION_EX, CAMDRV_IOC_CAMAC_LIST, CAMDRV_IOC_SET_CRATE,
+    CAMDRV_IOC_ENABLE_INTERRUPT, CAMDRV_IOC_DISABLE_INTERRUPT, CAMDRV_IOC_WAIT_LAM_US,
+    CAMDRV_IOC_SET_LAM_MASK, CAMDRV_LAM_MASK_ALL,
+)
+
+
+class AsyncCamac:
+    """
+    CAMAC actions run in a dedicated executor thread, with at most queue_size
+    waiting; LAMs are waited for by poll() on the device when the driver LAM
+    polling can be started, and in a second executor thread otherwise.
+
+    The driver polls LAM on one crate of a controller at a time: while the
+    files of another crate (or a readout) hold it, ENABLE_INTERRUPT fails with
+    EBUSY, and the wait runs in the executor thread until it can be started.
+    """
+
+    # longest blocking WAIT_LAM of the executor fallback, so that close() is not held
+    _FALLBACK_WAIT_US = 100000
+
+    def __init__(self, device_file=DEVICE_FILE, crate_number=1, queue_size=64):
+        self._fd = os.open(device_file, os.O_RDWR)
+        self._crate_number = crate_number
+        self._queue_size = queue_size
+        self._slots = None
+        self._lam_lock = None
+        self._executor = concurrent.futures.ThreadPoolExecutor(max_workers=1, thread_name_prefix='camasync')
+        self._lam_executor = None
+        self._is_pollable = None
+        self._lam_mask = CAMDRV_LAM_MASK_ALL
+        fcntl.ioctl(self._fd, CAMDRV_IOC_SET_CRATE, struct.pack('=II', crate_number, 0))
+
+
+    async def __aenter__(self):
+        return self
+
+
+    async def __aexit__(self, *args):
+        self.close()
+
+
+    def close(self):
+        if self._fd is None:
+            return
+        self._executor.shutdown(wait=True)
+        if self._lam_executor is not None:
+            self._lam_executor.shutdown(wait=True)
+        if self._is_pollable:
+            try:
+                fcntl.ioctl(self._fd, CAMDRV_IOC_DISABLE_INTERRUPT)
+            except OSError:
+                pass
+        os.close(self._fd)
+        self._fd = None
+
+
+    async def _run(self, function, *args):
+        if self._slots is None:
+            self._slots = asyncio.Semaphore(self._queue_size)
+        async with self._slots:
+            return await asyncio.get_running_loop().run_in_executor(self._executor, function, *args)
+
+
+    def _camac(self, n, a, f, data):
+        ioctl_data = bytearray(struct.pack('=8IQ', CAMDRV_ACTION_VERSION, 0, self._crate_number, n, a, f, data & 0x00ffffff, 0, 0))
+        try:
+            fcntl.ioctl(self._fd, CAMDRV_IOC_CAMAC_ACTION_EX, ioctl_data, True)
+        except OSError as e:
+            return (0, 0, data, e.errno)
+
+        _, _, _, _, _, _, data_out, status, _ = struct.unpack('=8IQ', ioctl_data)
+        q = 0 if (status & 0x0001) else 1
+        x = 0 if (status & 0x0002) else 1
+
+        return (q, x, data_out & 0x00ffffff, 0)
+
+
+    def _camac_list(self, commands):
+        results = []
+        for offset in range(0, len(commands), CAMDRV_MAX_COMMANDS):
+            chunk = commands[offset:offset+CAMDRV_MAX_COMMANDS]
+            ioctl_data = bytearray(struct.pack('=I', len(chunk)))
+            for command in chunk:
+                n, a, f = command[0:3]
+                data = command[3] if len(command) > 3 else 0
+                ioctl_data += struct.pack('=III', ((n << 9) | (a << 5) | f) & 0x3fff, data & 0x00ffffff, 0)
+            try:
+                fcntl.ioctl(self._fd, CAMDRV_IOC_CAMAC_LIST, ioctl_data, True)
+            except OSError as e:
+                return (results, e.errno)
+            for i in range(len(chunk)):
+                _, data_out, status = struct.unpack_from('=III', ioctl_data, 4 + 12 * i)
+                results.append((0 if (status & 0x0001) else 1, 0 if (status & 0x0002) else 1, data_out & 0x00ffffff))
+
+        return (results, 0)
+
+
+    async def camac(self, n, a, f, data=0):
+        """
+        Returns:
+            (q, x, data, errno)
+        """
+        return await self._run(self._camac, n, a, f, data)
+
+
+    async def camac_list(self, commands):
+        """
+        Args:
+            commands: sequence of (n, a, f) or (n, a, f, data)
+        Returns:
+            ([(q, x, data), ...], errno)
+        """
+        return await self._run(self._camac_list, list(commands))
+
+
+    def _wait_lam_us(self, timeout_us):
+        ioctl_data = bytearray(struct.pack('=II', timeout_us, 0))
+        try:
+            return (fcntl.ioctl(self._fd, CAMDRV_IOC_WAIT_LAM_US, ioctl_data, True), 0)
+        except OSError as e:
+            return (0, e.errno)
+
+
+    def _start_lam_polling(self):
+        if self._is_pollable is None:
+            try:
+                fcntl.ioctl(self._fd, CAMDRV_IOC_ENABLE_INTERRUPT)
+                self._is_pollable = True
+            except OSError as e:
+                if self._lam_executor is None:
+                    self._lam_executor = concurrent.futures.ThreadPoolExecutor(max_workers=1, thread_name_prefix='camasync-lam')
+                if e.errno == errno.EBUSY:
+                    # polled for another crate, or by a readout: tried again on the next wait
+                    return False
+                self._is_pollable = False
+        return bool(self._is_pollable)
+
+
+    def _prepare_lam(self, mask):
+        if mask != self._lam_mask:
+            try:
+                fcntl.ioctl(self._fd, CAMDRV_IOC_SET_LAM_MASK, struct.pack('=II', mask, 0))
+            except OSError as e:
+                return (False, e.errno)
+            self._lam_mask = mask
+        return (self._start_lam_polling(), 0)
+
+
+    async def wait_lam(self, mask=CAMDRV_LAM_MASK_ALL, timeout=None):
+        """
+        wait for a LAM in mask; the driver leaves the LAMs of the other stations to the other files
+        Args:
+            timeout: seconds, or None to wait forever
+        Returns:
+            (lam, errno): lam is the LAM pattern, bit N-1 for station N; errno is ETIMEDOUT on timeout
+        """
+        loop = asyncio.get_running_loop()
+        deadline = None if timeout is None else loop.time() + timeout
+        if self._lam_lock is None:
+            self._lam_lock = asyncio.Lock()
+
+        async with self._lam_lock:
+            mask &= CAMDRV_LAM_MASK_ALL
+            # these ioctl()s take the device, which a transaction may hold: not on the loop
+            is_pollable, status = await self._run(self._prepare_lam, mask)
+            if status != 0:
+                return (0, status)
+            while True:
+                if is_pollable:
+                    # takes the LAM the driver has seen, without blocking
+                    lam, status = self._wait_lam_us(0)
+                else:
+                    remaining_us = self._FALLBACK_WAIT_US
+                    if deadline is not None:
+                        remaining_us = max(0, min(remaining_us, int(1e6 * (deadline - loop.time()))))
+                    lam, status = await loop.run_in_executor(self._lam_executor, self._wait_lam_us, remaining_us)
+                if (status not in (0, errno.ETIMEDOUT)):
+                    return (0, status)
+                if (status == 0) and (lam & mask):
+                    return (lam & mask, 0)
+
+                remaining = None if deadline is None else deadline - loop.time()
+                if (remaining is not None) and (remaining <= 0):
+                    return (0, errno.ETIMEDOUT)
+                if not is_pollable and (self._is_pollable is None):
+                    is_pollable = await self._run(self._start_lam_polling)
+                if is_pollable:
+                    readable = loop.create_future()
+                    loop.add_reader(self._fd, lambda: readable.done() or readable.set_result(None))
+                    try:
+                        await asyncio.wait_for(readable, remaining)
+                    except asyncio.TimeoutError:
+                        pass
+                    finally:
+                        loop.remove_reader(self._fd)
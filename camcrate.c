@@ -0,0 +1,369 @@
+/* camcrate.c */
+/* Created on 16 October 2026. */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "camcrate.h"
+
+
+double camcrate_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+
+
+/**** Modules ****/
+
+static void module_schedule_lam(struct camcrate_module *module, double from)
+{
+    double jitter = 0;
+    if (module->jitter_us > 0) {
+        jitter = (2 * drand48() - 1) * module->jitter_us;
+    }
+    module->next_lam_time = from + 1e-6 * (module->period_us + jitter);
+}
+
+static void module_update_lam(struct camcrate_module *module, double t)
+{
+    if ((module->period_us > 0) && ! module->is_lam_pending && (t >= module->next_lam_time)) {
+        module->is_lam_pending = 1;
+        module->event_count++;
+    }
+}
+
+static void module_clear_lam(struct camcrate_module *module, double t)
+{
+    if (module->is_lam_pending) {
+        module->is_lam_pending = 0;
+        module_schedule_lam(module, t);
+    }
+}
+
+static void module_clear(struct camcrate_module *module, double t)
+{
+    int a;
+    for (a = 0; a < 16; a++) {
+        module->registers[a] = 0;
+        module->clear_time[a] = t;
+    }
+    module->address = 0;
+    module_clear_lam(module, t);
+}
+
+
+
+/**** Crate ****/
+
+void camcrate_camac(struct camcrate *crate, unsigned n, unsigned a, unsigned f, unsigned *data, int *q, int *x)
+{
+    struct camcrate_module *module;
+    double t = camcrate_now();
+
+    a &= 0x0f;
+    f &= 0x1f;
+    if ((n == 0) || (n > CAMCRATE_NUMBER_OF_STATIONS) || (crate->modules[n].type == camcrateNONE)) {
+        if (f < 16) {
+            *data = 0;
+        }
+        *q = 0;
+        *x = 0;
+        return;
+    }
+    module = &crate->modules[n];
+    module_update_lam(module, t);
+    *q = 1;
+    *x = 1;
+
+    switch (f) {
+      case 8:
+        *q = module->is_lam_pending;
+        break;
+      case 9:
+        module_clear(module, t);
+        break;
+      case 10:
+        module_clear_lam(module, t);
+        break;
+      case 24:
+        module->is_lam_enabled = 0;
+        break;
+      case 26:
+        module->is_lam_enabled = 1;
+        break;
+      case 0: case 1: case 2: case 3:
+        switch (module->type) {
+          case camcrateREGISTER:
+            *data = module->registers[a];
+            break;
+          case camcrateMEMORY:
+            if (f == 1) {
+                *data = module->address;
+            }
+            else if ((f == 0) && (module->address < module->size)) {
+                *data = module->memory[module->address++];
+            }
+            else {
+                *data = 0;
+                *q = 0;
+                *x = (f == 0);
+            }
+            break;
+          case camcrateSCALER:
+            *data = (unsigned) (module->rate * (t - module->clear_time[a])) & 0x00ffffff;
+            if (f == 2) {
+                module->clear_time[a] = t;
+            }
+            break;
+          case camcrateADC:
+            *q = (a < module->channels);
+            *data = *q ? (((module->event_count << 4) | a) & 0x00ffffff) : 0;
+            if ((f == 2) && (a + 1 >= module->channels)) {
+                module_clear_lam(module, t);
+            }
+            break;
+          default:
+            *data = 0;
+            *q = 0;
+            *x = 0;
+        }
+        break;
+      case 16: case 17: case 18: case 19:
+        if (module->type == camcrateREGISTER) {
+            module->registers[a] = *data & 0x00ffffff;
+        }
+        else if ((module->type == camcrateMEMORY) && (f == 16)) {
+            *q = (module->address < module->size);
+            if (*q) {
+                module->memory[module->address++] = *data & 0x00ffffff;
+            }
+        }
+        else if ((module->type == camcrateMEMORY) && (f == 17)) {
+            module->address = *data & 0x00ffffff;
+        }
+        else {
+            *q = 0;
+            *x = 0;
+        }
+        break;
+      default:
+        *q = 0;
+        *x = 0;
+    }
+    if ((f > 7) && (f < 16)) {
+        /* the reply carries a data word for F0-F15; the writes keep theirs */
+        *data = 0;
+    }
+}
+
+void camcrate_clear(struct camcrate *crate)
+{
+    double t = camcrate_now();
+    int n;
+
+    for (n = 1; n <= CAMCRATE_NUMBER_OF_STATIONS; n++) {
+        module_clear(&crate->modules[n], t);
+    }
+}
+
+unsigned camcrate_lam_pattern(struct camcrate *crate)
+{
+    double t = camcrate_now();
+    unsigned pattern = 0;
+    int n;
+
+    for (n = 1; n <= CAMCRATE_NUMBER_OF_STATIONS; n++) {
+        module_update_lam(&crate->modules[n], t);
+        if (crate->modules[n].is_lam_pending && crate->modules[n].is_lam_enabled) {
+            pattern |= 0x0001 << (n - 1);
+        }
+    }
+
+    return pattern;
+}
+
+double camcrate_next_lam_time(struct camcrate *crate)
+{
+    double next = 0;
+    int n;
+
+    for (n = 1; n <= CAMCRATE_NUMBER_OF_STATIONS; n++) {
+        struct camcrate_module *module = &crate->modules[n];
+        if ((module->period_us > 0) && module->is_lam_enabled && ! module->is_lam_pending) {
+            if ((next == 0) || (module->next_lam_time < next)) {
+                next = module->next_lam_time;
+            }
+        }
+    }
+
+    return next;
+}
+
+
+
+/**** Configuration ****/
+
+int camcrate_load_config(struct camcrate *crates, struct camcrate_settings *settings, const char *path)
+{
+    FILE *file;
+    char line[256], *token, *saveptr, *args[8];
+    unsigned crate_number = 1, n;
+    struct camcrate_module *module;
+    int line_number = 0, i, number_of_args;
+
+    if (! (file = fopen(path, "r"))) {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        if ((token = strchr(line, '#'))) {
+            *token = '\0';
+        }
+        number_of_args = 0;
+        for (token = strtok_r(line, " \t\r\n", &saveptr); token && (number_of_args < 8); token = strtok_r(NULL, " \t\r\n", &saveptr)) {
+            args[number_of_args++] = token;
+        }
+        if (number_of_args == 0) {
+            continue;
+        }
+
+        if ((strcmp(args[0], "crate") == 0) && (number_of_args == 2)) {
+            crate_number = strtoul(args[1], NULL, 0);
+            if (crate_number >= CAMCRATE_NUMBER_OF_CRATES) {
+                goto error;
+            }
+        }
+        else if ((strcmp(args[0], "module") == 0) && (number_of_args >= 3)) {
+            n = strtoul(args[1], NULL, 0);
+            if ((n == 0) || (n > CAMCRATE_NUMBER_OF_STATIONS)) {
+                goto error;
+            }
+            module = &crates[crate_number].modules[n];
+            if (strcmp(args[2], "register") == 0) {
+                module->type = camcrateREGISTER;
+            }
+            else if (strcmp(args[2], "memory") == 0) {
+                module->type = camcrateMEMORY;
+            }
+            else if (strcmp(args[2], "scaler") == 0) {
+                module->type = camcrateSCALER;
+            }
+            else if (strcmp(args[2], "adc") == 0) {
+                module->type = camcrateADC;
+            }
+            else if (strcmp(args[2], "lamgen") == 0) {
+                module->type = camcrateLAMGEN;
+            }
+            else {
+                goto error;
+            }
+            for (i = 3; i < number_of_args; i++) {
+                if (strncmp(args[i], "rate=", 5) == 0) {
+                    module->rate = strtod(args[i] + 5, NULL);
+                }
+                else if (strncmp(args[i], "channels=", 9) == 0) {
+                    module->channels = strtoul(args[i] + 9, NULL, 0);
+                }
+                else if (strncmp(args[i], "size=", 5) == 0) {
+                    module->size = strtoul(args[i] + 5, NULL, 0);
+                    if (module->size > CAMCRATE_MEMORY_MAX_SIZE) {
+                        goto error;
+                    }
+                }
+                else {
+                    goto error;
+                }
+            }
+        }
+        else if ((strcmp(args[0], "lam") == 0) && (number_of_args >= 3)) {
+            n = strtoul(args[1], NULL, 0);
+            if ((n == 0) || (n > CAMCRATE_NUMBER_OF_STATIONS)) {
+                goto error;
+            }
+            module = &crates[crate_number].modules[n];
+            module->period_us = strtoul(args[2], NULL, 0);
+            module->jitter_us = (number_of_args > 3) ? strtoul(args[3], NULL, 0) : 0;
+        }
+        else if ((strcmp(args[0], "latency") == 0) && (number_of_args >= 2)) {
+            settings->latency_us = strtoul(args[1], NULL, 0);
+            settings->jitter_us = (number_of_args > 2) ? strtoul(args[2], NULL, 0) : 0;
+        }
+        else if ((strcmp(args[0], "cycle") == 0) && (number_of_args == 2)) {
+            settings->cycle_ns = strtoul(args[1], NULL, 0);
+        }
+        else if ((strcmp(args[0], "error") == 0) && (number_of_args == 3)) {
+            if (strcmp(args[1], "drop") == 0) {
+                settings->drop_rate = strtod(args[2], NULL);
+            }
+            else if (strcmp(args[1], "garble") == 0) {
+                settings->garble_rate = strtod(args[2], NULL);
+            }
+            else if (strcmp(args[1], "noq") == 0) {
+                settings->noq_rate = strtod(args[2], NULL);
+            }
+            else {
+                goto error;
+            }
+        }
+        else {
+            goto error;
+        }
+    }
+
+    fclose(file);
+    return 0;
+
+  error:
+    fprintf(stderr, "%s:%d: bad line\n", path, line_number);
+    fclose(file);
+    return -1;
+}
+
+int camcrate_init(struct camcrate *crates)
+{
+    double t = camcrate_now();
+    struct camcrate_module *module;
+    int c, n;
+
+    for (c = 0; c < CAMCRATE_NUMBER_OF_CRATES; c++) {
+        for (n = 1; n <= CAMCRATE_NUMBER_OF_STATIONS; n++) {
+            module = &crates[c].modules[n];
+            if ((module->type == camcrateADC) && (module->channels == 0)) {
+                module->channels = 8;
+            }
+            if (module->type == camcrateMEMORY) {
+                if (module->size == 0) {
+                    module->size = 1024;
+                }
+                module->memory = calloc(module->size, sizeof(unsigned));
+                if (! module->memory) {
+                    return -1;
+                }
+            }
+            module->is_lam_enabled = 1;
+            module_clear(module, t);
+            module_schedule_lam(module, t);
+        }
+    }
+
+    return 0;
+}
+
+void camcrate_free(struct camcrate *crates)
+{
+    int c, n;
+
+    for (c = 0; c < CAMCRATE_NUMBER_OF_CRATES; c++) {
+        for (n = 1; n <= CAMCRATE_NUMBER_OF_STATIONS; n++) {
+            free(crates[c].modules[n].memory);
+        }
+    }
+    memset(crates, 0, CAMCRATE_NUMBER_OF_CRATES * sizeof(struct camcrate));
+}
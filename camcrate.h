@@ -0,0 +1,101 @@
+/* camcrate.h */
+/* Created on 16 October 2026. */
+
+/* The CAMAC crate model shared by the simulator transport (camsim.c) and  */
+/* the CCP-USB(V2) emulator (CCPUSBv2/emulator/ccpemu.c): the modules, the */
+/* LAM sources and the crate file, so that both answer the same way.       */
+
+
+#ifndef __CAMCRATE_H__
+#define __CAMCRATE_H__
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAMCRATE_NUMBER_OF_CRATES 8
+#define CAMCRATE_NUMBER_OF_STATIONS 24
+#define CAMCRATE_MEMORY_MAX_SIZE 65536
+
+enum camcrate_module_type {
+    camcrateNONE = 0,
+    camcrateREGISTER,  /* F0-F3 read, F16-F19 write, 16 registers */
+    camcrateMEMORY,    /* F0 read and F16 write with autoincrement, F17 loads and F1 reads the address */
+    camcrateSCALER,    /* 16 channels counting at rate Hz; F0 read, F2 read and clear, F9 clear */
+    camcrateADC,       /* F0/F2 read of channels A0..channels-1 (Q=0 after), F2 at the last one clears LAM */
+    camcrateLAMGEN     /* LAM source only */
+};
+
+struct camcrate_module {
+    int type;
+    unsigned registers[16];
+    unsigned *memory;
+    unsigned size, address;
+    double rate;
+    double clear_time[16];
+    unsigned channels;
+    /* LAM source: a LAM is raised every period_us (+/- jitter_us) */
+    unsigned period_us, jitter_us;
+    double next_lam_time;
+    int is_lam_enabled, is_lam_pending;
+    unsigned event_count;
+};
+
+struct camcrate {
+    struct camcrate_module modules[CAMCRATE_NUMBER_OF_STATIONS + 1];
+    int is_inhibited;
+};
+
+/* the lines of the crate file that are not modules; each user takes its own */
+struct camcrate_settings {
+    unsigned latency_us, jitter_us;  /* latency US [JITTER_US] */
+    unsigned cycle_ns;               /* cycle NS */
+    double drop_rate, garble_rate, noq_rate;  /* error drop|garble|noq RATE */
+};
+
+/* CLOCK_MONOTONIC in seconds, the time base of the LAM sources */
+double camcrate_now(void);
+
+/* One dataway cycle on station n. Q and X are set as the module answers; */
+/* *data is read for F0-F7, set to 0 for F8-F15 (as the controller does)  */
+/* and left as written for F16-F31. An empty station gives Q=0 and X=0.   */
+void camcrate_camac(struct camcrate *crate, unsigned n, unsigned a, unsigned f, unsigned *data, int *q, int *x);
+
+/* C: clears every module and its LAM */
+void camcrate_clear(struct camcrate *crate);
+
+/* the LAMs of the stations, bit N-1 for station N */
+unsigned camcrate_lam_pattern(struct camcrate *crate);
+
+/* the time of the next LAM in the crate, or 0 if none is coming */
+double camcrate_next_lam_time(struct camcrate *crate);
+
+/* Crate file lines; '#' to the end of the line is a comment:
+ *   crate C                         following modules are in crate C (default 1)
+ *   module N register
+ *   module N memory [size=WORDS]
+ *   module N scaler [rate=HZ]
+ *   module N adc [channels=K]
+ *   module N lamgen
+ *   lam N PERIOD_US [JITTER_US]     LAM source at station N
+ *   latency US [JITTER_US]          delay of each call (frame for the emulator)
+ *   cycle NS                        time of each CAMAC cycle
+ *   error drop|garble|noq RATE      probability per call (frame)
+ * Returns 0, or -1 after printing the bad line.
+ */
+int camcrate_load_config(struct camcrate *crates, struct camcrate_settings *settings, const char *path);
+
+/* completes the modules after the configuration and starts the LAM sources; */
+/* returns 0, or -1 if the memories cannot be allocated                      */
+int camcrate_init(struct camcrate *crates);
+
+/* frees the memories and empties the crates */
+void camcrate_free(struct camcrate *crates);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
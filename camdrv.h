@@ -10,6 +10,145 @@
 
 #define CAMDRV_IOC_MAGIC 0xCC
 
+#define CAMDRV_MAX_COMMANDS 256
+
+/* one entry of CAMDRV_IOC_CAMAC_LIST */
+/* naf and data are inputs; data and status (bit0: No-Q, bit1: No-X) are outputs */
+struct camdrv_command {
+    unsigned naf;
+    unsigned data;
+    unsigned status;
+};
+
+/* only the first number_of_commands entries are transferred */
+struct camdrv_command_list {
+    unsigned number_of_commands;
+    struct camdrv_command commands[CAMDRV_MAX_COMMANDS];
+};
+
+/* block transfer modes, executed by read() */
+#define CAMDRV_BLOCK_QSTOP            1  /* repeat one NAF until Q=0 */
+#define CAMDRV_BLOCK_QREPEAT          2  /* repeat one NAF, taking only the Q=1 words */
+#define CAMDRV_BLOCK_ADDRESS_SCAN     3  /* scan A then N, taking the Q=1 words, until X=0 */
+#define CAMDRV_BLOCK_MODE_MASK        0x00ff
+#define CAMDRV_BLOCK_PIPELINED        0x0100  /* issue commands ahead of the replies (address scan only) */
+
+/* max_count = 0 means the size of the read() buffer */
+struct camdrv_block_transfer {
+    unsigned mode;
+    unsigned naf;
+    unsigned max_count;
+};
+
+/* word formats of the read()/write() stream */
+#define CAMDRV_FORMAT_24BIT           24  /* 3 bytes per word, little endian */
+#define CAMDRV_FORMAT_32BIT           32  /* 4 bytes per word, little endian */
+
+/* binds read() (F=0-7) or write() (F=16-23) to one NAF */
+struct camdrv_stream {
+    unsigned crate;
+    unsigned naf;
+    unsigned format;
+};
+
+/* readout list run by the driver on every LAM in lam_mask; */
+/* the events are put into the ring buffer mapped by mmap() */
+#define CAMDRV_RING_DEFAULT_SIZE      (1 << 20)
+#define CAMDRV_RING_MAX_SIZE          (16 << 20)
+
+struct camdrv_readout {
+    unsigned crate;
+    unsigned lam_mask;
+    unsigned ring_size;  /* data area in bytes, power of two; 0 for default */
+    unsigned number_of_commands;
+    struct camdrv_command commands[CAMDRV_MAX_COMMANDS];  /* status is not used */
+};
+
+/* the first page of the mapping; the data area follows at CAMDRV_RING_DATA_OFFSET */
+/* head and tail are free-running byte counts; the reader advances tail only */
+struct camdrv_ring_control {
+    unsigned head;
+    unsigned tail;
+    unsigned size;
+    unsigned event_count;
+    unsigned dropped_count;  /* events lost because the ring was full */
+};
+
+#define CAMDRV_RING_DATA_OFFSET       4096
+
+/* an event does not wrap around the end of the data area: it is preceded */
+/* by a padding record, or by nothing if less than a header is left there */
+#define CAMDRV_EVENT_PADDING          0x0001
+
+/* each event is a header and number_of_words words; a word is the */
+/* 24-bit data with the status (bit24: No-Q, bit25: No-X) on top */
+struct camdrv_event_header {
+    unsigned size;  /* bytes including this header */
+    unsigned flags;
+    unsigned event_number;
+    unsigned lam_pattern;
+    unsigned timestamp_sec;
+    unsigned timestamp_nsec;
+    unsigned number_of_words;
+    unsigned status_summary;  /* OR of the word status bits */
+};
+
+/* LAM polling strategies, used by WAIT_LAM and by the LAM/readout threads */
+#define CAMDRV_LAM_POLL_SLEEP         0  /* usleep_range() from interval_us (default 2000) */
+#define CAMDRV_LAM_POLL_BUSY          1  /* back-to-back polls, only yielding to the scheduler */
+#define CAMDRV_LAM_POLL_HYBRID        2  /* busy for spin_budget_us (at most 5000) after the start or a LAM, then sleep */
+#define CAMDRV_LAM_POLL_HRTIMER       3  /* hrtimer sleep of interval_us */
+#define CAMDRV_LAM_POLL_ADAPTIVE      4  /* hrtimer sleep following the LAM rate, up to interval_us */
+
+/* shared by all the files, and also in /sys/class/camdrv/camdrvN; as the */
+/* tuning, set only by the sole or the exclusive file (EBUSY otherwise)    */
+struct camdrv_lam_polling {
+    unsigned strategy;
+    unsigned interval_us;
+    unsigned spin_budget_us;
+};
+
+/* CAMAC action naming its own crate; the crate is initialized on first use */
+#define CAMDRV_ACTION_VERSION         1
+#define CAMDRV_ACTION_TIMESTAMP       0x0001  /* flags: fill timestamp_ns */
+
+struct camdrv_action {
+    unsigned version;  /* CAMDRV_ACTION_VERSION */
+    unsigned flags;
+    unsigned crate;
+    unsigned n, a, f;
+    unsigned data;
+    unsigned status;  /* output: bit0: No-Q, bit1: No-X */
+    unsigned long long timestamp_ns;  /* output: CLOCK_MONOTONIC at the reply */
+};
+
+/* arbitration between the files sharing a device, for SET_PRIORITY */
+#define CAMDRV_PRIORITY_LOW           0  /* waits while a normal or high request is waiting */
+#define CAMDRV_PRIORITY_NORMAL        1  /* default */
+#define CAMDRV_PRIORITY_HIGH          2  /* as the readout and LAM threads */
+
+/* per-file LAM mask, for SET_LAM_MASK: bit N-1 for station N; READ_LAM, */
+/* WAIT_LAM and poll() report the LAMs of these stations only             */
+#define CAMDRV_LAM_MASK_ALL           0x007fffff  /* stations 1-23; default */
+
+/* per-file statistics, for GET_STATISTICS */
+struct camdrv_file_statistics {
+    unsigned long long transaction_count;
+    unsigned long long wait_ns;  /* total time waiting for the device */
+    unsigned long long max_wait_ns;
+};
+
+/* USB and FTDI parameters of the controller, for GET_TUNING and SET_TUNING; */
+/* shared by all the files, and also in /sys/class/camdrv/camdrvN          */
+#define CAMDRV_MAX_IN_TRANSFER_SIZE   4096
+
+struct camdrv_tuning {
+    unsigned latency_timer_ms;  /* FTDI latency timer, 1-255 (default 2) */
+    unsigned in_transfer_size;  /* bulk IN URB, multiple of the packet size (default 512) */
+    unsigned pipeline_depth;    /* bulk URBs in flight, 1-16 (default 4) */
+    unsigned timeout_ms;        /* bulk transfers and replies, 10-60000 (default 500) */
+};
+
 #define CAMDRV_IOC_INITIALIZE         _IO(CAMDRV_IOC_MAGIC, 1)
 #define CAMDRV_IOC_CLEAR              _IO(CAMDRV_IOC_MAGIC, 2)
 #define CAMDRV_IOC_INHIBIT            _IO(CAMDRV_IOC_MAGIC, 3)
@@ -20,6 +159,20 @@
 #define CAMDRV_IOC_READ_LAM           _IOR(CAMDRV_IOC_MAGIC, 8, unsigned[2])
 #define CAMDRV_IOC_WAIT_LAM           _IOWR(CAMDRV_IOC_MAGIC, 9, unsigned[2])
 #define CAMDRV_IOC_SET_CRATE          _IOW(CAMDRV_IOC_MAGIC, 10, unsigned[2])
+#define CAMDRV_IOC_CAMAC_LIST         _IOWR(CAMDRV_IOC_MAGIC, 11, struct camdrv_command_list)
+#define CAMDRV_IOC_SET_BLOCK_TRANSFER _IOW(CAMDRV_IOC_MAGIC, 12, struct camdrv_block_transfer)
+#define CAMDRV_IOC_SET_STREAM         _IOW(CAMDRV_IOC_MAGIC, 13, struct camdrv_stream)
+#define CAMDRV_IOC_START_READOUT      _IOW(CAMDRV_IOC_MAGIC, 14, struct camdrv_readout)
+#define CAMDRV_IOC_STOP_READOUT       _IO(CAMDRV_IOC_MAGIC, 15)
+#define CAMDRV_IOC_SET_LAM_POLLING    _IOW(CAMDRV_IOC_MAGIC, 16, struct camdrv_lam_polling)
+#define CAMDRV_IOC_WAIT_LAM_US        _IOWR(CAMDRV_IOC_MAGIC, 17, unsigned[2])
+#define CAMDRV_IOC_CAMAC_ACTION_EX    _IOWR(CAMDRV_IOC_MAGIC, 18, struct camdrv_action)
+#define CAMDRV_IOC_SET_EXCLUSIVE      _IOW(CAMDRV_IOC_MAGIC, 19, unsigned[2])
+#define CAMDRV_IOC_SET_PRIORITY       _IOW(CAMDRV_IOC_MAGIC, 20, unsigned[2])
+#define CAMDRV_IOC_GET_STATISTICS     _IOR(CAMDRV_IOC_MAGIC, 21, struct camdrv_file_statistics)
+#define CAMDRV_IOC_SET_LAM_MASK       _IOW(CAMDRV_IOC_MAGIC, 22, unsigned[2])
+#define CAMDRV_IOC_GET_TUNING         _IOR(CAMDRV_IOC_MAGIC, 23, struct camdrv_tuning)
+#define CAMDRV_IOC_SET_TUNING         _IOW(CAMDRV_IOC_MAGIC, 24, struct camdrv_tuning)
 
 
 #endif
@@ -4,82 +4,135 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include "camdrv.h"
 #include "camlib.h"
+#include "camtransport.h"
+
+/* All the state of one opened controller; the ioctl buffers are on the stack, */
+/* so that threads with their own contexts need no lock.                       */
+struct cam_ctx {
+    const struct camtransport *transport;
+    int device_descripter;
+    unsigned char *ring;
+    size_t ring_map_size;
+};
 
 static const char *device_file = "/dev/camdrv";
-static int device_descripter = 0;
-static unsigned ioctl_data[2];
+static struct cam_ctx default_context = { &camtransport_driver, 0, NULL, 0 };
 
 
-int COPEN(void)
+/**** Context API ****/
+
+static int context_open(struct cam_ctx *ctx, const char *path, const char *transport_name)
 {
-    device_descripter = open(device_file, O_RDWR);
+    ctx->ring = NULL;
+    ctx->ring_map_size = 0;
+    ctx->device_descripter = camtransport_open(&ctx->transport, transport_name, path ? path : device_file, O_RDWR);
 
-    return (device_descripter >= 0) ? 0 : errno;
+    return (ctx->device_descripter >= 0) ? 0 : errno;
 }
 
-int CCLOSE(void)
+cam_ctx *cam_open_transport(const char *path, const char *transport_name)
+{
+    struct cam_ctx *ctx;
+    int result;
+
+    ctx = malloc(sizeof(struct cam_ctx));
+    if (! ctx) {
+        return NULL;
+    }
+    result = context_open(ctx, path, transport_name);
+    if (result != 0) {
+        free(ctx);
+        errno = result;
+        return NULL;
+    }
+
+    return ctx;
+}
+
+cam_ctx *cam_open(const char *path)
+{
+    /* the transport is taken from CAMLIB_TRANSPORT, the driver by default */
+    return cam_open_transport(path, NULL);
+}
+
+static void context_close(struct cam_ctx *ctx)
+{
+    if (ctx->ring) {
+        ctx->transport->munmap(ctx->ring, ctx->ring_map_size);
+        ctx->ring = NULL;
+    }
+    ctx->transport->close(ctx->device_descripter);
+}
+
+int cam_close(cam_ctx *ctx)
 {
-    close(device_descripter);
+    context_close(ctx);
+    free(ctx);
 
     return 0;
 }
 
-int CSETCR(int crate_number)
+static int context_ioctl(cam_ctx *ctx, unsigned long request, void *arg)
 {
     int result;
-    ioctl_data[0] = crate_number;
-    result = ioctl(device_descripter, CAMDRV_IOC_SET_CRATE, ioctl_data);
+    result = ctx->transport->ioctl(ctx->device_descripter, request, arg);
 
     return (result >= 0) ? 0 : errno;
 }
 
-int CGENZ(void)
+static int context_ioctl_value(cam_ctx *ctx, unsigned long request, unsigned value)
 {
-    int result; 
-    result = ioctl(device_descripter, CAMDRV_IOC_INITIALIZE);
+    unsigned ioctl_data[2];
 
-    return (result >= 0) ? 0 : errno;
+    ioctl_data[0] = value;
+    ioctl_data[1] = 0;
+
+    return context_ioctl(ctx, request, ioctl_data);
 }
 
-int CGENC(void)
+int cam_set_crate(cam_ctx *ctx, int crate_number)
 {
-    int result; 
-    result = ioctl(device_descripter, CAMDRV_IOC_CLEAR);
-
-    return (result >= 0) ? 0 : errno;
+    return context_ioctl_value(ctx, CAMDRV_IOC_SET_CRATE, crate_number);
 }
 
-int CSETI(void)
+int cam_initialize(cam_ctx *ctx)
 {
-    int result; 
-    result = ioctl(device_descripter, CAMDRV_IOC_INHIBIT);
+    return context_ioctl(ctx, CAMDRV_IOC_INITIALIZE, NULL);
+}
 
-    return (result >= 0) ? 0 : errno;
+int cam_clear(cam_ctx *ctx)
+{
+    return context_ioctl(ctx, CAMDRV_IOC_CLEAR, NULL);
 }
 
-int CREMI(void)
+int cam_inhibit(cam_ctx *ctx)
 {
-    int result; 
-    result = ioctl(device_descripter, CAMDRV_IOC_RELEASE_INHIBIT);
+    return context_ioctl(ctx, CAMDRV_IOC_INHIBIT, NULL);
+}
 
-    return (result >= 0) ? 0 : errno;
+int cam_release_inhibit(cam_ctx *ctx)
+{
+    return context_ioctl(ctx, CAMDRV_IOC_RELEASE_INHIBIT, NULL);
 }
 
-int CAMAC(int naf, int *data, int *q, int *x)
+int cam_naf(cam_ctx *ctx, int naf, int *data, int *q, int *x)
 {
+    unsigned ioctl_data[2];
     int result;
 
     ioctl_data[0] = naf;
     ioctl_data[1] = (unsigned) *data;
-    result = ioctl(device_descripter, CAMDRV_IOC_CAMAC_ACTION, ioctl_data);
+    result = ctx->transport->ioctl(ctx->device_descripter, CAMDRV_IOC_CAMAC_ACTION, ioctl_data);
 
     if (result < 0) {
         return errno;
@@ -92,33 +145,533 @@ int CAMAC(int naf, int *data, int *q, int *x)
     return 0;
 }
 
-int CELAM(int mask)
+int cam_naf_crate(cam_ctx *ctx, int crate_number, int naf, int *data, int *q, int *x)
 {
-    // not supported
-    int result; 
-    result = ioctl(device_descripter, CAMDRV_IOC_ENABLE_INTERRUPT);
+    /* names its own crate; no cam_set_crate() is needed to switch between crates */
+    struct camdrv_action action;
+    int result;
 
-    return (result >= 0) ? 0 : errno;
+    action.version = CAMDRV_ACTION_VERSION;
+    action.flags = 0;
+    action.crate = crate_number;
+    action.n = (naf >> 9) & 0x1f;
+    action.a = (naf >> 5) & 0x0f;
+    action.f = naf & 0x1f;
+    action.data = (unsigned) *data;
+    result = ctx->transport->ioctl(ctx->device_descripter, CAMDRV_IOC_CAMAC_ACTION_EX, &action);
+
+    if (result < 0) {
+        return errno;
+    }
+
+    *data = action.data & 0x00ffffff;
+    *q = ! (action.status & 0x0001);
+    *x = ! (action.status & 0x0002);
+
+    return 0;
 }
 
-int CDLAM(void)
+int cam_list(cam_ctx *ctx, int number_of_commands, const int *naf, int *data, int *q, int *x)
 {
-    // not supported
-    int result; 
-    result = ioctl(device_descripter, CAMDRV_IOC_DISABLE_INTERRUPT);
+    struct camdrv_command_list command_list;
+    int result;
+    int offset, count, i;
 
-    return (result >= 0) ? 0 : errno;
+    /* longer lists are split into chunks of CAMDRV_MAX_COMMANDS */
+    for (offset = 0; offset < number_of_commands; offset += count) {
+        count = number_of_commands - offset;
+        if (count > CAMDRV_MAX_COMMANDS) {
+            count = CAMDRV_MAX_COMMANDS;
+        }
+
+        command_list.number_of_commands = count;
+        for (i = 0; i < count; i++) {
+            command_list.commands[i].naf = naf[offset + i];
+            command_list.commands[i].data = (unsigned) data[offset + i];
+        }
+        result = ctx->transport->ioctl(ctx->device_descripter, CAMDRV_IOC_CAMAC_LIST, &command_list);
+
+        if (result < 0) {
+            return errno;
+        }
+
+        for (i = 0; i < count; i++) {
+            data[offset + i] = command_list.commands[i].data & 0x00ffffff;
+            if (q) {
+                q[offset + i] = ! (command_list.commands[i].status & 0x0001);
+            }
+            if (x) {
+                x[offset + i] = ! (command_list.commands[i].status & 0x0002);
+            }
+        }
+    }
+
+    return 0;
 }
 
-int CWLAM(int timeout)
+int cam_block(cam_ctx *ctx, int mode, int naf, int *data, int *count)
+{
+    struct camdrv_block_transfer parameter;
+    int result;
+
+    parameter.mode = mode;
+    parameter.naf = naf;
+    parameter.max_count = *count;
+    result = ctx->transport->ioctl(ctx->device_descripter, CAMDRV_IOC_SET_BLOCK_TRANSFER, &parameter);
+    if (result < 0) {
+        *count = 0;
+        return errno;
+    }
+
+    /* the driver fills the whole buffer in one call */
+    result = ctx->transport->read(ctx->device_descripter, data, *count * sizeof(int));
+    if (result < 0) {
+        *count = 0;
+        return errno;
+    }
+    *count = result / sizeof(int);
+
+    return 0;
+}
+
+int cam_bind_stream(cam_ctx *ctx, int crate_number, int naf, int format)
+{
+    struct camdrv_stream parameter;
+
+    parameter.crate = crate_number;
+    parameter.naf = naf;
+    parameter.format = format;
+
+    return context_ioctl(ctx, CAMDRV_IOC_SET_STREAM, &parameter);
+}
+
+int cam_fileno(cam_ctx *ctx)
+{
+    /* for read()/write()/readv()/poll() on the bound stream: a kernel */
+    /* descriptor, which only the driver transport has                 */
+    if (ctx->transport != &camtransport_driver) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    return ctx->device_descripter;
+}
+
+int cam_start_readout(cam_ctx *ctx, int crate_number, int lam_mask, int number_of_commands, int *naf, int *data, int ring_size)
 {
-    int result; 
-    
-    CELAM(~0);
+    struct camdrv_readout readout;
+    size_t map_size;
+    int result, i;
+
+    if ((number_of_commands <= 0) || (number_of_commands > CAMDRV_MAX_COMMANDS)) {
+        return EINVAL;
+    }
+
+    readout.crate = crate_number;
+    readout.lam_mask = lam_mask;
+    readout.ring_size = ring_size;
+    readout.number_of_commands = number_of_commands;
+    for (i = 0; i < number_of_commands; i++) {
+        readout.commands[i].naf = naf[i];
+        readout.commands[i].data = data ? (unsigned) data[i] : 0;
+    }
+    result = ctx->transport->ioctl(ctx->device_descripter, CAMDRV_IOC_START_READOUT, &readout);
+    if (result < 0) {
+        return errno;
+    }
+
+    map_size = CAMDRV_RING_DATA_OFFSET + ((ring_size > 0) ? ring_size : CAMDRV_RING_DEFAULT_SIZE);
+    if (ctx->ring && (ctx->ring_map_size != map_size)) {
+        ctx->transport->munmap(ctx->ring, ctx->ring_map_size);
+        ctx->ring = NULL;
+    }
+    if (! ctx->ring) {
+        ctx->ring = ctx->transport->mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ctx->device_descripter, 0);
+        if (ctx->ring == MAP_FAILED) {
+            ctx->ring = NULL;
+            return errno;
+        }
+        ctx->ring_map_size = map_size;
+    }
+
+    return 0;
+}
 
+int cam_stop_readout(cam_ctx *ctx)
+{
+    return context_ioctl(ctx, CAMDRV_IOC_STOP_READOUT, NULL);
+}
+
+int cam_read_event(cam_ctx *ctx, int *lam_pattern, int *data, int *q, int *x, int *number_of_words)
+{
+    /* takes the oldest event out of the ring; data must hold the whole readout list */
+    volatile struct camdrv_ring_control *control = (struct camdrv_ring_control *) ctx->ring;
+    struct camdrv_event_header *header;
+    unsigned *words;
+    unsigned head, tail, offset, i;
+
+    if (! ctx->ring) {
+        return EINVAL;
+    }
+
+    while (1) {
+        head = control->head;
+        __sync_synchronize();
+        tail = control->tail;
+        if (head == tail) {
+            *number_of_words = 0;
+            return EAGAIN;
+        }
+
+        offset = tail & (control->size - 1);
+        if (control->size - offset < sizeof(struct camdrv_event_header)) {
+            control->tail = tail + (control->size - offset);
+            continue;
+        }
+        header = (struct camdrv_event_header *) (ctx->ring + CAMDRV_RING_DATA_OFFSET + offset);
+        if (header->flags & CAMDRV_EVENT_PADDING) {
+            control->tail = tail + header->size;
+            continue;
+        }
+        break;
+    }
+
+    words = (unsigned *) (header + 1);
+    *lam_pattern = header->lam_pattern;
+    *number_of_words = header->number_of_words;
+    for (i = 0; i < header->number_of_words; i++) {
+        data[i] = words[i] & 0x00ffffff;
+        if (q) {
+            q[i] = ! (words[i] & 0x01000000);
+        }
+        if (x) {
+            x[i] = ! (words[i] & 0x02000000);
+        }
+    }
+
+    __sync_synchronize();
+    control->tail = tail + header->size;
+
+    return 0;
+}
+
+int cam_read_lam(cam_ctx *ctx, int *lam)
+{
+    /* the LAMs of the stations in the mask of cam_enable_lam(), bit N-1 for station N */
+    unsigned ioctl_data[2];
+    int result;
+
+    ioctl_data[0] = 0;
+    ioctl_data[1] = 0;
+    result = ctx->transport->ioctl(ctx->device_descripter, CAMDRV_IOC_READ_LAM, ioctl_data);
+    if (result < 0) {
+        return errno;
+    }
+    *lam = ioctl_data[1];
+
+    return 0;
+}
+
+int cam_enable_lam(cam_ctx *ctx, int mask)
+{
+    /* starts the LAM polling in the driver; the LAMs of the other stations */
+    /* are neither reported nor taken from the other files                */
+    int result;
+
+    if ((result = context_ioctl_value(ctx, CAMDRV_IOC_SET_LAM_MASK, mask & CAMDRV_LAM_MASK_ALL)) != 0) {
+        return result;
+    }
+    return context_ioctl(ctx, CAMDRV_IOC_ENABLE_INTERRUPT, NULL);
+}
+
+int cam_disable_lam(cam_ctx *ctx)
+{
+    return context_ioctl(ctx, CAMDRV_IOC_DISABLE_INTERRUPT, NULL);
+}
+
+int cam_set_lam_polling(cam_ctx *ctx, int strategy, int interval_us, int spin_budget_us)
+{
+    struct camdrv_lam_polling parameter;
+
+    parameter.strategy = strategy;
+    parameter.interval_us = interval_us;
+    parameter.spin_budget_us = spin_budget_us;
+
+    return context_ioctl(ctx, CAMDRV_IOC_SET_LAM_POLLING, &parameter);
+}
+
+static int context_wait_lam(cam_ctx *ctx, unsigned long request, int timeout)
+{
+    unsigned ioctl_data[2];
+    int result;
+
+    /* with the mask of cam_enable_lam(); the driver waits on its LAM thread */
+    /* if cam_enable_lam() has started it for this file, and polls otherwise */
     ioctl_data[0] = timeout;
     ioctl_data[1] = 0;
-    result = ioctl(device_descripter, CAMDRV_IOC_WAIT_LAM, ioctl_data);
+    result = ctx->transport->ioctl(ctx->device_descripter, request, ioctl_data);
 
     return (result > 0) ? 0 : errno;
 }
+
+int cam_wait_lam(cam_ctx *ctx, int timeout)
+{
+    return context_wait_lam(ctx, CAMDRV_IOC_WAIT_LAM, timeout);
+}
+
+int cam_wait_lam_us(cam_ctx *ctx, int timeout_us)
+{
+    return context_wait_lam(ctx, CAMDRV_IOC_WAIT_LAM_US, timeout_us);
+}
+
+int cam_set_exclusive(cam_ctx *ctx, int exclusive)
+{
+    /* while set, the other processes sharing the controller get EBUSY */
+    return context_ioctl_value(ctx, CAMDRV_IOC_SET_EXCLUSIVE, exclusive);
+}
+
+int cam_set_priority(cam_ctx *ctx, int priority)
+{
+    /* CAMDRV_PRIORITY_LOW for a monitor sharing the controller with a DAQ */
+    return context_ioctl_value(ctx, CAMDRV_IOC_SET_PRIORITY, priority);
+}
+
+int cam_get_statistics(cam_ctx *ctx, unsigned long long *transaction_count, unsigned long long *wait_ns, unsigned long long *max_wait_ns)
+{
+    struct camdrv_file_statistics statistics;
+    int result;
+
+    result = context_ioctl(ctx, CAMDRV_IOC_GET_STATISTICS, &statistics);
+    if (result != 0) {
+        return result;
+    }
+
+    *transaction_count = statistics.transaction_count;
+    *wait_ns = statistics.wait_ns;
+    *max_wait_ns = statistics.max_wait_ns;
+
+    return 0;
+}
+
+int cam_get_tuning(cam_ctx *ctx, int *latency_timer_ms, int *in_transfer_size, int *pipeline_depth, int *timeout_ms)
+{
+    struct camdrv_tuning tuning;
+    int result;
+
+    result = context_ioctl(ctx, CAMDRV_IOC_GET_TUNING, &tuning);
+    if (result != 0) {
+        return result;
+    }
+
+    *latency_timer_ms = tuning.latency_timer_ms;
+    *in_transfer_size = tuning.in_transfer_size;
+    *pipeline_depth = tuning.pipeline_depth;
+    *timeout_ms = tuning.timeout_ms;
+
+    return 0;
+}
+
+int cam_set_tuning(cam_ctx *ctx, int latency_timer_ms, int in_transfer_size, int pipeline_depth, int timeout_ms)
+{
+    /* shared by all the processes on the controller: EBUSY unless alone or exclusive */
+    struct camdrv_tuning tuning;
+
+    tuning.latency_timer_ms = latency_timer_ms;
+    tuning.in_transfer_size = in_transfer_size;
+    tuning.pipeline_depth = pipeline_depth;
+    tuning.timeout_ms = timeout_ms;
+
+    return context_ioctl(ctx, CAMDRV_IOC_SET_TUNING, &tuning);
+}
+
+
+/**** Classic API, on the default context ****/
+
+int COPEN(void)
+{
+    /* the transport is taken from CAMLIB_TRANSPORT, the driver by default */
+    return context_open(&default_context, device_file, NULL);
+}
+
+int COPENT(const char *transport_name)
+{
+    /* "driver", "sim", "record:FILE" or "replay:FILE" */
+    return context_open(&default_context, device_file, transport_name);
+}
+
+int COPENN(int device_index)
+{
+    /* opens /dev/camdrvN, for the N-th controller */
+    char device_path[64];
+    snprintf(device_path, sizeof(device_path), "%s%d", device_file, device_index);
+
+    return context_open(&default_context, device_path, NULL);
+}
+
+int CCLOSE(void)
+{
+    context_close(&default_context);
+
+    return 0;
+}
+
+int CSETCR(int crate_number)
+{
+    return cam_set_crate(&default_context, crate_number);
+}
+
+int CGENZ(void)
+{
+    return cam_initialize(&default_context);
+}
+
+int CGENC(void)
+{
+    return cam_clear(&default_context);
+}
+
+int CSETI(void)
+{
+    return cam_inhibit(&default_context);
+}
+
+int CREMI(void)
+{
+    return cam_release_inhibit(&default_context);
+}
+
+int CAMAC(int naf, int *data, int *q, int *x)
+{
+    return cam_naf(&default_context, naf, data, q, x);
+}
+
+int CAMACC(int crate_number, int naf, int *data, int *q, int *x)
+{
+    return cam_naf_crate(&default_context, crate_number, naf, data, q, x);
+}
+
+int CDREG(int *ext, int b, int c, int n, int a)
+{
+    /* ESONE style; the branch is not used */
+    *ext = (c << 16) | NAF(n, a, 0);
+
+    return 0;
+}
+
+int CFSA(int f, int ext, int *data, int *q)
+{
+    int x;
+    return CAMACC(ext >> 16, (ext & 0x3fe0) | (f & 0x1f), data, q, &x);
+}
+
+int CSSA(int f, int ext, int *data, int *q)
+{
+    int result, x;
+    result = CAMACC(ext >> 16, (ext & 0x3fe0) | (f & 0x1f), data, q, &x);
+    *data &= 0x0000ffff;
+
+    return result;
+}
+
+int CAMACLIST(int number_of_commands, const int *naf, int *data, int *q, int *x)
+{
+    return cam_list(&default_context, number_of_commands, naf, data, q, x);
+}
+
+/* The ESONE block calls run one cycle at a time: the commands issued    */
+/* ahead by CAMDRV_BLOCK_PIPELINED are executed even when their data are */
+/* discarded, which loses words of FIFOs and destructive reads (F2). Use */
+/* cam_block() with CAMDRV_BLOCK_PIPELINED for modules that allow it.    */
+int CFUBC(int naf, int *data, int *count)
+{
+    return cam_block(&default_context, CAMDRV_BLOCK_QSTOP, naf, data, count);
+}
+
+int CFUBR(int naf, int *data, int *count)
+{
+    return cam_block(&default_context, CAMDRV_BLOCK_QREPEAT, naf, data, count);
+}
+
+int CFUBA(int naf, int *data, int *count)
+{
+    return cam_block(&default_context, CAMDRV_BLOCK_ADDRESS_SCAN, naf, data, count);
+}
+
+int CBINDSTREAM(int crate_number, int naf, int format)
+{
+    return cam_bind_stream(&default_context, crate_number, naf, format);
+}
+
+int CFILENO(void)
+{
+    return cam_fileno(&default_context);
+}
+
+int CSTARTREADOUT(int crate_number, int lam_mask, int number_of_commands, int *naf, int *data, int ring_size)
+{
+    return cam_start_readout(&default_context, crate_number, lam_mask, number_of_commands, naf, data, ring_size);
+}
+
+int CSTOPREADOUT(void)
+{
+    return cam_stop_readout(&default_context);
+}
+
+int CREADEVENT(int *lam_pattern, int *data, int *q, int *x, int *number_of_words)
+{
+    return cam_read_event(&default_context, lam_pattern, data, q, x, number_of_words);
+}
+
+int CREADLAM(int *lam)
+{
+    return cam_read_lam(&default_context, lam);
+}
+
+int CELAM(int mask)
+{
+    return cam_enable_lam(&default_context, mask);
+}
+
+int CDLAM(void)
+{
+    return cam_disable_lam(&default_context);
+}
+
+int CSETLAMPOLL(int strategy, int interval_us, int spin_budget_us)
+{
+    return cam_set_lam_polling(&default_context, strategy, interval_us, spin_budget_us);
+}
+
+int CWLAMUS(int timeout_us)
+{
+    return cam_wait_lam_us(&default_context, timeout_us);
+}
+
+int CWLAM(int timeout)
+{
+    return cam_wait_lam(&default_context, timeout);
+}
+
+int CSETEXCL(int exclusive)
+{
+    return cam_set_exclusive(&default_context, exclusive);
+}
+
+int CSETPRIO(int priority)
+{
+    return cam_set_priority(&default_context, priority);
+}
+
+int CGETSTAT(unsigned long long *transaction_count, unsigned long long *wait_ns, unsigned long long *max_wait_ns)
+{
+    return cam_get_statistics(&default_context, transaction_count, wait_ns, max_wait_ns);
+}
+
+int CGETTUNE(int *latency_timer_ms, int *in_transfer_size, int *pipeline_depth, int *timeout_ms)
+{
+    return cam_get_tuning(&default_context, latency_timer_ms, in_transfer_size, pipeline_depth, timeout_ms);
+}
+
+int CSETTUNE(int latency_timer_ms, int in_transfer_size, int pipeline_depth, int timeout_ms)
+{
+    return cam_set_tuning(&default_context, latency_timer_ms, in_transfer_size, pipeline_depth, timeout_ms);
+}
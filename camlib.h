@@ -11,7 +11,44 @@
 extern "C" {
 #endif
 
+/* Context API: all the state is on the handle, so that threads with */
+/* their own handles, e.g. one per controller, need no lock.         */
+/* Functions return 0 or errno, as the classic API.                  */
+typedef struct cam_ctx cam_ctx;
+
+cam_ctx *cam_open(const char *path);  /* NULL for /dev/camdrv; NULL with errno on error */
+cam_ctx *cam_open_transport(const char *path, const char *transport_name);
+int cam_close(cam_ctx *ctx);
+int cam_set_crate(cam_ctx *ctx, int crate_number);
+int cam_initialize(cam_ctx *ctx);
+int cam_clear(cam_ctx *ctx);
+int cam_inhibit(cam_ctx *ctx);
+int cam_release_inhibit(cam_ctx *ctx);
+int cam_naf(cam_ctx *ctx, int naf, int *data, int *q, int *x);
+int cam_naf_crate(cam_ctx *ctx, int crate_number, int naf, int *data, int *q, int *x);
+int cam_list(cam_ctx *ctx, int number_of_commands, const int *naf, int *data, int *q, int *x);
+int cam_block(cam_ctx *ctx, int mode, int naf, int *data, int *count);
+int cam_bind_stream(cam_ctx *ctx, int crate_number, int naf, int format);
+int cam_fileno(cam_ctx *ctx);
+int cam_start_readout(cam_ctx *ctx, int crate_number, int lam_mask, int number_of_commands, int *naf, int *data, int ring_size);
+int cam_stop_readout(cam_ctx *ctx);
+int cam_read_event(cam_ctx *ctx, int *lam_pattern, int *data, int *q, int *x, int *number_of_words);
+int cam_read_lam(cam_ctx *ctx, int *lam);
+int cam_enable_lam(cam_ctx *ctx, int mask);
+int cam_disable_lam(cam_ctx *ctx);
+int cam_set_lam_polling(cam_ctx *ctx, int strategy, int interval_us, int spin_budget_us);
+int cam_wait_lam(cam_ctx *ctx, int timeout);
+int cam_wait_lam_us(cam_ctx *ctx, int timeout_us);
+int cam_set_exclusive(cam_ctx *ctx, int exclusive);
+int cam_set_priority(cam_ctx *ctx, int priority);
+int cam_get_statistics(cam_ctx *ctx, unsigned long long *transaction_count, unsigned long long *wait_ns, unsigned long long *max_wait_ns);
+int cam_get_tuning(cam_ctx *ctx, int *latency_timer_ms, int *in_transfer_size, int *pipeline_depth, int *timeout_ms);
+int cam_set_tuning(cam_ctx *ctx, int latency_timer_ms, int in_transfer_size, int pipeline_depth, int timeout_ms);
+
+/* Classic API, on one default context */
 int COPEN(void);
+int COPENN(int device_index);
+int COPENT(const char *transport_name);
 int CCLOSE(void);
 int CSETCR(int crate_number);
 int CGENZ(void);
@@ -19,9 +56,30 @@ int CGENC(void);
 int CSETI(void);
 int CREMI(void);
 int CAMAC(int naf, int *data, int *q, int *x);
+int CAMACC(int crate_number, int naf, int *data, int *q, int *x);
+int CDREG(int *ext, int b, int c, int n, int a);
+int CFSA(int f, int ext, int *data, int *q);
+int CSSA(int f, int ext, int *data, int *q);
+int CAMACLIST(int number_of_commands, const int *naf, int *data, int *q, int *x);
+int CFUBC(int naf, int *data, int *count);
+int CFUBR(int naf, int *data, int *count);
+int CFUBA(int naf, int *data, int *count);
+int CBINDSTREAM(int crate_number, int naf, int format);
+int CFILENO(void);
+int CSTARTREADOUT(int crate_number, int lam_mask, int number_of_commands, int *naf, int *data, int ring_size);
+int CSTOPREADOUT(void);
+int CREADEVENT(int *lam_pattern, int *data, int *q, int *x, int *number_of_words);
+int CREADLAM(int *lam);
 int CELAM(int mask);
 int CDLAM(void);
 int CWLAM(int timeout);
+int CWLAMUS(int timeout_us);
+int CSETLAMPOLL(int strategy, int interval_us, int spin_budget_us);
+int CSETEXCL(int exclusive);
+int CSETPRIO(int priority);
+int CGETSTAT(unsigned long long *transaction_count, unsigned long long *wait_ns, unsigned long long *max_wait_ns);
+int CGETTUNE(int *latency_timer_ms, int *in_transfer_size, int *pipeline_depth, int *timeout_ms);
+int CSETTUNE(int latency_timer_ms, int in_transfer_size, int pipeline_depth, int timeout_ms);
 
 #ifdef __cplusplus
 }
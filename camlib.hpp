@@ -0,0 +1,161 @@
+/* camlib.hpp */
+/* Created on 16 October 2026. */
+
+/* Header-only C++17 layer over the camlib context API.                    */
+/* Station, sub-address and function are template parameters checked at   */
+/* compile time, and the NAF codes of a fixed readout list are encoded at  */
+/* compile time; cam_list() still fills the ioctl() command list from    */
+/* them and the data words on each execute():                              */
+/*                                                                         */
+/*   using Adc = camlib::Read<3, 0, 0>;                                    */
+/*   using Event = camlib::Sequence<Adc, camlib::Read<3, 1, 0>,            */
+/*                                  camlib::Control<3, 0, 10>>;            */
+/*   camlib::Crate crate(1);                                               */
+/*   Event::Frame frame;                                                   */
+/*   crate.execute(frame);  // one CAMAC_LIST; frame.data[0], frame.q[0].. */
+/*                                                                         */
+/* Errors are returned as errno, as the C API; no exceptions are thrown.   */
+
+
+#ifndef __CAMLIB_HPP_INCLUDED
+#define __CAMLIB_HPP_INCLUDED 1
+
+
+#include <array>
+#include <cstddef>
+#include <cerrno>
+#include "camlib.h"
+
+
+namespace camlib {
+
+/* the range check of the driver's ccp_camac_action() */
+constexpr bool is_valid_naf(unsigned n, unsigned a, unsigned f)
+{
+    return (n > 0) && (n < 24) && (a < 16) && (f < 32);
+}
+
+constexpr bool is_read(unsigned f) { return f < 8; }
+constexpr bool is_write(unsigned f) { return (f >= 16) && (f < 24); }
+constexpr bool is_control(unsigned f) { return ((f >= 8) && (f < 16)) || ((f >= 24) && (f < 32)); }
+
+/* not constexpr: reaching it in a constant expression is a compile error */
+inline int invalid_naf() { return -1; }
+
+/* encodes as the NAF() macro; an invalid NAF fails to compile as a     */
+/* constant expression, and is -1 when the arguments are run-time values */
+constexpr int encode_naf(unsigned n, unsigned a, unsigned f)
+{
+    return is_valid_naf(n, a, f) ? NAF(int(n), int(a), int(f)) : invalid_naf();
+}
+
+
+template<unsigned N, unsigned A, unsigned F>
+struct Naf {
+    static_assert((N > 0) && (N < 24), "CAMAC station must be 1-23");
+    static_assert(A < 16, "CAMAC sub-address must be 0-15");
+    static_assert(F < 32, "CAMAC function must be 0-31");
+
+    static constexpr unsigned n = N, a = A, f = F;
+    static constexpr int code = NAF(int(N), int(A), int(F));
+};
+
+/* F0-F7: data are read into the data word */
+template<unsigned N, unsigned A, unsigned F = 0>
+struct Read: Naf<N, A, F> {
+    static_assert(is_read(F), "Read<> takes F0-F7");
+};
+
+/* F16-F23: the data word is written */
+template<unsigned N, unsigned A, unsigned F = 16>
+struct Write: Naf<N, A, F> {
+    static_assert(is_write(F), "Write<> takes F16-F23");
+};
+
+/* F8-F15, F24-F31: no data */
+template<unsigned N, unsigned A, unsigned F>
+struct Control: Naf<N, A, F> {
+    static_assert(is_control(F), "Control<> takes F8-F15 or F24-F31");
+};
+
+
+/* a fixed list of operations, executed in one CAMAC_LIST ioctl() per 256 commands */
+template<class... Operations>
+struct Sequence {
+    static constexpr std::size_t size = sizeof...(Operations);
+    static_assert(size > 0, "empty Sequence<>");
+
+    static constexpr std::array<int, size> naf = { Operations::code... };
+
+    /* data are inputs of Write<> and outputs of Read<>; q and x are outputs */
+    struct Frame {
+        using sequence = Sequence;
+        std::array<int, size> data {};
+        std::array<int, size> q {};
+        std::array<int, size> x {};
+    };
+
+    static int execute(cam_ctx *ctx, Frame &frame)
+    {
+        return cam_list(ctx, int(size), naf.data(), frame.data.data(), frame.q.data(), frame.x.data());
+    }
+};
+
+
+/* owns a context; not copyable, as the context is not */
+class Crate {
+  public:
+    explicit Crate(int crate_number, const char *path = nullptr): ctx(cam_open(path)), status(0) {
+        if (! ctx) {
+            status = errno;
+        }
+        else if ((status = cam_set_crate(ctx, crate_number)) != 0) {
+            cam_close(ctx);
+            ctx = nullptr;
+        }
+    }
+    ~Crate() {
+        if (ctx) {
+            cam_close(ctx);
+        }
+    }
+    Crate(const Crate &) = delete;
+    Crate &operator=(const Crate &) = delete;
+
+    /* 0, or errno of the open */
+    int error() const { return status; }
+    cam_ctx *context() const { return ctx; }
+
+    template<unsigned N, unsigned A, unsigned F>
+    int execute(Read<N, A, F>, int &data, int &q, int &x) {
+        return cam_naf(ctx, Read<N, A, F>::code, &data, &q, &x);
+    }
+    template<unsigned N, unsigned A, unsigned F>
+    int execute(Write<N, A, F>, int data, int &q, int &x) {
+        return cam_naf(ctx, Write<N, A, F>::code, &data, &q, &x);
+    }
+    template<unsigned N, unsigned A, unsigned F>
+    int execute(Control<N, A, F>, int &q, int &x) {
+        int data = 0;
+        return cam_naf(ctx, Control<N, A, F>::code, &data, &q, &x);
+    }
+    template<class Frame>
+    int execute(Frame &frame) {
+        return Frame::sequence::execute(ctx, frame);
+    }
+
+    int initialize() { return cam_initialize(ctx); }
+    int clear() { return cam_clear(ctx); }
+    int enable_lam(int mask) { return cam_enable_lam(ctx, mask); }
+    int disable_lam() { return cam_disable_lam(ctx); }
+    int wait_lam_us(int timeout_us) { return cam_wait_lam_us(ctx, timeout_us); }
+
+  private:
+    cam_ctx *ctx;
+    int status;
+};
+
+}
+
+
+#endif
@@ -4,7 +4,7 @@
 DEVICE_FILE = "/dev/camdrv"
 
 
-import os, fcntl, struct, errno
+import os, fcntl, struct, errno, mmap, array
 
 _IOC_NONE = 0
 _IOC_READ = 2
@@ -33,6 +33,44 @@ def _IOWR(type, nr, size):
 
 _IOC_SIZE_UINT2 = 8
 
+CAMDRV_MAX_COMMANDS = 256
+_IOC_SIZE_COMMAND_LIST = 4 + 12 * CAMDRV_MAX_COMMANDS
+_IOC_SIZE_BLOCK_TRANSFER = 12
+_IOC_SIZE_STREAM = 12
+_IOC_SIZE_READOUT = 16 + 12 * CAMDRV_MAX_COMMANDS
+_IOC_SIZE_LAM_POLLING = 12
+_IOC_SIZE_ACTION = 40
+_IOC_SIZE_FILE_STATISTICS = 24
+_IOC_SIZE_TUNING = 16
+
+CAMDRV_ACTION_VERSION = 1
+CAMDRV_ACTION_TIMESTAMP = 0x0001
+
+CAMDRV_BLOCK_QSTOP = 1
+CAMDRV_BLOCK_QREPEAT = 2
+CAMDRV_BLOCK_ADDRESS_SCAN = 3
+CAMDRV_BLOCK_PIPELINED = 0x0100
+
+CAMDRV_FORMAT_24BIT = 24
+CAMDRV_FORMAT_32BIT = 32
+
+CAMDRV_RING_DEFAULT_SIZE = 1 << 20
+CAMDRV_RING_DATA_OFFSET = 4096
+CAMDRV_EVENT_PADDING = 0x0001
+_EVENT_HEADER_SIZE = 32
+
+CAMDRV_LAM_POLL_SLEEP = 0
+CAMDRV_LAM_POLL_BUSY = 1
+CAMDRV_LAM_POLL_HYBRID = 2
+CAMDRV_LAM_POLL_HRTIMER = 3
+CAMDRV_LAM_POLL_ADAPTIVE = 4
+
+CAMDRV_PRIORITY_LOW = 0
+CAMDRV_PRIORITY_NORMAL = 1
+CAMDRV_PRIORITY_HIGH = 2
+
+CAMDRV_LAM_MASK_ALL = 0x007fffff
+
 CAMDRV_IOC_MAGIC = 0xCC
 CAMDRV_IOC_INITIALIZE = _IO(CAMDRV_IOC_MAGIC, 1)
 CAMDRV_IOC_CLEAR = _IO(CAMDRV_IOC_MAGIC, 2)
@@ -44,9 +82,27 @@ CAMDRV_IOC_CAMAC_ACTION = _IOWR(CAMDRV_IOC_MAGIC, 7, _IOC_SIZE_UINT2)
 CAMDRV_IOC_READ_LAM = _IOR(CAMDRV_IOC_MAGIC, 8, _IOC_SIZE_UINT2)
 CAMDRV_IOC_WAIT_LAM = _IOWR(CAMDRV_IOC_MAGIC, 9, _IOC_SIZE_UINT2)
 CAMDRV_IOC_SET_CRATE = _IOW(CAMDRV_IOC_MAGIC, 10, _IOC_SIZE_UINT2)
+CAMDRV_IOC_CAMAC_LIST = _IOWR(CAMDRV_IOC_MAGIC, 11, _IOC_SIZE_COMMAND_LIST)
+CAMDRV_IOC_SET_BLOCK_TRANSFER = _IOW(CAMDRV_IOC_MAGIC, 12, _IOC_SIZE_BLOCK_TRANSFER)
+CAMDRV_IOC_SET_STREAM = _IOW(CAMDRV_IOC_MAGIC, 13, _IOC_SIZE_STREAM)
+CAMDRV_IOC_START_READOUT = _IOW(CAMDRV_IOC_MAGIC, 14, _IOC_SIZE_READOUT)
+CAMDRV_IOC_STOP_READOUT = _IO(CAMDRV_IOC_MAGIC, 15)
+CAMDRV_IOC_SET_LAM_POLLING = _IOW(CAMDRV_IOC_MAGIC, 16, _IOC_SIZE_LAM_POLLING)
+CAMDRV_IOC_WAIT_LAM_US = _IOWR(CAMDRV_IOC_MAGIC, 17, _IOC_SIZE_UINT2)
+CAMDRV_IOC_CAMAC_ACTION_EX = _IOWR(CAMDRV_IOC_MAGIC, 18, _IOC_SIZE_ACTION)
+CAMDRV_IOC_SET_EXCLUSIVE = _IOW(CAMDRV_IOC_MAGIC, 19, _IOC_SIZE_UINT2)
+CAMDRV_IOC_SET_PRIORITY = _IOW(CAMDRV_IOC_MAGIC, 20, _IOC_SIZE_UINT2)
+CAMDRV_IOC_GET_STATISTICS = _IOR(CAMDRV_IOC_MAGIC, 21, _IOC_SIZE_FILE_STATISTICS)
+CAMDRV_IOC_SET_LAM_MASK = _IOW(CAMDRV_IOC_MAGIC, 22, _IOC_SIZE_UINT2)
+CAMDRV_IOC_GET_TUNING = _IOR(CAMDRV_IOC_MAGIC, 23, _IOC_SIZE_TUNING)
+CAMDRV_IOC_SET_TUNING = _IOW(CAMDRV_IOC_MAGIC, 24, _IOC_SIZE_TUNING)
 
 
 _device_descriptor = None
+_ring = None
+
+# reused by CAMACBATCH(): the command list as 32-bit words, (naf, data, status) from index 1
+_batch_buffer = array.array('I', bytes(_IOC_SIZE_COMMAND_LIST))
 
 
 def COPEN():
@@ -58,8 +114,21 @@ def COPEN():
         return e.errno
 
 
-def CCLOSE():
+def COPENN(device_index):
+    """open /dev/camdrvN, for the N-th controller"""
     global _device_descriptor
+    try:
+        _device_descriptor = os.open(DEVICE_FILE + str(device_index), os.O_RDWR)
+        return 0
+    except OSError as e:
+        return e.errno
+
+
+def CCLOSE():
+    global _device_descriptor, _ring
+    if _ring is not None:
+        _ring.close()
+        _ring = None
     if _device_descriptor is not None:
         try:
             os.close(_device_descriptor)
@@ -134,6 +203,320 @@ def CAMAC(n, a, f, data=0):
     return (q, x, data_out, 0)
 
 
+def CAMACC(crate_number, n, a, f, data=0):
+    """
+    execute a CAMAC action on the given crate, without CSETCR()
+    Returns:
+        (q, x, data, errno)
+    """
+    if _device_descriptor is None:
+        return (0, 0, data, errno.EBADF)
+    
+    ioctl_data = bytearray(struct.pack('=8IQ', CAMDRV_ACTION_VERSION, 0, crate_number, n, a, f, data & 0x00ffffff, 0, 0))
+    try:
+        fcntl.ioctl(_device_descriptor, CAMDRV_IOC_CAMAC_ACTION_EX, ioctl_data, True)
+    except OSError as e:
+        return (0, 0, data, e.errno)
+        
+    _, _, _, _, _, _, data_out, status, _ = struct.unpack('=8IQ', ioctl_data)
+    q = 0 if (status & 0x0001) else 1
+    x = 0 if (status & 0x0002) else 1
+
+    return (q, x, data_out & 0x00ffffff, 0)
+
+
+def CAMACLIST(commands):
+    """
+    execute a list of CAMAC actions in one driver call
+    Args:
+        commands: sequence of (n, a, f) or (n, a, f, data)
+    Returns:
+        ([(q, x, data), ...], errno)
+    """
+    if _device_descriptor is None:
+        return ([], errno.EBADF)
+
+    results = []
+    for offset in range(0, len(commands), CAMDRV_MAX_COMMANDS):
+        chunk = commands[offset:offset+CAMDRV_MAX_COMMANDS]
+        ioctl_data = bytearray(struct.pack('=I', len(chunk)))
+        for command in chunk:
+            n, a, f = command[0:3]
+            data = command[3] if len(command) > 3 else 0
+            naf = ((n << 9) | (a << 5) | f) & 0x3fff
+            ioctl_data += struct.pack('=III', naf, data & 0x00ffffff, 0)
+        try:
+            fcntl.ioctl(_device_descriptor, CAMDRV_IOC_CAMAC_LIST, ioctl_data, True)
+        except OSError as e:
+            return (results, e.errno)
+
+        for i in range(len(chunk)):
+            _, data_out, status = struct.unpack_from('=III', ioctl_data, 4 + 12 * i)
+            q = 0 if (status & 0x0001) else 1
+            x = 0 if (status & 0x0002) else 1
+            results.append((q, x, data_out & 0x00ffffff))
+
+    return (results, 0)
+
+
+def _is_numpy(value):
+    return hasattr(value, '__array_interface__')
+
+
+def CAMACBATCH(n, a, f, data=None):
+    """
+    execute many CAMAC actions, with one driver call per CAMDRV_MAX_COMMANDS
+    Args:
+        n, a, f: sequences or NumPy arrays of the same length; an int is repeated
+        data: sequence or NumPy array of the write data, or None
+    Returns:
+        (data, q, x, errno): array('I'), array('B'), array('B'),
+        or NumPy arrays (uint32, uint8, uint8) if any argument is a NumPy array
+    """
+    use_numpy = any(_is_numpy(value) for value in (n, a, f, data))
+    length = 1
+    for value in (n, a, f, data):
+        if (value is not None) and not isinstance(value, int):
+            length = len(value)
+            break
+
+    if use_numpy:
+        import numpy
+        words = numpy.frombuffer(_batch_buffer, dtype=numpy.uint32)
+        naf = (
+            (numpy.asarray(n, dtype=numpy.uint32) << 9) | (numpy.asarray(a, dtype=numpy.uint32) << 5) | numpy.asarray(f, dtype=numpy.uint32)
+        ) & 0x3fff
+        naf = numpy.broadcast_to(naf, (length,))
+        data_in = numpy.broadcast_to(numpy.asarray(0 if data is None else data, dtype=numpy.uint32) & 0x00ffffff, (length,))
+        data_out = numpy.zeros(length, dtype=numpy.uint32)
+        status = numpy.zeros(length, dtype=numpy.uint32)
+    else:
+        n, a, f = [ [value] * length if isinstance(value, int) else value for value in (n, a, f) ]
+        naf = array.array('I', [ ((n[i] << 9) | (a[i] << 5) | f[i]) & 0x3fff for i in range(length) ])
+        data_in = array.array('I', [0] * length if data is None else [ d & 0x00ffffff for d in data ])
+        data_out = array.array('I', bytes(4 * length))
+        status = array.array('I', bytes(4 * length))
+
+    if _device_descriptor is None:
+        error = errno.EBADF
+        length = 0
+    else:
+        error = 0
+
+    for offset in range(0, length, CAMDRV_MAX_COMMANDS):
+        count = min(CAMDRV_MAX_COMMANDS, length - offset)
+        _batch_buffer[0] = count
+        if use_numpy:
+            words[1:1+3*count:3] = naf[offset:offset+count]
+            words[2:2+3*count:3] = data_in[offset:offset+count]
+        else:
+            _batch_buffer[1:1+3*count:3] = naf[offset:offset+count]
+            _batch_buffer[2:2+3*count:3] = data_in[offset:offset+count]
+        try:
+            fcntl.ioctl(_device_descriptor, CAMDRV_IOC_CAMAC_LIST, _batch_buffer, True)
+        except OSError as e:
+            error = e.errno
+            break
+        data_out[offset:offset+count] = _batch_buffer[2:2+3*count:3] if not use_numpy else words[2:2+3*count:3]
+        status[offset:offset+count] = _batch_buffer[3:3+3*count:3] if not use_numpy else words[3:3+3*count:3]
+
+    if use_numpy:
+        q = ((status & 0x0001) == 0).astype(numpy.uint8)
+        x = ((status & 0x0002) == 0).astype(numpy.uint8)
+        return (data_out & 0x00ffffff, q, x, error)
+
+    q = array.array('B', [ (s & 0x0001) ^ 0x0001 for s in status ])
+    x = array.array('B', [ ((s & 0x0002) >> 1) ^ 0x0001 for s in status ])
+    return (array.array('I', [ d & 0x00ffffff for d in data_out ]), q, x, error)
+
+
+def _block_transfer(mode, n, a, f, max_count):
+    if _device_descriptor is None:
+        return ([], errno.EBADF)
+
+    naf = ((n << 9) | (a << 5) | f) & 0x3fff
+    ioctl_data = struct.pack('=III', mode, naf, max_count)
+    try:
+        fcntl.ioctl(_device_descriptor, CAMDRV_IOC_SET_BLOCK_TRANSFER, ioctl_data)
+        buffer = os.read(_device_descriptor, 4 * max_count)
+    except OSError as e:
+        return ([], e.errno)
+
+    count = len(buffer) // 4
+    return ([ data & 0x00ffffff for data in struct.unpack('=%dI' % count, buffer[0:4*count]) ], 0)
+
+
+def CFUBC(n, a, f, max_count):
+    """
+    block read, repeating (n, a, f) until Q=0, one cycle at a time
+    Returns:
+        ([data, ...], errno)
+    """
+    return _block_transfer(CAMDRV_BLOCK_QSTOP, n, a, f, max_count)
+
+
+def CFUBR(n, a, f, max_count):
+    """
+    block read, repeating (n, a, f) and keeping the Q=1 data until X=0
+    Returns:
+        ([data, ...], errno)
+    """
+    return _block_transfer(CAMDRV_BLOCK_QREPEAT, n, a, f, max_count)
+
+
+def CFUBA(n, a, f, max_count, pipelined=False):
+    """
+    block read, scanning the subaddresses from (n, a); Q=0 moves to the next station
+    pipelined: issue the commands ahead of the replies; the commands beyond
+        the end are still executed, so only for non-destructive reads
+    Returns:
+        ([data, ...], errno)
+    """
+    mode = CAMDRV_BLOCK_ADDRESS_SCAN | (CAMDRV_BLOCK_PIPELINED if pipelined else 0)
+    return _block_transfer(mode, n, a, f, max_count)
+
+
+def CBINDSTREAM(crate_number, n, a, f, format=CAMDRV_FORMAT_24BIT):
+    """
+    bind os.read() (F=0-7) or os.write() (F=16-23) on CFILENO() to one NAF
+    Returns:
+        errno
+    """
+    if _device_descriptor is None:
+        return errno.EBADF
+
+    naf = ((n << 9) | (a << 5) | f) & 0x3fff
+    ioctl_data = struct.pack('=III', crate_number, naf, format)
+    try:
+        fcntl.ioctl(_device_descriptor, CAMDRV_IOC_SET_STREAM, ioctl_data)
+    except OSError as e:
+        return e.errno
+
+    return 0
+
+
+def CFILENO():
+    return _device_descriptor
+
+
+def CSTARTREADOUT(crate_number, lam_mask, commands, ring_size=0):
+    """
+    let the driver run a readout list on every LAM in lam_mask
+    Args:
+        commands: sequence of (n, a, f) or (n, a, f, data)
+    Returns:
+        errno
+    """
+    global _ring
+    if _device_descriptor is None:
+        return errno.EBADF
+    if len(commands) == 0 or len(commands) > CAMDRV_MAX_COMMANDS:
+        return errno.EINVAL
+
+    ioctl_data = bytearray(_IOC_SIZE_READOUT)
+    struct.pack_into('=IIII', ioctl_data, 0, crate_number, lam_mask, ring_size, len(commands))
+    for i, command in enumerate(commands):
+        n, a, f = command[0:3]
+        data = command[3] if len(command) > 3 else 0
+        naf = ((n << 9) | (a << 5) | f) & 0x3fff
+        struct.pack_into('=III', ioctl_data, 16 + 12 * i, naf, data & 0x00ffffff, 0)
+    try:
+        fcntl.ioctl(_device_descriptor, CAMDRV_IOC_START_READOUT, bytes(ioctl_data))
+    except OSError as e:
+        return e.errno
+
+    map_size = CAMDRV_RING_DATA_OFFSET + (ring_size if ring_size > 0 else CAMDRV_RING_DEFAULT_SIZE)
+    if _ring is not None and len(_ring) != map_size:
+        _ring.close()
+        _ring = None
+    if _ring is None:
+        try:
+            _ring = mmap.mmap(_device_descriptor, map_size, mmap.MAP_SHARED, mmap.PROT_READ | mmap.PROT_WRITE)
+        except OSError as e:
+            return e.errno
+
+    return 0
+
+
+def CSTOPREADOUT():
+    if _device_descriptor is None:
+        return errno.EBADF
+    try:
+        fcntl.ioctl(_device_descriptor, CAMDRV_IOC_STOP_READOUT)
+    except OSError as e:
+        return e.errno
+    return 0
+
+
+def CREADEVENT():
+    """
+    take the oldest event out of the ring
+    Returns:
+        ((lam_pattern, [(q, x, data), ...]), errno); errno is EAGAIN if the ring is empty
+    """
+    if _ring is None:
+        return (None, errno.EINVAL)
+
+    while True:
+        head, tail, size = struct.unpack_from('=III', _ring, 0)
+        if head == tail:
+            return (None, errno.EAGAIN)
+        offset = tail & (size - 1)
+        if size - offset < _EVENT_HEADER_SIZE:
+            struct.pack_into('=I', _ring, 4, (tail + size - offset) & 0xffffffff)
+            continue
+        base = CAMDRV_RING_DATA_OFFSET + offset
+        event_size, flags, _, lam_pattern, _, _, number_of_words, _ = struct.unpack_from('=8I', _ring, base)
+        if flags & CAMDRV_EVENT_PADDING:
+            struct.pack_into('=I', _ring, 4, (tail + event_size) & 0xffffffff)
+            continue
+        break
+
+    words = struct.unpack_from('=%dI' % number_of_words, _ring, base + _EVENT_HEADER_SIZE)
+    results = [ (0 if (w & 0x01000000) else 1, 0 if (w & 0x02000000) else 1, w & 0x00ffffff) for w in words ]
+    struct.pack_into('=I', _ring, 4, (tail + event_size) & 0xffffffff)
+
+    return ((lam_pattern, results), 0)
+
+
+def CREADLAM():
+    """LAMs of the stations in the CELAM() mask, bit N-1 for station N; returns (lam, errno)"""
+    
+    if _device_descriptor is None:
+        return (0, errno.EBADF)
+    
+    try:
+        ioctl_data = bytearray(struct.pack('=II', 0, 0))
+        fcntl.ioctl(_device_descriptor, CAMDRV_IOC_READ_LAM, ioctl_data, True)
+    except OSError as e:
+        return (0, e.errno)
+
+    return (struct.unpack('=II', ioctl_data)[1], 0)
+
+
+def CELAM(mask=CAMDRV_LAM_MASK_ALL):
+    """Start the LAM polling in the driver; poll() on CFILENO(), CREADLAM() and CWLAM() then report the LAMs in mask"""
+    
+    if _device_descriptor is None:
+        return errno.EBADF
+    try:
+        fcntl.ioctl(_device_descriptor, CAMDRV_IOC_SET_LAM_MASK, struct.pack('=II', mask & CAMDRV_LAM_MASK_ALL, 0))
+        fcntl.ioctl(_device_descriptor, CAMDRV_IOC_ENABLE_INTERRUPT)
+    except OSError as e:
+        return e.errno
+    return 0
+
+
+def CDLAM():
+    if _device_descriptor is None:
+        return errno.EBADF
+    try:
+        fcntl.ioctl(_device_descriptor, CAMDRV_IOC_DISABLE_INTERRUPT)
+    except OSError as e:
+        return e.errno
+    return 0
+
+
 def CWLAM(timeout):
     """Wait for a LAM"""
     
@@ -147,3 +530,99 @@ def CWLAM(timeout):
         return e.errno
 
     return 0 if result > 0 else errno.ETIMEDOUT
+
+
+def CWLAMUS(timeout_us):
+    """Wait for a LAM, with the timeout in microseconds"""
+    
+    if _device_descriptor is None:
+        return errno.EBADF
+    
+    try:
+        ioctl_data = bytearray(struct.pack('=II', timeout_us, 0))
+        result = fcntl.ioctl(_device_descriptor, CAMDRV_IOC_WAIT_LAM_US, ioctl_data, True)
+    except OSError as e:
+        return e.errno
+
+    return 0 if result > 0 else errno.ETIMEDOUT
+
+
+def CSETLAMPOLL(strategy, interval_us=2000, spin_budget_us=0):
+    """Select the LAM polling strategy (CAMDRV_LAM_POLL_*); spin_budget_us is at most 5000"""
+    
+    if _device_descriptor is None:
+        return errno.EBADF
+    try:
+        fcntl.ioctl(_device_descriptor, CAMDRV_IOC_SET_LAM_POLLING, struct.pack('=III', strategy, interval_us, spin_budget_us))
+    except OSError as e:
+        return e.errno
+    return 0
+
+
+def CSETEXCL(exclusive):
+    """While set, the other processes sharing the controller get EBUSY"""
+    
+    if _device_descriptor is None:
+        return errno.EBADF
+    try:
+        fcntl.ioctl(_device_descriptor, CAMDRV_IOC_SET_EXCLUSIVE, struct.pack('=II', 1 if exclusive else 0, 0))
+    except OSError as e:
+        return e.errno
+    return 0
+
+
+def CSETPRIO(priority):
+    """Arbitration priority (CAMDRV_PRIORITY_*) of this process on a shared controller"""
+    
+    if _device_descriptor is None:
+        return errno.EBADF
+    try:
+        fcntl.ioctl(_device_descriptor, CAMDRV_IOC_SET_PRIORITY, struct.pack('=II', priority, 0))
+    except OSError as e:
+        return e.errno
+    return 0
+
+
+def CGETSTAT():
+    """
+    Returns:
+        (transaction_count, wait_ns, max_wait_ns, errno)
+    """
+    if _device_descriptor is None:
+        return (0, 0, 0, errno.EBADF)
+    try:
+        ioctl_data = bytearray(_IOC_SIZE_FILE_STATISTICS)
+        fcntl.ioctl(_device_descriptor, CAMDRV_IOC_GET_STATISTICS, ioctl_data, True)
+    except OSError as e:
+        return (0, 0, 0, e.errno)
+
+    return struct.unpack('=QQQ', ioctl_data) + (0,)
+
+
+def CGETTUNE():
+    """
+    Returns:
+        (latency_timer_ms, in_transfer_size, pipeline_depth, timeout_ms, errno)
+    """
+    if _device_descriptor is None:
+        return (0, 0, 0, 0, errno.EBADF)
+    try:
+        ioctl_data = bytearray(_IOC_SIZE_TUNING)
+        fcntl.ioctl(_device_descriptor, CAMDRV_IOC_GET_TUNING, ioctl_data, True)
+    except OSError as e:
+        return (0, 0, 0, 0, e.errno)
+
+    return struct.unpack('=IIII', ioctl_data) + (0,)
+
+
+def CSETTUNE(latency_timer_ms, in_transfer_size, pipeline_depth, timeout_ms=500):
+    """
+    the parameters are shared by all the processes on the controller: EBUSY unless alone or exclusive
+    """
+    if _device_descriptor is None:
+        return errno.EBADF
+    try:
+        fcntl.ioctl(_device_descriptor, CAMDRV_IOC_SET_TUNING, struct.pack('=IIII', latency_timer_ms, in_transfer_size, pipeline_depth, timeout_ms))
+    except OSError as e:
+        return e.errno
+    return 0
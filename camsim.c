@@ -0,0 +1,584 @@
+/* camsim.c */
+/* Created on 16 October 2026. */
+
+/* A CAMAC crate simulated in the process, behind the driver ioctl()/read() */
+/* interface, for developing and testing camlib programs without hardware.  */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include "camdrv.h"
+#include "camtransport.h"
+#include "camcrate.h"
+
+
+#define SIM_DESCRIPTOR 0x5000
+#define SIM_MAX_FILES 16
+#define SIM_BLOCK_QREPEAT_LIMIT 1000  /* as BLOCK_QREPEAT_LIMIT in the driver */
+
+#define statNOQ 0x01
+#define statNOX 0x02
+
+/* the modules are those of the emulator, in camcrate.c */
+static struct camcrate crates[CAMCRATE_NUMBER_OF_CRATES];
+static unsigned cycle_ns = 1000, latency_us = 0;
+static double noq_rate = 0;
+
+/* kept for GET_TUNING only: the simulated timing does not follow it */
+static struct camdrv_tuning tuning = { 2, 512, 4, 500 };
+
+/* Each open() is a file of its own, sharing the crates, as with the driver; */
+/* the crates are accessed by one call at a time.                            */
+struct sim_file {
+    int is_open;
+    unsigned crate_number;
+    struct camdrv_block_transfer block_transfer;
+    struct camdrv_stream stream;
+    struct camdrv_file_statistics statistics;
+    unsigned lam_mask;
+};
+
+static struct sim_file files[SIM_MAX_FILES];
+static int open_count = 0;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void sleep_until(double deadline)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t) deadline;
+    ts.tv_nsec = (long) ((deadline - ts.tv_sec) * 1e9);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+        ;
+    }
+}
+
+/* a dataway cycle; too short to sleep, so it spins */
+static void spin_cycle(void)
+{
+    double deadline;
+
+    if (cycle_ns == 0) {
+        return;
+    }
+    deadline = camcrate_now() + 1e-9 * cycle_ns;
+    while (camcrate_now() < deadline) {
+        ;
+    }
+}
+
+/* the round trip to the controller, once per call */
+static void transaction(struct sim_file *file)
+{
+    file->statistics.transaction_count++;
+    if (latency_us > 0) {
+        sleep_until(camcrate_now() + 1e-6 * latency_us);
+    }
+}
+
+
+
+/**** Crate ****/
+
+/* returns the status as the driver does (bit0: No-Q, bit1: No-X) */
+static unsigned crate_camac(struct camcrate *crate, unsigned n, unsigned a, unsigned f, unsigned *data)
+{
+    int q, x;
+
+    spin_cycle();
+    camcrate_camac(crate, n, a, f, data, &q, &x);
+    if ((noq_rate > 0) && (drand48() < noq_rate)) {
+        q = 0;
+    }
+
+    return (q ? 0 : statNOQ) | (x ? 0 : statNOX);
+}
+
+/* as READ_LAM of the driver: the LAMs of the stations in the mask */
+static unsigned crate_read_lam(struct camcrate *crate, unsigned mask)
+{
+    return camcrate_lam_pattern(crate) & mask;
+}
+
+/* crate 1: memory at N1, scaler at N2, adc with a 1 kHz LAM at N3, 100 Hz LAM generator at N4 */
+static void default_config(void)
+{
+    struct camcrate *crate = &crates[1];
+
+    crate->modules[1].type = camcrateMEMORY;
+    crate->modules[2].type = camcrateSCALER;
+    crate->modules[2].rate = 1000;
+    crate->modules[3].type = camcrateADC;
+    crate->modules[3].channels = 8;
+    crate->modules[3].period_us = 1000;
+    crate->modules[4].type = camcrateLAMGEN;
+    crate->modules[4].period_us = 10000;
+}
+
+
+
+/**** Driver interface ****/
+
+static struct sim_file *get_file(int fd)
+{
+    int index = fd - SIM_DESCRIPTOR;
+
+    if ((index < 0) || (index >= SIM_MAX_FILES) || ! files[index].is_open) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    return &files[index];
+}
+
+/* the crates are set up at the first open, from the environment */
+static int setup_crates(void)
+{
+    struct camcrate_settings settings = { 0 };
+    const char *config, *value;
+
+    camcrate_free(crates);
+    settings.cycle_ns = 1000;
+    config = getenv("CAMLIB_SIM_CONFIG");
+    if (config && config[0]) {
+        if (camcrate_load_config(crates, &settings, config) < 0) {
+            camcrate_free(crates);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    else {
+        default_config();
+    }
+    /* the jitter, drop and garble lines are of the emulator frames */
+    cycle_ns = settings.cycle_ns;
+    latency_us = settings.latency_us;
+    noq_rate = settings.noq_rate;
+    if ((value = getenv("CAMLIB_SIM_CYCLE_NS"))) {
+        cycle_ns = strtoul(value, NULL, 0);
+    }
+    if ((value = getenv("CAMLIB_SIM_LATENCY_US"))) {
+        latency_us = strtoul(value, NULL, 0);
+    }
+    if (camcrate_init(crates) < 0) {
+        camcrate_free(crates);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int sim_open(const char *path, int flags)
+{
+    int index;
+
+    pthread_mutex_lock(&mutex);
+    for (index = 0; (index < SIM_MAX_FILES) && files[index].is_open; index++) {
+        ;
+    }
+    if (index == SIM_MAX_FILES) {
+        pthread_mutex_unlock(&mutex);
+        errno = EMFILE;
+        return -1;
+    }
+    if ((open_count == 0) && (setup_crates() < 0)) {
+        pthread_mutex_unlock(&mutex);
+        return -1;
+    }
+
+    memset(&files[index], 0, sizeof(struct sim_file));
+    files[index].is_open = 1;
+    files[index].crate_number = 1;
+    files[index].lam_mask = CAMDRV_LAM_MASK_ALL;
+    open_count++;
+    pthread_mutex_unlock(&mutex);
+
+    return SIM_DESCRIPTOR + index;
+}
+
+static int sim_close(int fd)
+{
+    struct sim_file *file;
+
+    pthread_mutex_lock(&mutex);
+    if (! (file = get_file(fd))) {
+        pthread_mutex_unlock(&mutex);
+        return -1;
+    }
+    file->is_open = 0;
+    if (--open_count == 0) {
+        camcrate_free(crates);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    return 0;
+}
+
+/* as WAIT_LAM of the driver: the LAM data (> 0), or ETIMEDOUT; */
+/* the crates are released while sleeping                       */
+static int sim_wait_lam(struct sim_file *file, unsigned long long timeout_us, unsigned *data)
+{
+    struct camcrate *crate = &crates[file->crate_number];
+    double deadline = camcrate_now() + 1e-6 * timeout_us, next;
+
+    while ((*data = crate_read_lam(crate, file->lam_mask)) == 0) {
+        next = camcrate_next_lam_time(crate);
+        if ((next == 0) || (next > deadline)) {
+            next = deadline;
+        }
+        if (camcrate_now() >= deadline) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        pthread_mutex_unlock(&mutex);
+        sleep_until(next);
+        pthread_mutex_lock(&mutex);
+    }
+
+    return *data;
+}
+
+static int sim_ioctl_locked(struct sim_file *file, unsigned long request, void *arg)
+{
+    struct camcrate *crate = &crates[file->crate_number];
+    unsigned *ioctl_data = arg;
+    struct camdrv_command_list *command_list;
+    struct camdrv_action *action;
+    struct camdrv_tuning *new_tuning;
+    unsigned i;
+
+    switch (request) {
+      case CAMDRV_IOC_INITIALIZE:
+        camcrate_clear(crate);
+        crate->is_inhibited = 0;
+        return 0;
+      case CAMDRV_IOC_CLEAR:
+        camcrate_clear(crate);
+        return 0;
+      case CAMDRV_IOC_INHIBIT:
+      case CAMDRV_IOC_RELEASE_INHIBIT:
+        /* not supported by the CCP-USB driver either */
+        errno = EINVAL;
+        return -1;
+      case CAMDRV_IOC_ENABLE_INTERRUPT:
+      case CAMDRV_IOC_DISABLE_INTERRUPT:
+      case CAMDRV_IOC_SET_LAM_POLLING:
+      case CAMDRV_IOC_SET_EXCLUSIVE:
+        return 0;
+      case CAMDRV_IOC_SET_PRIORITY:
+        if (ioctl_data[0] > CAMDRV_PRIORITY_HIGH) {
+            errno = EINVAL;
+            return -1;
+        }
+        return 0;
+      case CAMDRV_IOC_CAMAC_ACTION:
+        return crate_camac(
+            crate, (ioctl_data[0] >> 9) & 0x1f, (ioctl_data[0] >> 5) & 0x0f, ioctl_data[0] & 0x1f, &ioctl_data[1]
+        );
+      case CAMDRV_IOC_CAMAC_ACTION_EX:
+        action = arg;
+        if ((action->version == 0) || (action->version > CAMDRV_ACTION_VERSION) || (action->crate >= CAMCRATE_NUMBER_OF_CRATES)) {
+            errno = EINVAL;
+            return -1;
+        }
+        action->status = crate_camac(&crates[action->crate], action->n, action->a, action->f, &action->data);
+        action->timestamp_ns = (action->flags & CAMDRV_ACTION_TIMESTAMP) ? (unsigned long long) (1e9 * camcrate_now()) : 0;
+        return action->status;
+      case CAMDRV_IOC_CAMAC_LIST:
+        command_list = arg;
+        if (command_list->number_of_commands > CAMDRV_MAX_COMMANDS) {
+            errno = EINVAL;
+            return -1;
+        }
+        for (i = 0; i < command_list->number_of_commands; i++) {
+            struct camdrv_command *command = &command_list->commands[i];
+            command->status = crate_camac(
+                crate, (command->naf >> 9) & 0x1f, (command->naf >> 5) & 0x0f, command->naf & 0x1f, &command->data
+            );
+        }
+        return 0;
+      case CAMDRV_IOC_READ_LAM:
+        ioctl_data[1] = crate_read_lam(crate, file->lam_mask);
+        return 0;
+      case CAMDRV_IOC_WAIT_LAM:
+        return sim_wait_lam(file, 1000000ull * ioctl_data[0], &ioctl_data[1]);
+      case CAMDRV_IOC_WAIT_LAM_US:
+        return sim_wait_lam(file, ioctl_data[0], &ioctl_data[1]);
+      case CAMDRV_IOC_SET_LAM_MASK:
+        file->lam_mask = ioctl_data[0] & CAMDRV_LAM_MASK_ALL;
+        return 0;
+      case CAMDRV_IOC_SET_CRATE:
+        if (ioctl_data[0] >= CAMCRATE_NUMBER_OF_CRATES) {
+            errno = EINVAL;
+            return -1;
+        }
+        file->crate_number = ioctl_data[0];
+        return 0;
+      case CAMDRV_IOC_SET_BLOCK_TRANSFER:
+        file->block_transfer = *(struct camdrv_block_transfer *) arg;
+        switch (file->block_transfer.mode & CAMDRV_BLOCK_MODE_MASK) {
+          case 0:
+          case CAMDRV_BLOCK_QSTOP:
+          case CAMDRV_BLOCK_QREPEAT:
+          case CAMDRV_BLOCK_ADDRESS_SCAN:
+            return 0;
+        }
+        file->block_transfer.mode = 0;
+        errno = EINVAL;
+        return -1;
+      case CAMDRV_IOC_SET_STREAM:
+        file->stream = *(struct camdrv_stream *) arg;
+        if (
+            ((file->stream.format != 0) && (file->stream.format != CAMDRV_FORMAT_24BIT) && (file->stream.format != CAMDRV_FORMAT_32BIT)) ||
+            (file->stream.crate >= CAMCRATE_NUMBER_OF_CRATES)
+        ){
+            file->stream.format = 0;
+            errno = EINVAL;
+            return -1;
+        }
+        return 0;
+      case CAMDRV_IOC_GET_STATISTICS:
+        *(struct camdrv_file_statistics *) arg = file->statistics;
+        return 0;
+      case CAMDRV_IOC_GET_TUNING:
+        *(struct camdrv_tuning *) arg = tuning;
+        return 0;
+      case CAMDRV_IOC_SET_TUNING:
+        new_tuning = arg;
+        if (
+            (new_tuning->latency_timer_ms < 1) || (new_tuning->latency_timer_ms > 255) ||
+            (new_tuning->in_transfer_size < 512) || (new_tuning->in_transfer_size > CAMDRV_MAX_IN_TRANSFER_SIZE) || (new_tuning->in_transfer_size % 512) ||
+            (new_tuning->pipeline_depth < 1) || (new_tuning->pipeline_depth > 16) ||
+            (new_tuning->timeout_ms < 10) || (new_tuning->timeout_ms > 60000)
+        ){
+            errno = EINVAL;
+            return -1;
+        }
+        tuning = *new_tuning;
+        return 0;
+      case CAMDRV_IOC_START_READOUT:
+      case CAMDRV_IOC_STOP_READOUT:
+        /* the readout thread and its ring buffer are only in the driver */
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+static int sim_ioctl(int fd, unsigned long request, void *arg)
+{
+    struct sim_file *file;
+    int result;
+
+    pthread_mutex_lock(&mutex);
+    if (! (file = get_file(fd))) {
+        pthread_mutex_unlock(&mutex);
+        return -1;
+    }
+    if (_IOC_TYPE(request) != CAMDRV_IOC_MAGIC) {
+        pthread_mutex_unlock(&mutex);
+        errno = EINVAL;
+        return -1;
+    }
+    transaction(file);
+    result = sim_ioctl_locked(file, request, arg);
+    pthread_mutex_unlock(&mutex);
+
+    return result;
+}
+
+static ssize_t sim_read_block(struct sim_file *file, unsigned *words, size_t count)
+{
+    struct camcrate *crate = &crates[file->crate_number];
+    unsigned mode = file->block_transfer.mode & CAMDRV_BLOCK_MODE_MASK;
+    unsigned n = (file->block_transfer.naf >> 9) & 0x1f;
+    unsigned a = (file->block_transfer.naf >> 5) & 0x0f;
+    unsigned f = file->block_transfer.naf & 0x1f;
+    unsigned max_count = count / sizeof(unsigned), number_of_words = 0, failures = 0;
+    unsigned status, data;
+
+    if ((file->block_transfer.max_count > 0) && (file->block_transfer.max_count < max_count)) {
+        max_count = file->block_transfer.max_count;
+    }
+
+    while (number_of_words < max_count) {
+        data = 0;
+        status = crate_camac(crate, n, a, f, &data);
+        if (mode == CAMDRV_BLOCK_QSTOP) {
+            if (status != 0) {
+                break;
+            }
+            words[number_of_words++] = data;
+        }
+        else if (mode == CAMDRV_BLOCK_QREPEAT) {
+            if (status & statNOX) {
+                break;
+            }
+            if (! (status & statNOQ)) {
+                words[number_of_words++] = data;
+                failures = 0;
+            }
+            else if (++failures >= SIM_BLOCK_QREPEAT_LIMIT) {
+                break;
+            }
+        }
+        else {
+            if (status & statNOX) {
+                break;
+            }
+            if (! (status & statNOQ)) {
+                words[number_of_words++] = data;
+                a++;
+            }
+            if ((status & statNOQ) || (a > 15)) {
+                a = 0;
+                n++;
+            }
+            if (n >= CAMCRATE_NUMBER_OF_STATIONS) {
+                break;
+            }
+        }
+    }
+
+    return number_of_words * sizeof(unsigned);
+}
+
+/* stream words are little endian, as in the driver: 3 bytes for 24-bit, 4 for 32-bit */
+static void pack_word(unsigned char *bytes, unsigned data, unsigned word_size)
+{
+    unsigned k;
+    for (k = 0; k < word_size; k++) {
+        bytes[k] = (data >> (8 * k)) & 0xff;
+    }
+}
+
+static unsigned unpack_word(const unsigned char *bytes, unsigned word_size)
+{
+    unsigned data = 0, k;
+    for (k = 0; k < word_size; k++) {
+        data |= (unsigned) bytes[k] << (8 * k);
+    }
+    return data & 0x00ffffff;
+}
+
+static ssize_t sim_read_stream(struct sim_file *file, unsigned char *bytes, size_t count)
+{
+    struct camdrv_stream *stream = &file->stream;
+    unsigned word_size, data, status;
+    size_t total = 0;
+
+    if ((stream->format == 0) || ((stream->naf & 0x1f) >= 8)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    word_size = stream->format / 8;
+    while (count - total >= word_size) {
+        data = 0;
+        status = crate_camac(&crates[stream->crate], (stream->naf >> 9) & 0x1f, (stream->naf >> 5) & 0x0f, stream->naf & 0x1f, &data);
+        if (status & statNOX) {
+            break;
+        }
+        pack_word(bytes + total, data, word_size);
+        total += word_size;
+    }
+
+    if ((total == 0) && (count >= word_size)) {
+        errno = EIO;
+        return -1;
+    }
+    return total;
+}
+
+static ssize_t sim_read(int fd, void *buffer, size_t count)
+{
+    struct sim_file *file;
+    ssize_t result;
+
+    pthread_mutex_lock(&mutex);
+    if (! (file = get_file(fd))) {
+        pthread_mutex_unlock(&mutex);
+        return -1;
+    }
+    transaction(file);
+
+    /* a block transfer, if set, takes precedence over the stream binding */
+    if (file->block_transfer.mode != 0) {
+        result = sim_read_block(file, buffer, count);
+    }
+    else {
+        result = sim_read_stream(file, buffer, count);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    return result;
+}
+
+static ssize_t sim_write_stream(struct sim_file *file, const unsigned char *bytes, size_t count)
+{
+    struct camdrv_stream *stream = &file->stream;
+    unsigned word_size, data, status;
+    size_t total = 0;
+
+    if ((stream->format == 0) || ((stream->naf & 0x1f) < 16) || ((stream->naf & 0x1f) >= 24)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    word_size = stream->format / 8;
+    while (count - total >= word_size) {
+        data = unpack_word(bytes + total, word_size);
+        status = crate_camac(&crates[stream->crate], (stream->naf >> 9) & 0x1f, (stream->naf >> 5) & 0x0f, stream->naf & 0x1f, &data);
+        if (status & statNOX) {
+            break;
+        }
+        total += word_size;
+    }
+
+    if ((total == 0) && (count >= word_size)) {
+        errno = EIO;
+        return -1;
+    }
+    return total;
+}
+
+static ssize_t sim_write(int fd, const void *buffer, size_t count)
+{
+    struct sim_file *file;
+    ssize_t result;
+
+    pthread_mutex_lock(&mutex);
+    if (! (file = get_file(fd))) {
+        pthread_mutex_unlock(&mutex);
+        return -1;
+    }
+    transaction(file);
+    result = sim_write_stream(file, buffer, count);
+    pthread_mutex_unlock(&mutex);
+
+    return result;
+}
+
+static void *sim_mmap(void *address, size_t length, int protection, int flags, int fd, off_t offset)
+{
+    errno = ENODEV;
+    return MAP_FAILED;
+}
+
+static int sim_munmap(void *address, size_t length)
+{
+    return 0;
+}
+
+const struct camtransport camtransport_simulator = {
+    "sim", sim_open, sim_close, sim_ioctl, sim_read, sim_write, sim_mmap, sim_munmap
+};
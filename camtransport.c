@@ -0,0 +1,419 @@
+/* camtransport.c */
+/* Created on 16 October 2026. */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "camdrv.h"
+#include "camtransport.h"
+
+
+/**** Driver ****/
+
+static int driver_open(const char *path, int flags)
+{
+    return open(path, flags);
+}
+
+static int driver_ioctl(int fd, unsigned long request, void *arg)
+{
+    return ioctl(fd, request, arg);
+}
+
+static void *driver_mmap(void *address, size_t length, int protection, int flags, int fd, off_t offset)
+{
+    return mmap(address, length, protection, flags, fd, offset);
+}
+
+const struct camtransport camtransport_driver = {
+    "driver", driver_open, close, driver_ioctl, read, write, driver_mmap, munmap
+};
+
+
+/**** Record and replay ****/
+
+/* A record is a sequence of calls, each a header followed by the argument */
+/* before the call and the argument after it (size bytes each). read() and  */
+/* write() are recorded with request RECORD_READ and RECORD_WRITE.          */
+#define RECORD_READ 0x00000001ul
+#define RECORD_WRITE 0x00000002ul
+
+struct record_header {
+    unsigned long long request;
+    unsigned size;
+    int result;
+    int error;
+    unsigned reserved;
+};
+
+/* Each open has its own record stream, found by the descriptor: the driver */
+/* descriptor when recording, REPLAY_DESCRIPTOR + index when replaying.     */
+#define RECORD_MAX_FILES 16
+#define REPLAY_DESCRIPTOR 0x7e00
+
+struct record_stream {
+    int is_open;
+    int fd;
+    FILE *file;
+};
+
+static struct record_stream streams[RECORD_MAX_FILES];
+static pthread_mutex_t record_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* the record file of the next open, set by camtransport_open() */
+static pthread_mutex_t record_open_mutex = PTHREAD_MUTEX_INITIALIZER;
+static const char *record_path = NULL;
+
+/* The opens of one record:FILE (or replay:FILE) take FILE, FILE.1, FILE.2, */
+/* ... in the order they are made, so that no two opens share a file and a */
+/* replay made in the same order finds the record of each open.            */
+struct record_name {
+    char spec[256];
+    unsigned open_count;
+};
+
+static struct record_name record_names[RECORD_MAX_FILES];
+
+/* called with record_mutex held; opens the record file for a new stream */
+static struct record_stream *new_stream(const char *mode)
+{
+    int index;
+
+    for (index = 0; (index < RECORD_MAX_FILES) && streams[index].is_open; index++) {
+        ;
+    }
+    if (index == RECORD_MAX_FILES) {
+        errno = EMFILE;
+        return NULL;
+    }
+    if (! record_path || ! (streams[index].file = fopen(record_path, mode))) {
+        if (! record_path) {
+            errno = EINVAL;
+        }
+        return NULL;
+    }
+    streams[index].is_open = 1;
+    streams[index].fd = REPLAY_DESCRIPTOR + index;
+
+    return &streams[index];
+}
+
+/* called with record_mutex held */
+static struct record_stream *get_stream(int fd)
+{
+    int index;
+
+    for (index = 0; index < RECORD_MAX_FILES; index++) {
+        if (streams[index].is_open && (streams[index].fd == fd)) {
+            return &streams[index];
+        }
+    }
+    errno = EBADF;
+
+    return NULL;
+}
+
+/* called with record_mutex held */
+static void free_stream(struct record_stream *stream)
+{
+    fclose(stream->file);
+    stream->file = NULL;
+    stream->is_open = 0;
+}
+
+static void record_call(int fd, unsigned long request, const void *input, const void *output, unsigned size, int result)
+{
+    struct record_stream *stream;
+    struct record_header header;
+    int error = errno;
+
+    pthread_mutex_lock(&record_mutex);
+    if (! (stream = get_stream(fd))) {
+        pthread_mutex_unlock(&record_mutex);
+        errno = error;
+        return;
+    }
+    header.request = request;
+    header.size = size;
+    header.result = result;
+    header.error = (result < 0) ? error : 0;
+    header.reserved = 0;
+    fwrite(&header, sizeof(header), 1, stream->file);
+    if (size > 0) {
+        fwrite(input, size, 1, stream->file);
+        fwrite(output, size, 1, stream->file);
+    }
+    pthread_mutex_unlock(&record_mutex);
+    errno = error;
+}
+
+static int record_open(const char *path, int flags)
+{
+    struct record_stream *stream;
+    int fd, error;
+
+    pthread_mutex_lock(&record_mutex);
+    if (! (stream = new_stream("wb"))) {
+        pthread_mutex_unlock(&record_mutex);
+        return -1;
+    }
+    fd = open(path, flags);
+    if (fd < 0) {
+        error = errno;
+        free_stream(stream);
+        errno = error;
+    }
+    else {
+        stream->fd = fd;
+    }
+    pthread_mutex_unlock(&record_mutex);
+
+    return fd;
+}
+
+static int record_close(int fd)
+{
+    struct record_stream *stream;
+
+    pthread_mutex_lock(&record_mutex);
+    if ((stream = get_stream(fd))) {
+        free_stream(stream);
+    }
+    pthread_mutex_unlock(&record_mutex);
+
+    return close(fd);
+}
+
+static int record_ioctl(int fd, unsigned long request, void *arg)
+{
+    unsigned size = arg ? _IOC_SIZE(request) : 0;
+    void *input = NULL;
+    int result;
+
+    if (size > 0) {
+        input = malloc(size);
+        if (! input) {
+            return -1;
+        }
+        memcpy(input, arg, size);
+    }
+    result = ioctl(fd, request, arg);
+    record_call(fd, request, input, arg, size, result);
+    free(input);
+
+    return result;
+}
+
+static ssize_t record_read(int fd, void *buffer, size_t count)
+{
+    ssize_t result = read(fd, buffer, count);
+
+    /* the bytes read are kept, for the replay to return them */
+    record_call(fd, RECORD_READ, buffer, buffer, (result > 0) ? result : 0, result);
+
+    return result;
+}
+
+static ssize_t record_write(int fd, const void *buffer, size_t count)
+{
+    ssize_t result = write(fd, buffer, count);
+
+    record_call(fd, RECORD_WRITE, buffer, buffer, count, result);
+
+    return result;
+}
+
+const struct camtransport camtransport_record = {
+    "record", record_open, record_close, record_ioctl, record_read, record_write, driver_mmap, munmap
+};
+
+static int replay_open(const char *path, int flags)
+{
+    struct record_stream *stream;
+    int fd = -1;
+
+    pthread_mutex_lock(&record_mutex);
+    if ((stream = new_stream("rb"))) {
+        fd = stream->fd;
+    }
+    pthread_mutex_unlock(&record_mutex);
+
+    return fd;
+}
+
+static int replay_close(int fd)
+{
+    struct record_stream *stream;
+    int result = 0;
+
+    pthread_mutex_lock(&record_mutex);
+    if ((stream = get_stream(fd))) {
+        free_stream(stream);
+    }
+    else {
+        result = -1;
+    }
+    pthread_mutex_unlock(&record_mutex);
+
+    return result;
+}
+
+/* called with record_mutex held; takes the next call of the record, */
+/* which must be the same request                                     */
+static int replay_next(FILE *file, unsigned long request, void *output, unsigned size)
+{
+    struct record_header header;
+    unsigned char *buffer;
+
+    if (fread(&header, sizeof(header), 1, file) != 1) {
+        errno = ENODATA;
+        return -1;
+    }
+    if (header.request != request) {
+        errno = EPROTO;
+        return -1;
+    }
+    buffer = malloc(2 * header.size + 1);
+    if (! buffer) {
+        return -1;
+    }
+    if ((header.size > 0) && (fread(buffer, 2 * header.size, 1, file) != 1)) {
+        free(buffer);
+        errno = ENODATA;
+        return -1;
+    }
+    if (output) {
+        memcpy(output, buffer + header.size, (header.size < size) ? header.size : size);
+    }
+    free(buffer);
+    if (header.result < 0) {
+        errno = header.error;
+    }
+
+    return header.result;
+}
+
+static int replay_call(int fd, unsigned long request, void *output, unsigned size)
+{
+    struct record_stream *stream;
+    int result = -1;
+
+    pthread_mutex_lock(&record_mutex);
+    if ((stream = get_stream(fd))) {
+        result = replay_next(stream->file, request, output, size);
+    }
+    pthread_mutex_unlock(&record_mutex);
+
+    return result;
+}
+
+static int replay_ioctl(int fd, unsigned long request, void *arg)
+{
+    return replay_call(fd, request, arg, arg ? _IOC_SIZE(request) : 0);
+}
+
+static ssize_t replay_read(int fd, void *buffer, size_t count)
+{
+    return replay_call(fd, RECORD_READ, buffer, count);
+}
+
+static ssize_t replay_write(int fd, const void *buffer, size_t count)
+{
+    return replay_call(fd, RECORD_WRITE, NULL, 0);
+}
+
+static void *replay_mmap(void *address, size_t length, int protection, int flags, int fd, off_t offset)
+{
+    errno = ENODEV;
+    return MAP_FAILED;
+}
+
+static int replay_munmap(void *address, size_t length)
+{
+    return 0;
+}
+
+const struct camtransport camtransport_replay = {
+    "replay", replay_open, replay_close, replay_ioctl, replay_read, replay_write, replay_mmap, replay_munmap
+};
+
+
+/**** Selection ****/
+
+/* called with record_open_mutex held; the record file of the next open of spec */
+static int record_file_name(const char *spec, char *buffer, size_t size)
+{
+    struct record_name *name = NULL;
+    int index;
+
+    for (index = 0; index < RECORD_MAX_FILES; index++) {
+        if (strcmp(record_names[index].spec, spec) == 0) {
+            name = &record_names[index];
+            break;
+        }
+        if (! name && (record_names[index].spec[0] == '\0')) {
+            name = &record_names[index];
+        }
+    }
+    if (! name || (strlen(spec) >= sizeof(name->spec))) {
+        errno = ENFILE;
+        return -1;
+    }
+    if (name->spec[0] == '\0') {
+        strcpy(name->spec, spec);
+    }
+
+    if (name->open_count == 0) {
+        snprintf(buffer, size, "%s", spec + 7);
+    }
+    else {
+        snprintf(buffer, size, "%s.%u", spec + 7, name->open_count);
+    }
+    name->open_count++;
+
+    return 0;
+}
+
+int camtransport_open(const struct camtransport **transport, const char *spec, const char *path, int flags)
+{
+    char record_path_buffer[256];
+    int fd;
+
+    if (! spec) {
+        spec = getenv("CAMLIB_TRANSPORT");
+    }
+    if (! spec || (spec[0] == '\0') || (strcmp(spec, "driver") == 0)) {
+        *transport = &camtransport_driver;
+    }
+    else if ((strcmp(spec, "sim") == 0) || (strcmp(spec, "simulator") == 0)) {
+        *transport = &camtransport_simulator;
+    }
+    else if ((strncmp(spec, "record:", 7) == 0) || (strncmp(spec, "replay:", 7) == 0)) {
+        *transport = (spec[2] == 'c') ? &camtransport_record : &camtransport_replay;
+        /* the record file goes to the stream of this open only */
+        pthread_mutex_lock(&record_open_mutex);
+        if (record_file_name(spec, record_path_buffer, sizeof(record_path_buffer)) < 0) {
+            pthread_mutex_unlock(&record_open_mutex);
+            return -1;
+        }
+        record_path = record_path_buffer;
+        fd = (*transport)->open(path, flags);
+        record_path = NULL;
+        pthread_mutex_unlock(&record_open_mutex);
+        return fd;
+    }
+    else {
+        fprintf(stderr, "camtransport: unknown transport \"%s\"\n", spec);
+        errno = EINVAL;
+        return -1;
+    }
+
+    return (*transport)->open(path, flags);
+}
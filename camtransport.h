@@ -0,0 +1,50 @@
+/* camtransport.h */
+/* Created on 16 October 2026. */
+
+
+#ifndef __CAMTRANSPORT_H__
+#define __CAMTRANSPORT_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The system calls made on the device, so that camlib and toyocamac can   */
+/* run on something else than the kernel driver. The calls follow the      */
+/* system calls: -1 (MAP_FAILED for mmap) with errno set on error.         */
+struct camtransport {
+    const char *name;
+    int (*open)(const char *path, int flags);
+    int (*close)(int fd);
+    int (*ioctl)(int fd, unsigned long request, void *arg);
+    ssize_t (*read)(int fd, void *buffer, size_t count);
+    ssize_t (*write)(int fd, const void *buffer, size_t count);
+    void *(*mmap)(void *address, size_t length, int protection, int flags, int fd, off_t offset);
+    int (*munmap)(void *address, size_t length);
+};
+
+extern const struct camtransport camtransport_driver;     /* the kernel driver */
+extern const struct camtransport camtransport_simulator;  /* a CAMAC crate in the process */
+extern const struct camtransport camtransport_record;     /* the driver, logging every call */
+extern const struct camtransport camtransport_replay;     /* replays a record */
+
+/* Opens the device through the transport named by spec, or by the        */
+/* CAMLIB_TRANSPORT environment variable if spec is NULL:                   */
+/*   "driver" (default), "sim", "record:FILE", "replay:FILE"                */
+/* The opens of record:FILE and replay:FILE take FILE, FILE.1, FILE.2, ...  */
+/* in the order they are made.                                              */
+/* Simulator settings are taken from CAMLIB_SIM_CONFIG (a crate file),     */
+/* CAMLIB_SIM_CYCLE_NS and CAMLIB_SIM_LATENCY_US.                           */
+/* Returns the descriptor, or -1 with errno set.                            */
+int camtransport_open(const struct camtransport **transport, const char *spec, const char *path, int flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
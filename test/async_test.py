@@ -0,0 +1,33 @@
+# async_test.py
+
+import sys, os, asyncio
+sys.path.insert(0, os.path.normpath('..'))
+
+from camasync import *
+
+n = 3
+number_of_events = 100
+
+
+# waits for the LAMs of one crate while the other crates are served in the same loop
+async def readout(crate_number):
+    async with AsyncCamac(crate_number=crate_number) as cam:
+        q, x, data, status = await cam.camac(n, 0, 26)
+        if status != 0:
+            print(f"ERROR: crate {crate_number}: camac(): {os.strerror(status)}")
+            return
+        for event in range(number_of_events):
+            lam, status = await cam.wait_lam(1 << (n-1), timeout=1.0)
+            if status != 0:
+                print(f"ERROR: crate {crate_number}: wait_lam(): {os.strerror(status)}")
+                return
+            results, status = await cam.camac_list([(n, a, 0) for a in range(4)] + [(n, 0, 10)])
+            data = ' '.join('%06x' % d for q, x, d in results[0:4])
+            print(f"crate {crate_number}, event {event}: {data}")
+
+
+async def main(crate_numbers):
+    await asyncio.gather(*(readout(crate_number) for crate_number in crate_numbers))
+
+
+asyncio.run(main([int(arg) for arg in sys.argv[1:]] or [1]))
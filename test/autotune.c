@@ -0,0 +1,217 @@
+/* autotune.c */
+/* Created on 16 October 2026. */
+
+/* Runs a short benchmark for each combination of the FTDI latency timer,   */
+/* the bulk IN transfer size and the pipeline depth, and sets the best one. */
+/* Usage: autotune [-t transport] [-c crate] [-n station] [-i iterations] [-o latency|throughput] [-d] */
+/*   -n: station read with F0 (default 3)                                   */
+/*   -o: latency picks the lowest median of single reads (default);         */
+/*       throughput the lowest time per word of 256-command lists           */
+/*   -d: dry run; the original parameters are set back at the end           */
+/* The controller is held exclusively during the run. The timeout is kept.  */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "camdrv.h"
+#include "camlib.h"
+
+
+#define LIST_SIZE 256
+
+static const int latency_timers[] = { 1, 2, 4, 8 };
+static const int in_transfer_sizes[] = { 512, 1024, 2048, 4096 };
+static const int pipeline_depths[] = { 1, 2, 4, 8, 16 };
+
+#define NUMBER_OF(array) ((int) (sizeof(array) / sizeof(array[0])))
+
+struct result {
+    int latency_timer_ms, in_transfer_size, pipeline_depth;
+    unsigned long long p50_ns, p99_ns;
+    double list_word_ns;
+};
+
+static unsigned long long *samples;
+static int station = 3, iterations = 100;
+static int naf[LIST_SIZE], data[LIST_SIZE], q[LIST_SIZE], x[LIST_SIZE];
+
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *) a, y = *(const unsigned long long *) b;
+    return (x > y) - (x < y);
+}
+
+/* returns 0 or errno */
+static int measure(cam_ctx *ctx, struct result *result)
+{
+    unsigned long long start, total = 0;
+    int lists = (iterations / 10 > 5) ? iterations / 10 : 5;
+    int d, qq, xx, i, k, status;
+
+    /* the first transactions after a restart of the pipeline are not counted */
+    for (i = 0; i < 10; i++) {
+        if ((status = cam_naf(ctx, NAF(station, 0, 0), &d, &qq, &xx)) != 0) {
+            return status;
+        }
+    }
+    for (i = 0; i < iterations; i++) {
+        start = now_ns();
+        if ((status = cam_naf(ctx, NAF(station, 0, 0), &d, &qq, &xx)) != 0) {
+            return status;
+        }
+        samples[i] = now_ns() - start;
+    }
+    qsort(samples, iterations, sizeof(samples[0]), compare);
+    result->p50_ns = samples[iterations / 2];
+    result->p99_ns = samples[(99 * iterations) / 100];
+
+    for (i = 0; i < lists; i++) {
+        for (k = 0; k < LIST_SIZE; k++) {
+            naf[k] = NAF(station, k % 16, 0);
+            data[k] = 0;
+        }
+        start = now_ns();
+        if ((status = cam_list(ctx, LIST_SIZE, naf, data, q, x)) != 0) {
+            return status;
+        }
+        total += now_ns() - start;
+    }
+    result->list_word_ns = (double) total / lists / LIST_SIZE;
+
+    return 0;
+}
+
+static int is_better(const struct result *a, const struct result *b, int is_throughput)
+{
+    if (is_throughput) {
+        return a->list_word_ns < b->list_word_ns;
+    }
+    if (a->p50_ns != b->p50_ns) {
+        return a->p50_ns < b->p50_ns;
+    }
+    return a->p99_ns < b->p99_ns;
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *transport = NULL, *objective = "latency";
+    int crate_number = 1, is_dry_run = 0, is_throughput;
+    int original_latency, original_size, original_depth, timeout_ms;
+    struct result result, best = { 0 };
+    int option, status, has_best = 0;
+    int i, j, k;
+    cam_ctx *ctx;
+
+    while ((option = getopt(argc, argv, "t:c:n:i:o:d")) != -1) {
+        switch (option) {
+          case 't': transport = optarg; break;
+          case 'c': crate_number = atoi(optarg); break;
+          case 'n': station = atoi(optarg); break;
+          case 'i': iterations = atoi(optarg); break;
+          case 'o': objective = optarg; break;
+          case 'd': is_dry_run = 1; break;
+          default:
+            fprintf(stderr, "Usage: %s [-t transport] [-c crate] [-n station] [-i iterations] [-o latency|throughput] [-d]\n", argv[0]);
+            return -1;
+        }
+    }
+    if ((strcmp(objective, "latency") != 0) && (strcmp(objective, "throughput") != 0)) {
+        fprintf(stderr, "%s: unknown objective %s\n", argv[0], objective);
+        return -1;
+    }
+    is_throughput = (strcmp(objective, "throughput") == 0);
+    if (iterations < 10) {
+        iterations = 10;
+    }
+    if (! (samples = malloc(iterations * sizeof(samples[0])))) {
+        perror("malloc()");
+        return -1;
+    }
+
+    ctx = transport ? cam_open_transport(NULL, transport) : cam_open(NULL);
+    if (! ctx) {
+        perror("cam_open()");
+        return -1;
+    }
+    if ((status = cam_set_exclusive(ctx, 1)) != 0) {
+        fprintf(stderr, "cam_set_exclusive(): %s\n", strerror(status));
+        cam_close(ctx);
+        return -1;
+    }
+    if ((status = cam_set_crate(ctx, crate_number)) != 0) {
+        fprintf(stderr, "cam_set_crate(): %s\n", strerror(status));
+        cam_close(ctx);
+        return -1;
+    }
+    if ((status = cam_get_tuning(ctx, &original_latency, &original_size, &original_depth, &timeout_ms)) != 0) {
+        fprintf(stderr, "cam_get_tuning(): %s\n", strerror(status));
+        cam_close(ctx);
+        return -1;
+    }
+    printf("current: latency_timer=%d ms, in_transfer_size=%d, pipeline_depth=%d\n", original_latency, original_size, original_depth);
+
+    printf("%8s %8s %6s %10s %10s %14s\n", "latency", "in_size", "depth", "p50[us]", "p99[us]", "list/word[us]");
+    for (i = 0; i < NUMBER_OF(latency_timers); i++) {
+        for (j = 0; j < NUMBER_OF(in_transfer_sizes); j++) {
+            for (k = 0; k < NUMBER_OF(pipeline_depths); k++) {
+                result.latency_timer_ms = latency_timers[i];
+                result.in_transfer_size = in_transfer_sizes[j];
+                result.pipeline_depth = pipeline_depths[k];
+                status = cam_set_tuning(ctx, result.latency_timer_ms, result.in_transfer_size, result.pipeline_depth, timeout_ms);
+                if (status == 0) {
+                    status = measure(ctx, &result);
+                }
+                if (status != 0) {
+                    printf("%8d %8d %6d %s\n", result.latency_timer_ms, result.in_transfer_size, result.pipeline_depth, strerror(status));
+                    continue;
+                }
+                printf(
+                    "%8d %8d %6d %10.2f %10.2f %14.3f\n",
+                    result.latency_timer_ms, result.in_transfer_size, result.pipeline_depth,
+                    1e-3 * result.p50_ns, 1e-3 * result.p99_ns, 1e-3 * result.list_word_ns
+                );
+                fflush(stdout);
+                if (! has_best || is_better(&result, &best, is_throughput)) {
+                    best = result;
+                    has_best = 1;
+                }
+            }
+        }
+    }
+
+    if (! has_best || is_dry_run) {
+        status = cam_set_tuning(ctx, original_latency, original_size, original_depth, timeout_ms);
+        if (! has_best) {
+            fprintf(stderr, "%s: no combination could be measured\n", argv[0]);
+        }
+    }
+    else {
+        status = cam_set_tuning(ctx, best.latency_timer_ms, best.in_transfer_size, best.pipeline_depth, timeout_ms);
+    }
+    if (has_best) {
+        printf(
+            "best for %s: latency_timer=%d ms, in_transfer_size=%d, pipeline_depth=%d%s\n",
+            objective, best.latency_timer_ms, best.in_transfer_size, best.pipeline_depth, is_dry_run ? " (not set)" : ""
+        );
+    }
+    if (status != 0) {
+        fprintf(stderr, "cam_set_tuning(): %s\n", strerror(status));
+    }
+
+    cam_close(ctx);
+    free(samples);
+
+    return (has_best && (status == 0)) ? 0 : -1;
+}
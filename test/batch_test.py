@@ -0,0 +1,34 @@
+# batch_test.py
+
+import sys, os, time
+sys.path.insert(0, os.path.normpath('..'))
+
+from camlib import *
+
+crate_number = 1
+n = 3
+number_of_events = 1000
+
+status = COPEN()
+if status != 0:
+    print(f"ERROR: COPEN(): {os.strerror(status)}")
+    sys.exit(-1)
+CSETCR(crate_number)
+
+# all the sub-addresses of one station, 16 actions per driver call
+a = list(range(16))
+data, q, x, status = CAMACBATCH(n, a, 0)
+if status != 0:
+    print(f"ERROR: CAMACBATCH(): {os.strerror(status)}")
+    sys.exit(-1)
+for i in range(16):
+    print("NAF:%d,%d,%d, data:%06x, q:%d, x:%d" % (n, a[i], 0, data[i], q[i], x[i]))
+
+# the same, for many events
+start = time.monotonic()
+for event in range(number_of_events):
+    data, q, x, status = CAMACBATCH(n, a, 0)
+elapsed = time.monotonic() - start
+print("%d events: %.1f us/event" % (number_of_events, 1e6 * elapsed / number_of_events))
+
+CCLOSE()
@@ -0,0 +1,351 @@
+/* bench.c */
+/* Created on 16 October 2026. */
+
+/* Latency distribution of each class of CAMAC operation, and batch size sweeps. */
+/* Usage: bench [-t transport] [-c crate] [-n station] [-w station] [-i iterations] [-f text|json|csv] */
+/*   -n: station read and controlled (default 3); a LAM source for WAIT_LAM  */
+/*   -w: station written with F16 (default 1)                                */
+/* The transport is "driver", "sim", ... as for COPENT(); CAMLIB_TRANSPORT   */
+/* is used without -t.                                                       */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "camdrv.h"
+#include "camlib.h"
+
+
+#define MAX_RESULTS 64
+#define MAX_BATCH 1024
+
+struct result {
+    const char *operation;
+    int batch;
+    int count;
+    unsigned long long p50_ns, p99_ns, p999_ns, max_ns;
+    double mean_ns;
+};
+
+static struct result results[MAX_RESULTS];
+static int number_of_results = 0;
+static unsigned long long *samples;
+
+static int crate_number = 1, station = 3, write_station = 1, iterations = 10000;
+static int naf[MAX_BATCH], data[MAX_BATCH], q[MAX_BATCH], x[MAX_BATCH];
+
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *) a, y = *(const unsigned long long *) b;
+    return (x > y) - (x < y);
+}
+
+static unsigned long long percentile(int count, double p)
+{
+    int index = (int) (p * count);
+    return samples[(index < count) ? index : count - 1];
+}
+
+static void add_result(const char *operation, int batch, int count)
+{
+    struct result *result;
+    double sum = 0;
+    int i;
+
+    if ((count == 0) || (number_of_results >= MAX_RESULTS)) {
+        return;
+    }
+    qsort(samples, count, sizeof(samples[0]), compare);
+    for (i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+
+    result = &results[number_of_results++];
+    result->operation = operation;
+    result->batch = batch;
+    result->count = count;
+    result->p50_ns = percentile(count, 0.5);
+    result->p99_ns = percentile(count, 0.99);
+    result->p999_ns = percentile(count, 0.999);
+    result->max_ns = samples[count - 1];
+    result->mean_ns = sum / count;
+}
+
+static void bench_camac(const char *operation, int n, int a, int f)
+{
+    unsigned long long start;
+    int d, qq, xx, i;
+
+    for (i = 0; i < iterations; i++) {
+        d = i & 0x00ffffff;
+        start = now_ns();
+        if (CAMAC(NAF(n, a, f), &d, &qq, &xx) != 0) {
+            perror(operation);
+            break;
+        }
+        samples[i] = now_ns() - start;
+    }
+    add_result(operation, 1, i);
+}
+
+static void bench_z_c(void)
+{
+    unsigned long long start;
+    int i;
+
+    for (i = 0; i < iterations; i++) {
+        start = now_ns();
+        if (CGENZ() != 0) {
+            perror("CGENZ()");
+            break;
+        }
+        samples[i] = now_ns() - start;
+    }
+    add_result("z", 1, i);
+
+    for (i = 0; i < iterations; i++) {
+        start = now_ns();
+        if (CGENC() != 0) {
+            perror("CGENC()");
+            break;
+        }
+        samples[i] = now_ns() - start;
+    }
+    add_result("c", 1, i);
+}
+
+static void bench_read_lam(void)
+{
+    unsigned long long start;
+    int lam, i;
+
+    for (i = 0; i < iterations; i++) {
+        start = now_ns();
+        if (CREADLAM(&lam) != 0) {
+            perror("CREADLAM()");
+            break;
+        }
+        samples[i] = now_ns() - start;
+    }
+    add_result("read_lam", 1, i);
+}
+
+/* wait_lam_pending: the LAM of the station is left pending, so that each */
+/* WAIT_LAM returns as soon as the LAM is seen again: the detection and   */
+/* wake-up path only. wait_lam_next: the LAM is cleared (F10) before each */
+/* WAIT_LAM, which then takes the next one; the time is from the clear,   */
+/* so it includes the period of the LAM source. Only the LAM of the      */
+/* station is waited for.                                                 */
+static void bench_wait_lam(void)
+{
+    unsigned long long start;
+    int count = (iterations < 1000) ? iterations : 1000;
+    int d = 0, qq, xx, i;
+
+    CAMAC(NAF(station, 0, 26), &d, &qq, &xx);
+    if (CELAM(0x0001 << (station - 1)) != 0) {
+        perror("CELAM()");
+        return;
+    }
+    if (CWLAMUS(1000000) != 0) {
+        fprintf(stderr, "wait_lam: no LAM within 1 s, skipped\n");
+        CDLAM();
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        start = now_ns();
+        if (CWLAMUS(1000000) != 0) {
+            perror("CWLAMUS()");
+            break;
+        }
+        samples[i] = now_ns() - start;
+    }
+    add_result("wait_lam_pending", 1, i);
+
+    count = (iterations < 100) ? iterations : 100;
+    for (i = 0; i < count; i++) {
+        CAMAC(NAF(station, 0, 10), &d, &qq, &xx);
+        start = now_ns();
+        if (CWLAMUS(1000000) != 0) {
+            perror("CWLAMUS()");
+            break;
+        }
+        samples[i] = now_ns() - start;
+    }
+    CDLAM();
+    add_result("wait_lam_next", 1, i);
+}
+
+/* one call of batch commands, for the list and the block transfer paths */
+static void bench_batches(void)
+{
+    unsigned long long start;
+    int count = (iterations / 16 > 100) ? iterations / 16 : 100;
+    int batch, words, i, k;
+
+    if (count > iterations) {
+        /* samples holds iterations entries */
+        count = iterations;
+    }
+
+    for (batch = 1; batch <= MAX_BATCH; batch *= 4) {
+        for (i = 0; i < count; i++) {
+            for (k = 0; k < batch; k++) {
+                naf[k] = NAF(station, k % 16, 0);
+                data[k] = 0;
+            }
+            start = now_ns();
+            if (CAMACLIST(batch, naf, data, q, x) != 0) {
+                perror("CAMACLIST()");
+                break;
+            }
+            samples[i] = now_ns() - start;
+        }
+        add_result("list_f0", batch, i);
+    }
+
+    for (batch = 1; batch <= MAX_BATCH; batch *= 4) {
+        for (i = 0; i < count; i++) {
+            words = batch;
+            start = now_ns();
+            if (CFUBC(NAF(station, 0, 0), data, &words) != 0) {
+                perror("CFUBC()");
+                break;
+            }
+            samples[i] = now_ns() - start;
+        }
+        add_result("block_qstop_f0", batch, i);
+    }
+}
+
+static void print_text(FILE *output)
+{
+    struct result *result;
+    int i;
+
+    fprintf(output, "%-16s %6s %8s %10s %10s %10s %10s %12s\n", "operation", "batch", "count", "p50[us]", "p99[us]", "p99.9[us]", "max[us]", "per-word[us]");
+    for (i = 0; i < number_of_results; i++) {
+        result = &results[i];
+        fprintf(
+            output, "%-16s %6d %8d %10.2f %10.2f %10.2f %10.2f %12.3f\n",
+            result->operation, result->batch, result->count,
+            1e-3 * result->p50_ns, 1e-3 * result->p99_ns, 1e-3 * result->p999_ns, 1e-3 * result->max_ns,
+            1e-3 * result->mean_ns / result->batch
+        );
+    }
+}
+
+static void print_csv(FILE *output, const char *transport, time_t date)
+{
+    struct result *result;
+    int i;
+
+    fprintf(output, "date,transport,crate,operation,batch,count,p50_ns,p99_ns,p999_ns,max_ns,mean_ns,per_word_ns\n");
+    for (i = 0; i < number_of_results; i++) {
+        result = &results[i];
+        fprintf(
+            output, "%ld,%s,%d,%s,%d,%d,%llu,%llu,%llu,%llu,%.0f,%.1f\n",
+            (long) date, transport, crate_number, result->operation, result->batch, result->count,
+            result->p50_ns, result->p99_ns, result->p999_ns, result->max_ns,
+            result->mean_ns, result->mean_ns / result->batch
+        );
+    }
+}
+
+static void print_json(FILE *output, const char *transport, time_t date)
+{
+    struct result *result;
+    int i;
+
+    fprintf(output, "{\n  \"date\": %ld,\n  \"transport\": \"%s\",\n  \"crate\": %d,\n  \"results\": [\n", (long) date, transport, crate_number);
+    for (i = 0; i < number_of_results; i++) {
+        result = &results[i];
+        fprintf(
+            output,
+            "    {\"operation\": \"%s\", \"batch\": %d, \"count\": %d, "
+            "\"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu, "
+            "\"mean_ns\": %.0f, \"per_word_ns\": %.1f}%s\n",
+            result->operation, result->batch, result->count,
+            result->p50_ns, result->p99_ns, result->p999_ns, result->max_ns,
+            result->mean_ns, result->mean_ns / result->batch,
+            (i + 1 < number_of_results) ? "," : ""
+        );
+    }
+    fprintf(output, "  ]\n}\n");
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *transport = NULL, *format = "text";
+    int option, result;
+
+    while ((option = getopt(argc, argv, "t:c:n:w:i:f:")) != -1) {
+        switch (option) {
+          case 't': transport = optarg; break;
+          case 'c': crate_number = atoi(optarg); break;
+          case 'n': station = atoi(optarg); break;
+          case 'w': write_station = atoi(optarg); break;
+          case 'i': iterations = atoi(optarg); break;
+          case 'f': format = optarg; break;
+          default:
+            fprintf(stderr, "Usage: %s [-t transport] [-c crate] [-n station] [-w station] [-i iterations] [-f text|json|csv]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (iterations <= 0) {
+        iterations = 1;
+    }
+    if (! (samples = malloc(iterations * sizeof(samples[0])))) {
+        perror("malloc()");
+        return -1;
+    }
+
+    result = transport ? COPENT(transport) : COPEN();
+    if (result != 0) {
+        perror("COPEN()");
+        return -1;
+    }
+    if (! transport) {
+        transport = getenv("CAMLIB_TRANSPORT");
+        transport = (transport && transport[0]) ? transport : "driver";
+    }
+    if (CSETCR(crate_number) != 0) {
+        perror("CSETCR()");
+        return -1;
+    }
+
+    bench_camac("read_f0", station, 0, 0);
+    bench_camac("control_f8", station, 0, 8);
+    bench_camac("write_f16", write_station, 0, 16);
+    bench_camac("control_f26", station, 0, 26);
+    bench_read_lam();
+    bench_wait_lam();
+    bench_z_c();
+    bench_batches();
+
+    CCLOSE();
+
+    if (strcmp(format, "json") == 0) {
+        print_json(stdout, transport, time(NULL));
+    }
+    else if (strcmp(format, "csv") == 0) {
+        print_csv(stdout, transport, time(NULL));
+    }
+    else {
+        print_text(stdout);
+    }
+    free(samples);
+
+    return 0;
+}
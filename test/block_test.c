@@ -0,0 +1,50 @@
+/* block_test.c */
+/* Created on 16 October 2026. */
+
+
+#include <stdio.h>
+#include "camlib.h"
+
+
+int main(void)
+{
+    int n = 3, a = 0, f = 0;
+    int data[1024];
+    int count, i;
+
+    if (COPEN() != 0) {
+        perror("COPEN()");
+        return -1;
+    }
+
+    /* set crate number if necessary (default is 1) */
+    unsigned crate_number = 1;
+    if (CSETCR(crate_number) != 0) {
+        perror("CSETCR()");
+        return -1;
+    }
+
+    /* read until Q=0 */
+    count = 1024;
+    if (CFUBC(NAF(n, a, f), data, &count) != 0) {
+        perror("CFUBC()");
+    }
+    printf("Q-stop, NAF:%d,%d,%d: %d words\n", n, a, f, count);
+    for (i = 0; i < count; i++) {
+        printf("%06x\n", data[i]);
+    }
+
+    /* scan the sub-addresses, moving to the next station on Q=0 */
+    count = 1024;
+    if (CFUBA(NAF(n, a, f), data, &count) != 0) {
+        perror("CFUBA()");
+    }
+    printf("address scan, NAF:%d,%d,%d: %d words\n", n, a, f, count);
+    for (i = 0; i < count; i++) {
+        printf("%06x\n", data[i]);
+    }
+
+    CCLOSE();
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+/* cpp_test.cpp */
+/* Created on 16 October 2026. */
+
+/* camlib.hpp: a fixed readout list encoded at compile time. */
+/* Usage: cpp_test [crate]                                   */
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "camlib.hpp"
+
+
+using namespace camlib;
+
+/* ADC at station 3: four channels and the LAM clear */
+using Event = Sequence<
+    Read<3, 0>, Read<3, 1>, Read<3, 2>, Read<3, 3>,
+    Control<3, 0, 10>
+>;
+
+static_assert(Event::naf[0] == NAF(3, 0, 0), "NAF encoding");
+static_assert(Event::naf[4] == NAF(3, 0, 10), "NAF encoding");
+static_assert(encode_naf(23, 15, 31) == 0x2fff, "NAF encoding");
+
+/* each of these fails to compile:           */
+/*   Read<24, 0>           station range     */
+/*   Write<3, 0, 0>        F0 is not a write */
+/*   constexpr int naf = encode_naf(0, 0, 0); */
+
+
+int main(int argc, char **argv)
+{
+    Crate crate(argc > 1 ? atoi(argv[1]) : 1);
+    if (crate.error()) {
+        fprintf(stderr, "ERROR: Crate(): %s\n", strerror(crate.error()));
+        return -1;
+    }
+
+    int q, x, status;
+    if ((status = crate.execute(Write<1, 0>(), 0x123456, q, x)) != 0) {
+        fprintf(stderr, "ERROR: Write: %s\n", strerror(status));
+        return -1;
+    }
+    printf("F16: q=%d, x=%d\n", q, x);
+
+    Event::Frame frame;
+    for (int event = 0; event < 10; event++) {
+        if ((status = crate.execute(frame)) != 0) {
+            fprintf(stderr, "ERROR: Event: %s\n", strerror(status));
+            return -1;
+        }
+        printf("%d:", event);
+        for (std::size_t i = 0; i < 4; i++) {
+            printf(" %06x(q=%d)", frame.data[i], frame.q[i]);
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,59 @@
+/* lam_latency_test.c */
+/* Created on 16 October 2026. */
+
+/* Usage: lam_latency_test [path of the lam_latency sysfs attribute] */
+/* A module at station n must keep raising LAM (e.g. from a pulser). */
+
+
+#include <stdio.h>
+#include "camdrv.h"
+#include "camlib.h"
+
+
+static void print_latency(const char *path)
+{
+    char line[256];
+    FILE *file;
+
+    if (! path || ! (file = fopen(path, "r"))) {
+        return;
+    }
+    if (fgets(line, sizeof(line), file)) {
+        printf("    %s", line);
+    }
+    fclose(file);
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *names[] = { "sleep", "busy", "hybrid", "hrtimer", "adaptive" };
+    int n = 3, a = 0, f = 10, data = 0, q, x;
+    int interval_us = 100, spin_budget_us = 200, timeout_us = 1000000;
+    int strategy, i, lams;
+
+    if (COPEN() != 0) {
+        perror("COPEN()");
+        return -1;
+    }
+
+    for (strategy = CAMDRV_LAM_POLL_SLEEP; strategy <= CAMDRV_LAM_POLL_ADAPTIVE; strategy++) {
+        if (CSETLAMPOLL(strategy, interval_us, spin_budget_us) != 0) {
+            perror("CSETLAMPOLL()");
+            break;
+        }
+        for (i = 0, lams = 0; i < 1000; i++) {
+            if (CWLAMUS(timeout_us) == 0) {
+                lams++;
+            }
+            /* clear LAM (F10) */
+            CAMAC(NAF(n, a, f), &data, &q, &x);
+        }
+        printf("%s: %d LAMs\n", names[strategy], lams);
+        print_latency((argc > 1) ? argv[1] : NULL);
+    }
+
+    CCLOSE();
+
+    return 0;
+}
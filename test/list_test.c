@@ -0,0 +1,46 @@
+/* list_test.c */
+/* Created on 16 October 2026. */
+
+
+#include <stdio.h>
+#include "camlib.h"
+
+
+int main(void)
+{
+    int n = 3, f = 0;
+    int naf[16], data[16], q[16], x[16];
+    int a, i;
+
+    if (COPEN() != 0) {
+        perror("COPEN()");
+        return -1;
+    }
+
+    /* set crate number if necessary (default is 1) */
+    unsigned crate_number = 1;
+    if (CSETCR(crate_number) != 0) {
+        perror("CSETCR()");
+        return -1;
+    }
+
+    /* read all the sub-addresses of one station in one call */
+    for (a = 0; a < 16; a++) {
+        naf[a] = NAF(n, a, f);
+        data[a] = 0;
+    }
+
+    for (i = 0; i < 10; i++) {
+        if (CAMACLIST(16, naf, data, q, x) != 0) {
+            perror("CAMACLIST()");
+            break;
+        }
+        for (a = 0; a < 16; a++) {
+            printf("NAF:%d,%d,%d, data:%06x, q:%d, x:%d\n", n, a, f, data[a], q[a], x[a]);
+        }
+    }
+
+    CCLOSE();
+
+    return 0;
+}
@@ -0,0 +1,53 @@
+/* monitor_test.c */
+/* Created on 16 October 2026. */
+
+/* Reads a scaler at low priority, on a controller shared with a running DAQ. */
+/* Usage: monitor_test [station] */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "camdrv.h"
+#include "camlib.h"
+
+
+int main(int argc, char **argv)
+{
+    int n = (argc > 1) ? atoi(argv[1]) : 5;
+    int a, data, q, x, i;
+    unsigned long long transaction_count, wait_ns, max_wait_ns;
+
+    if (COPEN() != 0) {
+        perror("COPEN()");
+        return -1;
+    }
+    if (CSETPRIO(CAMDRV_PRIORITY_LOW) != 0) {
+        perror("CSETPRIO()");
+        return -1;
+    }
+
+    for (i = 0; i < 10; i++) {
+        for (a = 0; a < 4; a++) {
+            data = 0;
+            if (CAMAC(NAF(n, a, 0), &data, &q, &x) != 0) {
+                perror("CAMAC()");
+                return -1;
+            }
+            printf("%8d ", data);
+        }
+        printf("\n");
+        sleep(1);
+    }
+
+    if (CGETSTAT(&transaction_count, &wait_ns, &max_wait_ns) == 0) {
+        printf(
+            "transactions: %llu, mean wait: %.1f us, max wait: %.1f us\n",
+            transaction_count, 1e-3 * wait_ns / (transaction_count ? transaction_count : 1), 1e-3 * max_wait_ns
+        );
+    }
+
+    CCLOSE();
+
+    return 0;
+}
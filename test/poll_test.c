@@ -0,0 +1,62 @@
+/* poll_test.c */
+/* Created on 16 October 2026. */
+
+/* epoll is made on the device file: with the driver only. */
+
+
+#include <stdio.h>
+#include <sys/epoll.h>
+#include "camlib.h"
+
+
+int main(void)
+{
+    int timeout = 10;  /* sec */
+    struct epoll_event event;
+    int epoll_fd, result, i;
+
+    if (COPEN() != 0) {
+        perror("COPEN()");
+        return -1;
+    }
+
+    /* the driver polls LAM; the device becomes readable on LAM */
+    if (CELAM(~0) != 0) {
+        perror("CELAM()");
+        return -1;
+    }
+
+    if (CFILENO() < 0) {
+        perror("CFILENO()");
+        return -1;
+    }
+    epoll_fd = epoll_create1(0);
+    event.events = EPOLLIN | EPOLLPRI;
+    event.data.fd = CFILENO();
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, CFILENO(), &event) < 0) {
+        perror("epoll_ctl()");
+        return -1;
+    }
+
+    for (i = 0; i < 16; i++) {
+        printf("Waiting for a LAM ...");
+        fflush(stdout);
+        result = epoll_wait(epoll_fd, &event, 1, timeout * 1000);
+        if (result < 0) {
+            perror("epoll_wait()");
+            break;
+        }
+        if (result == 0) {
+            printf(" timed out\n");
+            continue;
+        }
+        /* takes the LAM; it is reported again while the module keeps it */
+        CWLAM(0);
+        printf(" LAM, events=0x%x\n", event.events);
+    }
+
+    CDLAM();
+    CCLOSE();
+
+    return 0;
+}
@@ -0,0 +1,51 @@
+/* readout_test.c */
+/* Created on 16 October 2026. */
+
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include "camlib.h"
+
+
+int main(void)
+{
+    int crate_number = 1, lam_station = 3;
+    int naf[2], data[2], q[2], x[2];
+    int lam_pattern, number_of_words, result;
+    int events = 0;
+
+    if (COPEN() != 0) {
+        perror("COPEN()");
+        return -1;
+    }
+
+    /* on LAM of the station, read A(0) and clear it with F(9) */
+    naf[0] = NAF(lam_station, 0, 0);
+    naf[1] = NAF(lam_station, 0, 9);
+    if (CSTARTREADOUT(crate_number, 0x0001 << (lam_station - 1), 2, naf, NULL, 0) != 0) {
+        perror("CSTARTREADOUT()");
+        return -1;
+    }
+
+    /* the driver keeps reading out while this loop is busy */
+    while (events < 100) {
+        result = CREADEVENT(&lam_pattern, data, q, x, &number_of_words);
+        if (result == EAGAIN) {
+            usleep(1000);
+            continue;
+        }
+        if (result != 0) {
+            errno = result;
+            perror("CREADEVENT()");
+            break;
+        }
+        printf("LAM:%06x, data:%06x, q:%d, x:%d\n", lam_pattern, data[0], q[0], x[0]);
+        events++;
+    }
+
+    CSTOPREADOUT();
+    CCLOSE();
+
+    return 0;
+}
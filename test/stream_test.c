@@ -0,0 +1,55 @@
+/* stream_test.c */
+/* Created on 16 October 2026. */
+
+/* readv() is made on the device file: with the driver only, not through */
+/* CAMLIB_TRANSPORT=sim or replay, which have no kernel descriptor.      */
+
+
+#include <stdio.h>
+#include <sys/uio.h>
+#include "camdrv.h"
+#include "camlib.h"
+
+
+int main(void)
+{
+    int crate_number = 1, n = 3, a = 0, f = 0;
+    unsigned char header[3*16], body[3*1024];
+    struct iovec iov[2];
+    int size, i;
+
+    if (COPEN() != 0) {
+        perror("COPEN()");
+        return -1;
+    }
+
+    /* bind read() to one NAF, packed 24-bit words */
+    if (CBINDSTREAM(crate_number, NAF(n, a, f), CAMDRV_FORMAT_24BIT) != 0) {
+        perror("CBINDSTREAM()");
+        return -1;
+    }
+
+    /* one system call fills both buffers */
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = body;
+    iov[1].iov_len = sizeof(body);
+    if (CFILENO() < 0) {
+        perror("CFILENO()");
+        return -1;
+    }
+    size = readv(CFILENO(), iov, 2);
+    if (size < 0) {
+        perror("readv()");
+        return -1;
+    }
+
+    printf("NAF:%d,%d,%d: %d words\n", n, a, f, size / 3);
+    for (i = 0; (i < 16) && (3*i < size); i++) {
+        printf("%06x\n", header[3*i] | (header[3*i+1] << 8) | (header[3*i+2] << 16));
+    }
+
+    CCLOSE();
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+/* thread_test.c */
+/* Created on 16 October 2026. */
+
+/* One readout thread per controller, each on its own camlib context. */
+/* Usage: thread_test [device index ...]                               */
+/*   /dev/camdrvN for each index; without any, two threads share       */
+/*   /dev/camdrv as two files.                                         */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "camlib.h"
+
+
+#define MAX_THREADS 8
+
+struct reader {
+    pthread_t thread;
+    char path[64];
+    int n, count, errors;
+};
+
+
+static void *read_loop(void *arg)
+{
+    struct reader *reader = arg;
+    cam_ctx *ctx;
+    int data, q, x, i;
+
+    if (! (ctx = cam_open(reader->path))) {
+        perror(reader->path);
+        reader->errors++;
+        return NULL;
+    }
+    cam_set_crate(ctx, 1);
+
+    for (i = 0; i < 10000; i++) {
+        data = 0;
+        if (cam_naf(ctx, NAF(reader->n, i % 8, 0), &data, &q, &x) != 0) {
+            reader->errors++;
+            break;
+        }
+        reader->count++;
+    }
+
+    cam_close(ctx);
+
+    return NULL;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct reader readers[MAX_THREADS];
+    int number_of_readers, i;
+
+    number_of_readers = (argc > 1) ? argc - 1 : 2;
+    if (number_of_readers > MAX_THREADS) {
+        number_of_readers = MAX_THREADS;
+    }
+
+    for (i = 0; i < number_of_readers; i++) {
+        if (argc > 1) {
+            snprintf(readers[i].path, sizeof(readers[i].path), "/dev/camdrv%d", atoi(argv[i + 1]));
+        }
+        else {
+            snprintf(readers[i].path, sizeof(readers[i].path), "/dev/camdrv");
+        }
+        readers[i].n = 3;
+        readers[i].count = 0;
+        readers[i].errors = 0;
+        pthread_create(&readers[i].thread, NULL, read_loop, &readers[i]);
+    }
+
+    for (i = 0; i < number_of_readers; i++) {
+        pthread_join(readers[i].thread, NULL);
+        printf("%s: %d transactions, %d errors\n", readers[i].path, readers[i].count, readers[i].errors);
+    }
+
+    return 0;
+}
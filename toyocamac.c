@@ -3,43 +3,151 @@
 /* Last updated by Sanshiro Enomoto on 18 September 2002. */
 
 
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <sys/ioctl.h>
-#include <fcntl.h>
-#include <unistd.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include "camdrv.h"
+#include "camlib.h"
 #include "toyocamac.h"
 
-static const char *device_file = "/dev/camdrv";
-static int device_descripter = 0;
-static unsigned ioctl_data[2];
+/* a wrapper of the camlib context API, on a context of its own */
+static cam_ctx *context = NULL;
 static unsigned crate_number = 0;
 
-#define NAF(n, a, f) ((((n) << 9) | ((a) << 5) | (f)) & 0x00003fff)
-#define CHECK_OPENED ((device_descripter > 0) ? 1 : camdrv_open())
+/* Deferred mode: F8-F31 from camac_0() and the camac_*w() writes are queued, */
+/* and sent as one list with the next read, or by camflush().                  */
+static int is_deferred = 0;
+static int number_of_deferred = 0;
+static int deferred_naf[CAMDRV_MAX_COMMANDS], deferred_data[CAMDRV_MAX_COMMANDS];
+static int deferred_q[CAMDRV_MAX_COMMANDS], deferred_x[CAMDRV_MAX_COMMANDS];
+static unsigned deferred_status = 0;
+
+#define CHECK_OPENED ((context != NULL) ? 1 : camdrv_open())
+/* an implicit flush keeps the nxq of the queue for the next camflush() */
+#define FLUSH_DEFERRED (number_of_deferred ? run_deferred(-1, NULL) : 0)
 
 
 static int camdrv_open(void)
 {
-    device_descripter = open(device_file, O_RDWR);
+    const char *defer = getenv("TOYOCAMAC_DEFER");
+
+    /* the transport is taken from CAMLIB_TRANSPORT, the driver by default */
+    context = cam_open(NULL);
+    if (context && defer && (atoi(defer) != 0)) {
+        camdefer(1);
+    }
+
+    return (context != NULL);
+}
+
+/* runs the queue, with one more command if naf is not negative; */
+/* returns the nxq of that command, or of the queue              */
+static unsigned run_deferred(int naf, unsigned *data)
+{
+    unsigned status = 0;
+    int count = number_of_deferred, i;
+
+    if (naf >= 0) {
+        deferred_naf[count] = naf;
+        deferred_data[count] = *data;
+        count++;
+    }
+    number_of_deferred = 0;
+    if (count == 0) {
+        return deferred_status;
+    }
+
+    if (! CHECK_OPENED || (cam_list(context, count, deferred_naf, deferred_data, deferred_q, deferred_x) != 0)) {
+        if ((naf < 0) || (count > 1)) {
+            /* the queued commands were not run */
+            deferred_status |= 0x0003;
+        }
+        return ~0;
+    }
+    for (i = 0; i < count; i++) {
+        status = (deferred_q[i] ? 0 : 0x0001) | (deferred_x[i] ? 0 : 0x0002);
+        if ((naf < 0) || (i + 1 < count)) {
+            deferred_status |= status;
+        }
+    }
+    if (naf >= 0) {
+        *data = deferred_data[count - 1];
+        return status;
+    }
+
+    return deferred_status;
+}
+
+static void flush_at_exit(void)
+{
+    camflush();
+}
+
+void camdefer(int enable)
+{
+    static int is_registered = 0;
+
+    if (enable && ! is_registered) {
+        atexit(flush_at_exit);
+        is_registered = 1;
+    }
+    if (! enable) {
+        FLUSH_DEFERRED;
+    }
+    is_deferred = enable;
+}
+
+unsigned camflush(void)
+{
+    unsigned status = run_deferred(-1, NULL);
+
+    deferred_status = 0;
 
-    return device_descripter;
+    return status;
+}
+
+/* for the calls whose nxq is not looked at in the deferred mode: only the */
+/* clears (F9-F11), the writes (F16-F23) and the controls (F24-F26) are    */
+/* queued; the tests (F8, F27) and the others answer in Q and run at once  */
+static unsigned camac_deferrable(unsigned n, unsigned a, unsigned f, unsigned data)
+{
+    int is_queueable = ((f >= 9) && (f <= 11)) || ((f >= 16) && (f <= 26));
+
+    if (! is_deferred || ! is_queueable) {
+        return camac_24(n, a, f, &data);
+    }
+
+    if (number_of_deferred + 1 >= CAMDRV_MAX_COMMANDS) {
+        run_deferred(-1, NULL);
+    }
+    deferred_naf[number_of_deferred] = NAF(n, a, f);
+    deferred_data[number_of_deferred] = data;
+    number_of_deferred++;
+
+    return 0;
 }
 
 #if 0
 static void camdrv_close(void)
 {
-    close(device_descripter);
+    cam_close(context);
+    context = NULL;
 }
 #endif
 
-void setcn(unsigned crate_number)
+int camopen(const char *transport_name)
 {
-    CHECK_OPENED;
+    /* "driver", "sim", "record:FILE" or "replay:FILE"; without it, the first call opens the device */
+    context = cam_open_transport(NULL, transport_name);
 
-    ioctl_data[0] = crate_number;
-    ioctl(device_descripter, CAMDRV_IOC_SET_CRATE, ioctl_data);
+    return (context != NULL) ? 0 : -1;
+}
+
+void setcn(unsigned crate_number)
+{
+    FLUSH_DEFERRED;
+    if (CHECK_OPENED) {
+        cam_set_crate(context, crate_number);
+    }
 }
 
 unsigned getcn(void)
@@ -49,55 +157,67 @@ unsigned getcn(void)
 
 void execz(void)
 {
-    CHECK_OPENED;
-    ioctl(device_descripter, CAMDRV_IOC_INITIALIZE);
+    FLUSH_DEFERRED;
+    if (CHECK_OPENED) {
+        cam_initialize(context);
+    }
 }
 
 void execc(void)
 {
-    CHECK_OPENED;
-    ioctl(device_descripter, CAMDRV_IOC_CLEAR);
+    FLUSH_DEFERRED;
+    if (CHECK_OPENED) {
+        cam_clear(context);
+    }
 }
 
 void seti(void)
 {
-    CHECK_OPENED;
-    ioctl(device_descripter, CAMDRV_IOC_INHIBIT);
+    FLUSH_DEFERRED;
+    if (CHECK_OPENED) {
+        cam_inhibit(context);
+    }
 }
 
 void clri(void)
 {
-    CHECK_OPENED;
-    ioctl(device_descripter, CAMDRV_IOC_RELEASE_INHIBIT);
+    FLUSH_DEFERRED;
+    if (CHECK_OPENED) {
+        cam_release_inhibit(context);
+    }
 }
 
 void setei(void)
 {
-    CHECK_OPENED;
-    ioctl(device_descripter, CAMDRV_IOC_ENABLE_INTERRUPT);
+    FLUSH_DEFERRED;
+    if (CHECK_OPENED) {
+        cam_enable_lam(context, ~0);
+    }
 }
 
 void clrei(void)
 {
-    CHECK_OPENED;
-    ioctl(device_descripter, CAMDRV_IOC_DISABLE_INTERRUPT);
+    FLUSH_DEFERRED;
+    if (CHECK_OPENED) {
+        cam_disable_lam(context);
+    }
 }
 
 unsigned long rlam(void)
 {
-    CHECK_OPENED;
+    int lam = 0;
 
-    ioctl_data[0] = 0;
-    ioctl_data[1] = 0;
-    ioctl(device_descripter, CAMDRV_IOC_READ_LAM, ioctl_data);
+    FLUSH_DEFERRED;
+    if (CHECK_OPENED) {
+        cam_read_lam(context, &lam);
+    }
 
-    return ioctl_data[1];
+    return (unsigned) lam;
 }
 
 unsigned int camac_0(unsigned n, unsigned a, unsigned f)
 {
-    unsigned data;
-    return camac_24(n, a, f, &data);
+    return camac_deferrable(n, a, f, 0);
 }
 
 unsigned int camac_16(unsigned n, unsigned a, unsigned f, unsigned *data)
@@ -107,31 +227,64 @@ unsigned int camac_16(unsigned n, unsigned a, unsigned f, unsigned *data)
 
 unsigned int camac_24(unsigned n, unsigned a, unsigned f, unsigned *data)
 {
-    unsigned nxq = 0;
-    int result;
-
-    CHECK_OPENED;
+    int value = *data, q, x;
 
-    ioctl_data[0] = NAF(n, a, f);
-    ioctl_data[1] = *data;
-    result = ioctl(device_descripter, CAMDRV_IOC_CAMAC_ACTION, ioctl_data);
-
-    if (result < 0) {
+    if (number_of_deferred > 0) {
+        /* the queue goes in the same round trip */
+        return run_deferred(NAF(n, a, f), data);
+    }
+    if (! CHECK_OPENED || (cam_naf(context, NAF(n, a, f), &value, &q, &x) != 0)) {
         return ~0;
     }
+    *data = value;
 
-    *data = ioctl_data[1] & 0x00ffffff;
-    nxq = result & 0x0003;
-
-    return nxq;
+    return (q ? 0 : 0x0001) | (x ? 0 : 0x0002);
 }
 
 unsigned int camac_16w(unsigned n, unsigned a, unsigned f, unsigned data)
 {
-    return camac_24(n, a, f, &data);
+    return camac_deferrable(n, a, f, data);
 }
 
 unsigned int camac_24w(unsigned n, unsigned a, unsigned f, unsigned data)
 {
-    return camac_24(n, a, f, &data);
+    return camac_deferrable(n, a, f, data);
+}
+
+unsigned int camac_0c(unsigned c, unsigned n, unsigned a, unsigned f)
+{
+    unsigned data = 0;
+    return camac_24c(c, n, a, f, &data);
+}
+
+unsigned int camac_16c(unsigned c, unsigned n, unsigned a, unsigned f, unsigned *data)
+{
+    unsigned nxq = camac_24c(c, n, a, f, data);
+    *data &= 0x0000ffff;
+
+    return nxq;
+}
+
+/* names its own crate; no setcn() is needed to switch between crates */
+unsigned int camac_24c(unsigned c, unsigned n, unsigned a, unsigned f, unsigned *data)
+{
+    int value = *data, q, x;
+
+    FLUSH_DEFERRED;
+    if (! CHECK_OPENED || (cam_naf_crate(context, c, NAF(n, a, f), &value, &q, &x) != 0)) {
+        return ~0;
+    }
+    *data = value;
+
+    return (q ? 0 : 0x0001) | (x ? 0 : 0x0002);
+}
+
+unsigned int camac_16wc(unsigned c, unsigned n, unsigned a, unsigned f, unsigned data)
+{
+    return camac_24c(c, n, a, f, &data);
+}
+
+unsigned int camac_24wc(unsigned c, unsigned n, unsigned a, unsigned f, unsigned data)
+{
+    return camac_24c(c, n, a, f, &data);
 }
@@ -11,6 +11,9 @@
 extern "C" {
 #endif
 
+int camopen(const char *transport_name);
+void camdefer(int enable);
+unsigned camflush(void);
 void setcn(unsigned crate_number);
 unsigned getcn(void);
 void execz(void);
@@ -25,12 +28,20 @@ unsigned int camac_16(unsigned n, unsigned a, unsigned f, unsigned *data);
 unsigned int camac_24(unsigned n, unsigned a, unsigned f, unsigned *data);
 unsigned int camac_16w(unsigned n, unsigned a, unsigned f, unsigned data);
 unsigned int camac_24w(unsigned n, unsigned a, unsigned f, unsigned data);
+unsigned int camac_0c(unsigned c, unsigned n, unsigned a, unsigned f);
+unsigned int camac_16c(unsigned c, unsigned n, unsigned a, unsigned f, unsigned *data);
+unsigned int camac_24c(unsigned c, unsigned n, unsigned a, unsigned f, unsigned *data);
+unsigned int camac_16wc(unsigned c, unsigned n, unsigned a, unsigned f, unsigned data);
+unsigned int camac_24wc(unsigned c, unsigned n, unsigned a, unsigned f, unsigned data);
 
 #ifdef __cplusplus
 }
 #endif
 
 
+#define CamOpen camopen
+#define CamDefer camdefer
+#define CamFlush camflush
 #define SetCN setcn
 #define GetCN getcn
 #define ExecZ execz
@@ -45,6 +56,11 @@ unsigned int camac_24w(unsigned n, unsigned a, unsigned f, unsigned data);
 #define Camac24 camac_24
 #define Camac16w camac_16w
 #define Camac24w camac_24w
+#define Camac0C camac_0c
+#define Camac16C camac_16c
+#define Camac24C camac_24c
+#define Camac16wC camac_16wc
+#define Camac24wC camac_24wc
 
 
 #endif